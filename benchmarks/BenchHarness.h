@@ -0,0 +1,176 @@
+/*
+ * A tiny headless microbenchmark harness.
+ *
+ * Every case is run a few times, each run is timed as a whole (the setup
+ * is not timed) and the results are written out as JSON, so the numbers
+ * can be tracked between releases.
+ */
+
+#ifndef BENCHHARNESS_LIBRARY_H
+#define BENCHHARNESS_LIBRARY_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct BenchResult{
+    std::string name;
+    unsigned long long size;        //bytes of text the case works on
+    unsigned long long ops;         //operations per run
+    unsigned long long bytes;       //bytes processed per run, 0 if not meaningful
+    std::vector<double> runsNs;     //wall time of each run
+    std::string note;               //why a case was skipped, empty otherwise
+};
+
+class BenchHarness{
+private:
+    std::vector<BenchResult> results;
+    std::string filter;
+    unsigned repeat;
+
+    /* There is no need for copy construction. */
+    BenchHarness(const BenchHarness &);
+
+    static double Median(std::vector<double> v){
+        if(v.empty())
+            return 0;
+        std::sort(v.begin(),v.end());
+        return v[v.size() / 2];
+    }
+
+    /*
+     * Print a string as a JSON string literal.
+     */
+    static void WriteString(std::ostream &os, const std::string &s){
+        os << '"';
+        for(char ch : s){
+            if(ch == '"' || ch == '\\')
+                os << '\\' << ch;
+            else if((unsigned char)ch < 0x20){
+                char buf[8];
+                snprintf(buf,sizeof(buf),"\\u%04x",ch);
+                os << buf;
+            }
+            else
+                os << ch;
+        }
+        os << '"';
+    }
+
+public:
+    /*
+     * @param f Only cases whose name contains f are run, empty runs everything.
+     * @param r The number of timed runs per case.
+     */
+    BenchHarness(const std::string &f = "", unsigned r = 5):filter(f),repeat(r ? r : 1){}
+
+    /*
+     * Return whether a case would run at all, so callers can skip expensive setup.
+     */
+    bool Selected(const std::string &name) const{
+        return filter.empty() || name.find(filter) != std::string::npos;
+    }
+
+    /*
+     * Time a case.
+     * @param name The name of the case.
+     * @param size The size of the text it works on.
+     * @param ops The number of operations a run performs.
+     * @param bytes The number of bytes a run processes, 0 if not meaningful.
+     * @param setup Run before every run, not timed, may be empty.
+     * @param body The timed part.
+     */
+    void Run(const std::string &name, unsigned long long size, unsigned long long ops, unsigned long long bytes,
+             std::function<void()> setup, std::function<void()> body){
+
+        if(!Selected(name))
+            return;
+
+        BenchResult r;
+        r.name = name;
+        r.size = size;
+        r.ops = ops;
+        r.bytes = bytes;
+
+        for(unsigned i = 0;i < repeat;++i){
+            if(setup)
+                setup();
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            body();
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+            r.runsNs.push_back(std::chrono::duration<double,std::nano>(end - start).count());
+        }
+
+        double med = Median(r.runsNs);
+        std::cerr << name << " size=" << size << " median=" << med / 1e6 << "ms";
+        if(ops && med > 0)
+            std::cerr << " ops/s=" << ops / (med / 1e9);
+        if(bytes && med > 0)
+            std::cerr << " MB/s=" << bytes / (med / 1e9) / (1 << 20);
+        std::cerr << std::endl;
+
+        results.push_back(r);
+    }
+
+    /*
+     * Record a case which can't run in this configuration.
+     */
+    void Skip(const std::string &name, unsigned long long size, const std::string &why){
+
+        if(!Selected(name))
+            return;
+
+        BenchResult r;
+        r.name = name;
+        r.size = size;
+        r.ops = 0;
+        r.bytes = 0;
+        r.note = why;
+        std::cerr << name << " size=" << size << " skipped: " << why << std::endl;
+        results.push_back(r);
+    }
+
+    /*
+     * Write every result as one JSON document.
+     */
+    void WriteJson(std::ostream &os) const{
+
+        os << "{\n  \"timestamp\": " << (long long)std::time(nullptr) << ",\n  \"results\": [";
+        for(size_t i = 0;i < results.size();++i){
+            const BenchResult &r = results[i];
+            os << (i ? ",\n" : "\n") << "    {\"name\": ";
+            WriteString(os,r.name);
+            os << ", \"size\": " << r.size << ", \"ops\": " << r.ops << ", \"bytes\": " << r.bytes;
+
+            if(!r.note.empty()){
+                os << ", \"skipped\": ";
+                WriteString(os,r.note);
+                os << "}";
+                continue;
+            }
+
+            double med = Median(r.runsNs);
+            double mn = *std::min_element(r.runsNs.begin(),r.runsNs.end());
+            double sum = 0;
+            for(double v : r.runsNs)
+                sum += v;
+
+            os << ", \"runs\": " << r.runsNs.size() << ", \"min_ns\": " << (unsigned long long)mn
+               << ", \"median_ns\": " << (unsigned long long)med
+               << ", \"mean_ns\": " << (unsigned long long)(sum / r.runsNs.size());
+            if(r.ops && med > 0)
+                os << ", \"ns_per_op\": " << med / r.ops;
+            if(r.bytes && med > 0)
+                os << ", \"mb_per_s\": " << r.bytes / (med / 1e9) / (1 << 20);
+            os << "}";
+        }
+        os << "\n  ]\n}\n";
+    }
+};
+
+#endif
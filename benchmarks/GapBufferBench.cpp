@@ -0,0 +1,585 @@
+/*
+ * Microbenchmarks of GapBuffer and the editor core operations.
+ * Runs headless, no SDL. A summary goes to stderr, JSON goes to stdout
+ * or to the file given by --json.
+ *
+ * Usage: benchmarks [--sizes 1M,16M,64M] [--filter name] [--repeat n]
+ *                   [--tmpdir dir] [--json out.json]
+ */
+
+#include "GapBuffer.h"
+#include "ColdText.h"
+#include "Arena.h"
+#include "AnchorSet.h"
+#include "StructureIndex.h"
+#include "FoldSet.h"
+#include "LineOps.h"
+#include "BenchHarness.h"
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/* Keeps the compiler from dropping work whose result isn't used. */
+static volatile unsigned long long sink;
+
+/*
+ * Parse sizes like 1M, 512K or 4G.
+ */
+static unsigned long long ParseSize(const std::string &s){
+
+    char *end;
+    unsigned long long v = strtoull(s.c_str(),&end,10);
+    switch(*end){
+        case 'k': case 'K': return v << 10;
+        case 'm': case 'M': return v << 20;
+        case 'g': case 'G': return v << 30;
+        default: return v;
+    }
+}
+
+static std::vector<unsigned long long> ParseSizes(const std::string &list){
+
+    std::vector<unsigned long long> sizes;
+    std::stringstream ss(list);
+    std::string item;
+    while(std::getline(ss,item,','))
+        if(!item.empty())
+            sizes.push_back(ParseSize(item));
+    return sizes;
+}
+
+/*
+ * Text that looks roughly like source code: lines of 60 characters.
+ */
+static void FillText(char *p, unsigned long long n){
+
+    for(unsigned long long i = 0;i < n;++i)
+        p[i] = (i % 61 == 60) ? '\n' : (char)('a' + i % 26);
+}
+
+/*
+ * A buffer holding n characters with the gap at the end.
+ */
+static GapBuffer * MakeBuffer(unsigned long long n){
+
+    GapBuffer *gb = new GapBuffer(GapBuffer::DEFAULT_GAP_BUFFER_SIZE);
+    std::vector<char> chunk(1 << 20);
+    FillText(chunk.data(),chunk.size());
+    while(n > 0){
+        unsigned int len = n < chunk.size() ? n : chunk.size();
+        gb->InsertString(chunk.data(),len);
+        n -= len;
+    }
+    return gb;
+}
+
+/*
+ * Write a file of n characters.
+ */
+static void MakeFile(const std::string &path, unsigned long long n){
+
+    std::ofstream out(path.c_str(),std::ios::binary);
+    std::vector<char> chunk(1 << 20);
+    FillText(chunk.data(),chunk.size());
+    while(n > 0){
+        unsigned long long len = n < chunk.size() ? n : chunk.size();
+        out.write(chunk.data(),len);
+        n -= len;
+    }
+}
+
+static std::string Name(const char *op, unsigned long long size){
+
+    std::ostringstream os;
+    os << op << "/" << size;
+    return os.str();
+}
+
+/*
+ * Typing at the cursor, the gap never moves.
+ */
+static void BenchTyping(BenchHarness &h, unsigned long long size){
+
+    unsigned long long ops = size;
+    std::unique_ptr<GapBuffer> gb;
+
+    h.Run(Name("typing_insert_char",size),size,ops,ops,
+          [&]{ gb.reset(new GapBuffer()); },
+          [&]{
+              for(unsigned long long i = 0;i < ops;++i)
+                  gb->InsertChar((char)('a' + i % 26));
+          });
+
+    h.Run(Name("typing_delete_char",size),size,ops,ops,
+          [&]{ gb.reset(MakeBuffer(size)); },
+          [&]{
+              for(unsigned long long i = 0;i < ops;++i)
+                  gb->DeleteChar();
+          });
+}
+
+/*
+ * Inserts and deletes at random positions, every one of them moves the gap.
+ */
+static void BenchRandomEdits(BenchHarness &h, unsigned long long size){
+
+    /* Each edit moves about a third of the text, keep a run around a few GB moved. */
+    unsigned long long ops = (4ULL << 30) / size;
+    if(ops < 16)
+        ops = 16;
+    if(ops > 100000)
+        ops = 100000;
+
+    std::unique_ptr<GapBuffer> gb;
+    std::vector<unsigned int> pos(ops);
+    std::mt19937 rng(42);
+    for(auto &p : pos)
+        p = rng() % size;
+
+    h.Run(Name("random_insert",size),size,ops,0,
+          [&]{ gb.reset(MakeBuffer(size)); },
+          [&]{
+              for(unsigned long long i = 0;i < ops;++i){
+                  gb->SetCursor(pos[i]);
+                  gb->InsertChar('x');
+              }
+          });
+
+    h.Run(Name("random_delete",size),size,ops,0,
+          [&]{ gb.reset(MakeBuffer(size)); },
+          [&]{
+              for(unsigned long long i = 0;i < ops;++i){
+                  gb->SetCursor(pos[i] + 1 < gb->size() ? pos[i] + 1 : gb->size());
+                  gb->DeleteChar();
+              }
+          });
+}
+
+/*
+ * One big InsertString into the middle of a small buffer, like a paste.
+ */
+static void BenchLargeInsert(BenchHarness &h, unsigned long long size){
+
+    std::unique_ptr<GapBuffer> gb;
+    std::vector<char> data(size);
+    FillText(data.data(),size);
+
+    h.Run(Name("large_insert_string",size),size,1,size,
+          [&]{
+              gb.reset(MakeBuffer(4096));
+              gb->SetCursor(2048);
+          },
+          [&]{ gb->InsertString(data.data(),size); });
+}
+
+/*
+ * Growing from the default size one character at a time,
+ * and explicit doubling of a full buffer.
+ */
+static void BenchExpand(BenchHarness &h, unsigned long long size){
+
+    std::unique_ptr<GapBuffer> gb;
+
+    h.Run(Name("expand_growth",size),size,size,size,
+          [&]{ gb.reset(new GapBuffer(GapBuffer::DEFAULT_GAP_BUFFER_SIZE)); },
+          [&]{
+              for(unsigned long long i = 0;i < size;++i)
+                  gb->InsertChar('g');
+          });
+
+    h.Run(Name("expand_buffer",size),size,1,size,
+          [&]{ gb.reset(MakeBuffer(size)); },
+          [&]{ gb->expand(); });
+}
+
+/*
+ * Walking the cursor over the whole text, one character at a time.
+ */
+static void BenchCursor(BenchHarness &h, unsigned long long size){
+
+    std::unique_ptr<GapBuffer> gb;
+
+    h.Run(Name("cursor_step",size),size,2 * size,0,
+          [&]{
+              gb.reset(MakeBuffer(size));
+              gb->SetCursor(size / 2);
+              gb->InsertChar('c');
+              gb->SetCursor(0);
+          },
+          [&]{
+              for(unsigned long long i = 0;i < size;++i)
+                  gb->CursorForward();
+              for(unsigned long long i = 0;i < size;++i)
+                  gb->CursorBackward();
+              sink = gb->CursorOffset();
+          });
+}
+
+/*
+ * Compressing a buffer, scrolling through it a screen at a time while it
+ * stays compressed, and thawing it back into a buffer.
+ */
+static void BenchCold(BenchHarness &h, unsigned long long size){
+
+    if(!h.Selected(Name("cold_compress",size)) && !h.Selected(Name("cold_scroll",size))
+       && !h.Selected(Name("cold_thaw",size)))
+        return;
+
+    const unsigned SCREEN = 4096;
+    std::unique_ptr<GapBuffer> gb(MakeBuffer(size));
+    std::unique_ptr<ColdText> cold;
+    std::vector<char> screen(SCREEN);
+
+    h.Run(Name("cold_compress",size),size,1,size,
+          [&]{ cold.reset(); },
+          [&]{ cold.reset(new ColdText(*gb)); });
+
+    if(!cold)
+        cold.reset(new ColdText(*gb));
+    std::cerr << "cold text holds " << cold->ResidentBytes() << " bytes for " << size << std::endl;
+
+    h.Run(Name("cold_scroll",size),size,size / SCREEN,size,
+          []{},
+          [&]{
+              for(unsigned long long at = 0;at + SCREEN <= size;at += SCREEN)
+                  sink = cold->Read(at,SCREEN,screen.data());
+          });
+
+    h.Run(Name("cold_thaw",size),size,1,size,
+          [&]{ gb.reset(new GapBuffer()); },
+          [&]{ cold->Thaw(*gb); });
+}
+
+/*
+ * Small objects of mixed sizes coming and going, the way undo records or
+ * line cache entries do: the oldest of a window of live objects is freed
+ * for every new one. Once as heap allocations, once in an arena.
+ */
+static void BenchSmallObjects(BenchHarness &h, unsigned long long size){
+
+    const unsigned LIVE = 4096;
+    unsigned long long ops = size / 64;
+    std::vector<unsigned> sizes(ops);
+    std::mt19937 rng(11);
+    for(unsigned long long i = 0;i < ops;++i)
+        sizes[i] = 16 + rng() % 240;
+    std::vector<void *> live(LIVE,nullptr);
+    std::vector<unsigned> liveSizes(LIVE,0);
+
+    h.Run(Name("heap_churn",size),size,ops,0,
+          []{},
+          [&]{
+              for(unsigned long long i = 0;i < ops;++i){
+                  void *&slot = live[i % LIVE];
+                  ::operator delete(slot);
+                  slot = ::operator new(sizes[i]);
+                  static_cast<char *>(slot)[0] = (char)i;
+              }
+              for(unsigned j = 0;j < LIVE;++j){
+                  ::operator delete(live[j]);
+                  live[j] = nullptr;
+              }
+          });
+
+    std::unique_ptr<Arena> arena;
+    h.Run(Name("arena_churn",size),size,ops,0,
+          [&]{ arena.reset(new Arena); },
+          [&]{
+              for(unsigned long long i = 0;i < ops;++i){
+                  unsigned k = i % LIVE;
+                  arena->Free(live[k],liveSizes[k]);
+                  live[k] = arena->Allocate(sizes[i]);
+                  liveSizes[k] = sizes[i];
+                  static_cast<char *>(live[k])[0] = (char)i;
+              }
+              sink = arena->GetStats().blocks;
+              arena->Reset();
+              for(unsigned j = 0;j < LIVE;++j)
+                  live[j] = nullptr;
+          });
+}
+
+/*
+ * Typing in the middle of a text with an anchor every 64 bytes, a million
+ * of them at 64M, the way search hits would be. Every keystroke moves all
+ * the anchors after it.
+ */
+static void BenchAnchors(BenchHarness &h, unsigned long long size){
+
+    unsigned long long ops = size / 64;
+    std::unique_ptr<GapBuffer> gb;
+    std::unique_ptr<Arena> arena;
+    std::unique_ptr<AnchorSet> anchors;
+
+    h.Run(Name("anchors_typing",size),size,ops,ops,
+          [&]{
+              anchors.reset();
+              arena.reset(new Arena);
+              anchors.reset(new AnchorSet(*arena));
+              for(unsigned long long i = 0;i < size;i += 64)
+                  anchors->Add(i,i % 128 ? GRAVITY::RIGHT : GRAVITY::LEFT);
+              gb.reset(MakeBuffer(size));
+              gb->SetCursor(size / 2);
+              AnchorSet *set = anchors.get();
+              gb->Subscribe([set](const TextChange &c){ set->Apply(c); });
+          },
+          [&]{
+              for(unsigned long long i = 0;i < ops;++i)
+                  gb->InsertChar((char)('a' + i % 26));
+              sink = anchors->Offset(anchors->First());
+          });
+
+    gb.reset();
+    anchors.reset();
+}
+
+/*
+ * Indexing code-like text with about 300K brackets per MB, and typing in
+ * the middle of it with the index following every keystroke.
+ */
+static void BenchStructure(BenchHarness &h, unsigned long long size){
+
+    std::string line = "    if (a[i] == f(b, c)) { x = {1, 2, (3)}; }\n";
+    std::string text;
+    while(text.size() + line.size() <= size)
+        text += line;
+    text.append(size - text.size(),'x');
+
+    std::unique_ptr<GapBuffer> gb;
+    std::unique_ptr<Arena> arena;
+    std::unique_ptr<StructureIndex> index;
+
+    h.Run(Name("structure_build",size),size,1,size,
+          [&]{
+              index.reset();
+              arena.reset(new Arena);
+              gb.reset(new GapBuffer());
+              gb->InsertString(text);
+          },
+          [&]{
+              index.reset(new StructureIndex(*gb,*arena));
+              sink = index->Chunks();
+          });
+
+    unsigned long long ops = 10000;
+    h.Run(Name("structure_typing",size),size,ops,ops,
+          [&]{
+              index.reset();
+              arena.reset(new Arena);
+              gb.reset(new GapBuffer());
+              gb->InsertString(text);
+              index.reset(new StructureIndex(*gb,*arena));
+              gb->SetCursor(size / 2);
+              StructureIndex *structure = index.get();
+              gb->Subscribe([structure](const TextChange &c){ structure->Apply(c); });
+          },
+          [&]{
+              for(unsigned long long i = 0;i < ops;++i)
+                  gb->InsertChar(i % 40 ? (char)('a' + i % 26) : '\n');
+              unsigned int match;
+              sink = index->Match(0,match);
+          });
+
+    index.reset();
+    gb.reset();
+}
+
+/*
+ * Folds hiding 10 of every 20 lines. Scrolling to a random row and
+ * finding the fold after it, as the layout does for every frame, and
+ * typing in the middle with the folds following every keystroke.
+ */
+static void BenchFolds(BenchHarness &h, unsigned long long size){
+
+    std::unique_ptr<GapBuffer> gb;
+    std::unique_ptr<Arena> arena;
+    std::unique_ptr<StructureIndex> index;
+    std::unique_ptr<FoldSet> folds;
+
+    auto setup = [&]{
+        folds.reset();
+        index.reset();
+        arena.reset(new Arena);
+        gb.reset(MakeBuffer(size));
+        index.reset(new StructureIndex(*gb,*arena));
+        folds.reset(new FoldSet(*arena));
+        for(unsigned int line = 1;line + 10 < index->Lines();line += 20)
+            folds->Fold(*index,line,line + 9);
+    };
+
+    unsigned long long ops = 10000;
+    h.Run(Name("folds_scroll",size),size,ops,ops,setup,
+          [&]{
+              std::mt19937 rng(7);
+              unsigned int rows = folds->VisualLines(*index), from, to, lines;
+              for(unsigned long long i = 0;i < ops;++i){
+                  unsigned int line = folds->BufferLine(*index,rng() % rows);
+                  if(folds->Next(*index,index->LineStart(line),from,to,lines))
+                      sink += to - from;
+                  sink += folds->VisualLine(line);
+              }
+          });
+
+    h.Run(Name("folds_typing",size),size,ops,ops,
+          [&]{
+              setup();
+              gb->SetCursor(size / 2);
+              StructureIndex *structure = index.get();
+              FoldSet *f = folds.get();
+              gb->Subscribe([structure,f](const TextChange &c){ structure->Apply(c); f->Apply(*structure,c); });
+          },
+          [&]{
+              for(unsigned long long i = 0;i < ops;++i)
+                  gb->InsertChar(i % 40 ? (char)('a' + i % 26) : '\n');
+              sink = folds->Hidden();
+          });
+
+    folds.reset();
+    index.reset();
+    gb.reset();
+}
+
+/*
+ * Bulk line operations over a whole buffer: a copy of the text is taken,
+ * transformed on all hardware threads and written back as one change.
+ * The lines are shuffled, one in eight repeats an earlier one and one in
+ * four ends in blanks.
+ */
+static void BenchLineOps(BenchHarness &h, unsigned long long size){
+
+    std::mt19937 rng(11);
+    std::string text;
+    text.reserve(size);
+    std::vector<size_t> starts;
+    while(text.size() < size){
+        if(!starts.empty() && rng() % 8 == 0){
+            size_t from = starts[rng() % starts.size()];
+            size_t end = text.find('\n',from);
+            text.append(text,from,end - from + 1);
+            continue;
+        }
+        starts.push_back(text.size());
+        for(unsigned i = 20 + rng() % 60;i > 0;--i)
+            text += (char)('a' + rng() % 26);
+        if(rng() % 4 == 0)
+            text += "  ";
+        text += '\n';
+    }
+    text.resize(size);
+
+    std::unique_ptr<GapBuffer> gb;
+    const LINEOP ops[] = { LINEOP::SORT, LINEOP::UNIQUE, LINEOP::TRIM };
+    const char *names[] = { "lineops_sort", "lineops_unique", "lineops_trim" };
+    for(int i = 0;i < 3;++i){
+        LineOp op(ops[i]);
+        h.Run(Name(names[i],size),size,1,size,
+              [&]{
+                  gb.reset(new GapBuffer());
+                  gb->InsertString(text);
+              },
+              [&]{
+                  std::string before = gb->GetString(0,gb->size()), after;
+                  RunLineOp(op,before.data(),before.size(),after);
+                  sink = ReplaceText(*gb,before,after).inserted;
+              });
+    }
+    gb.reset();
+}
+
+/*
+ * Loading a file into a buffer and saving it back.
+ */
+static void BenchFile(BenchHarness &h, unsigned long long size, const std::string &tmpdir){
+
+    std::string loadName = Name("file_load",size), saveName = Name("file_save",size);
+    if(!h.Selected(loadName) && !h.Selected(saveName))
+        return;
+
+    std::string in = tmpdir + "/gapbuffer_bench_in.txt", out = tmpdir + "/gapbuffer_bench_out.txt";
+    MakeFile(in,size);
+
+    std::unique_ptr<GapBuffer> gb;
+
+    h.Run(loadName,size,1,size,
+          [&]{ gb.reset(); },
+          [&]{ gb.reset(new GapBuffer(in.c_str())); });
+
+    h.Run(saveName,size,1,size,
+          [&]{
+              if(!gb)
+                  gb.reset(new GapBuffer(in.c_str()));
+              gb->SetCursor(size / 2);
+              gb->InsertChar('s');
+          },
+          [&]{
+              if(gb->SaveBufferToFile(out.c_str()))
+                  std::cerr << "can't write " << out << std::endl;
+          });
+
+    gb.reset();
+    std::remove(in.c_str());
+    std::remove(out.c_str());
+}
+
+int main(int argc, char *argv[]){
+
+    std::string sizeList = "1M,16M,64M", filter, tmpdir = "/tmp", jsonFile;
+    unsigned repeat = 5;
+
+    for(int i = 1;i < argc;++i){
+        std::string arg = argv[i];
+        if(arg == "--sizes" && i + 1 < argc)
+            sizeList = argv[++i];
+        else if(arg == "--filter" && i + 1 < argc)
+            filter = argv[++i];
+        else if(arg == "--repeat" && i + 1 < argc)
+            repeat = atoi(argv[++i]);
+        else if(arg == "--tmpdir" && i + 1 < argc)
+            tmpdir = argv[++i];
+        else if(arg == "--json" && i + 1 < argc)
+            jsonFile = argv[++i];
+        else{
+            std::cerr << "Usage: " << argv[0] << " [--sizes 1M,16M,64M] [--filter name] [--repeat n]"
+                      << " [--tmpdir dir] [--json out.json]" << std::endl;
+            return 1;
+        }
+    }
+
+    BenchHarness h(filter,repeat);
+
+    for(unsigned long long size : ParseSizes(sizeList)){
+        /* The buffer counts in unsigned int and keeps twice the file size when loading. */
+        if(size == 0 || size > UINT_MAX / 2){
+            h.Skip(Name("size",size),size,"larger than GapBuffer can hold");
+            continue;
+        }
+        BenchTyping(h,size);
+        BenchRandomEdits(h,size);
+        BenchLargeInsert(h,size);
+        BenchExpand(h,size);
+        BenchCursor(h,size);
+        BenchCold(h,size);
+        BenchSmallObjects(h,size);
+        BenchAnchors(h,size);
+        BenchStructure(h,size);
+        BenchFolds(h,size);
+        BenchLineOps(h,size);
+        BenchFile(h,size,tmpdir);
+    }
+
+    if(jsonFile.empty()){
+        h.WriteJson(std::cout);
+    }else{
+        std::ofstream out(jsonFile.c_str());
+        h.WriteJson(out);
+    }
+    return 0;
+}
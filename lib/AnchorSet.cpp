@@ -0,0 +1,294 @@
+#include "AnchorSet.h"
+
+#include <algorithm>
+#include <new>
+
+/*
+ * A pending collapse (setPending, setOffset) followed by a pending shift
+ * belongs to the children of the node holding it, the node itself is
+ * already up to date.
+ */
+struct AnchorNode{
+    AnchorNode * left;
+    AnchorNode * right;
+    AnchorNode * parent;
+    unsigned int offset;
+    unsigned int priority;
+    GRAVITY gravity;
+    bool setPending;
+    unsigned int setOffset;
+    long long shift;
+};
+
+/*
+ * Collapse and/or shift a whole subtree: the root now, its children later.
+ */
+static void Tag(AnchorNode *t, bool set, unsigned int value, long long shift){
+
+    if(!t)
+        return;
+    if(set){
+        t->offset = value;
+        t->setPending = true;
+        t->setOffset = value;
+        t->shift = 0;
+    }
+    t->offset = (unsigned int)((long long)t->offset + shift);
+    t->shift += shift;
+}
+
+static void Push(AnchorNode *t){
+
+    if(!t->setPending && !t->shift)
+        return;
+    Tag(t->left,t->setPending,t->setOffset,t->shift);
+    Tag(t->right,t->setPending,t->setOffset,t->shift);
+    t->setPending = false;
+    t->shift = 0;
+}
+
+/*
+ * Push the tags of every ancestor, the offset of t is exact afterwards.
+ */
+static void PushPath(AnchorNode *t){
+
+    if(!t->parent)
+        return;
+    PushPath(t->parent);
+    Push(t->parent);
+}
+
+/*
+ * Cut a treap into the anchors before key (at key too if inclusive) and the rest.
+ */
+static void Split(AnchorNode *t, unsigned int key, bool inclusive, AnchorNode *&l, AnchorNode *&r){
+
+    if(!t){
+        l = r = nullptr;
+        return;
+    }
+    Push(t);
+    if(t->offset < key || (inclusive && t->offset == key)){
+        Split(t->right,key,inclusive,t->right,r);
+        if(t->right)
+            t->right->parent = t;
+        l = t;
+    }else{
+        Split(t->left,key,inclusive,l,t->left);
+        if(t->left)
+            t->left->parent = t;
+        r = t;
+    }
+}
+
+/*
+ * Join two treaps, every anchor of a is at or before every anchor of b.
+ */
+static AnchorNode * Merge(AnchorNode *a, AnchorNode *b){
+
+    if(!a)
+        return b;
+    if(!b)
+        return a;
+    if(a->priority > b->priority){
+        Push(a);
+        a->right = Merge(a->right,b);
+        a->right->parent = a;
+        return a;
+    }
+    Push(b);
+    b->left = Merge(a,b->left);
+    b->left->parent = b;
+    return b;
+}
+
+static AnchorNode * Root(AnchorNode *t){
+
+    if(t)
+        t->parent = nullptr;
+    return t;
+}
+
+static void CollectTree(AnchorNode *t, unsigned int from, unsigned int to, std::vector<Anchor> &out){
+
+    if(!t)
+        return;
+    Push(t);
+    if(t->offset >= from)
+        CollectTree(t->left,from,to,out);
+    if(t->offset >= from && t->offset <= to)
+        out.push_back(t);
+    if(t->offset <= to)
+        CollectTree(t->right,from,to,out);
+}
+
+static AnchorNode * NextIn(AnchorNode *t, unsigned int offset){
+
+    AnchorNode *best = nullptr;
+    while(t){
+        Push(t);
+        if(t->offset > offset){
+            best = t;
+            t = t->left;
+        }else{
+            t = t->right;
+        }
+    }
+    return best;
+}
+
+static AnchorNode * FirstIn(AnchorNode *t){
+
+    while(t && (Push(t),t->left))
+        t = t->left;
+    return t;
+}
+
+/*
+ * The earlier of two anchors whose offsets are exact, either may be null.
+ */
+static AnchorNode * Earlier(AnchorNode *a, AnchorNode *b){
+
+    if(!a)
+        return b;
+    if(!b)
+        return a;
+    return b->offset < a->offset ? b : a;
+}
+
+AnchorSet::AnchorSet(Arena &a):arena(a),count(0),seed(2463534242u) {
+
+    roots[0] = roots[1] = nullptr;
+}
+
+AnchorSet::~AnchorSet() {
+
+    Clear();
+}
+
+void AnchorSet::FreeTree(AnchorNode *t) {
+
+    if(!t)
+        return;
+    FreeTree(t->left);
+    FreeTree(t->right);
+    arena.Free(t,sizeof(AnchorNode));
+}
+
+void AnchorSet::Clear() {
+
+    FreeTree(roots[0]);
+    FreeTree(roots[1]);
+    roots[0] = roots[1] = nullptr;
+    count = 0;
+}
+
+Anchor AnchorSet::Add(unsigned int offset, GRAVITY g) {
+
+    AnchorNode *n = new (arena.Allocate(sizeof(AnchorNode))) AnchorNode;
+    n->left = n->right = n->parent = nullptr;
+    n->offset = offset;
+    n->gravity = g;
+    n->setPending = false;
+    n->setOffset = 0;
+    n->shift = 0;
+
+    /* xorshift32 */
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    n->priority = seed;
+
+    AnchorNode *&root = roots[(int)g];
+    AnchorNode *l, *r;
+    Split(root,offset,true,l,r);
+    root = Root(Merge(Merge(Root(l),n),Root(r)));
+    ++count;
+    return n;
+}
+
+void AnchorSet::Remove(Anchor a) {
+
+    PushPath(a);
+    Push(a);
+
+    AnchorNode *m = Merge(a->left,a->right);
+    if(m)
+        m->parent = a->parent;
+    if(!a->parent)
+        roots[(int)a->gravity] = m;
+    else if(a->parent->left == a)
+        a->parent->left = m;
+    else
+        a->parent->right = m;
+
+    arena.Free(a,sizeof(AnchorNode));
+    --count;
+}
+
+unsigned int AnchorSet::Offset(Anchor a) {
+
+    PushPath(a);
+    return a->offset;
+}
+
+GRAVITY AnchorSet::Gravity(Anchor a) const {
+
+    return a->gravity;
+}
+
+/*
+ * The anchors before the edit stay, those in the removed text collapse to
+ * its start (LEFT) or to the end of what replaced it (RIGHT), those after
+ * it shift. An anchor right at an insertion is before it if LEFT.
+ */
+void AnchorSet::Shift(AnchorNode *&t, const TextDelta &d, GRAVITY g) {
+
+    bool right = g == GRAVITY::RIGHT;
+    AnchorNode *before, *rest, *inside, *after;
+
+    Split(t,d.offset,!right,before,rest);
+    Split(Root(rest),d.offset + d.removed,false,inside,after);
+
+    Tag(Root(inside),true,right ? d.offset + d.inserted : d.offset,0);
+    Tag(Root(after),false,0,(long long)d.inserted - d.removed);
+
+    t = Root(Merge(Merge(Root(before),inside),after));
+}
+
+void AnchorSet::Apply(const TextDelta &d) {
+
+    if(roots[0])
+        Shift(roots[0],d,GRAVITY::LEFT);
+    if(roots[1])
+        Shift(roots[1],d,GRAVITY::RIGHT);
+}
+
+void AnchorSet::Apply(const TextChange &c) {
+
+    for(size_t i = 0;i < c.deltas.size();++i)
+        Apply(c.deltas[i]);
+}
+
+/*
+ * Both treaps are walked in order, the two runs are merged.
+ */
+void AnchorSet::Collect(unsigned int from, unsigned int to, std::vector<Anchor> &out) {
+
+    size_t start = out.size();
+    CollectTree(roots[0],from,to,out);
+    size_t middle = out.size();
+    CollectTree(roots[1],from,to,out);
+    std::inplace_merge(out.begin() + start,out.begin() + middle,out.end(),
+        [](const Anchor &a, const Anchor &b){ return a->offset < b->offset; });
+}
+
+Anchor AnchorSet::Next(unsigned int offset) {
+
+    return Earlier(NextIn(roots[0],offset),NextIn(roots[1],offset));
+}
+
+Anchor AnchorSet::First() {
+
+    return Earlier(FirstIn(roots[0]),FirstIn(roots[1]));
+}
@@ -0,0 +1,124 @@
+/*
+ * Positions in a text which follow its edits: bookmarks, selections,
+ * search hits, diagnostics, extra cursors.
+ *
+ * An anchor has a gravity for text inserted right where it is: a LEFT
+ * anchor stays in front of it, a RIGHT anchor moves behind it. An anchor
+ * in text which is removed ends up where the removal was, in front of or
+ * behind what replaced it, by its gravity.
+ *
+ * The anchors of each gravity are kept in a treap ordered by offset,
+ * where a pending shift or collapse is stored on the root of the subtree
+ * it applies to and pushed down only when that subtree is looked into.
+ * An edit splits the treap around the edited range, tags the pieces and
+ * joins them again, so it takes O(log n) however many anchors follow it.
+ * Reading an anchor pushes the tags on its way from the root, O(log n).
+ *
+ * Nodes are allocated from an arena (see Arena.h).
+ */
+
+#ifndef ANCHORSET_LIBRARY_H
+#define ANCHORSET_LIBRARY_H
+
+#include "Arena.h"
+#include "GapBuffer.h"
+#include <vector>
+
+/* Where an anchor goes when text is inserted right at it. */
+enum class GRAVITY{LEFT = 0,RIGHT};
+
+struct AnchorNode;
+
+/* A handle, valid until the anchor is removed or its set destroyed. */
+typedef AnchorNode * Anchor;
+
+class AnchorSet{
+private:
+    Arena &arena;
+    AnchorNode * roots[2];              //by gravity
+    size_t count;
+    unsigned int seed;                  //for the node priorities
+
+    /*
+     * Give the nodes of a subtree back to the arena.
+     */
+    void FreeTree(AnchorNode * t);
+
+    /*
+     * Move the anchors of one treap along with an edit.
+     * @param t The treap, replaced by the result.
+     * @param d The edit.
+     * @param g The gravity of its anchors.
+     */
+    void Shift(AnchorNode * &t, const TextDelta &d, GRAVITY g);
+
+    /* There is no need for copy construction. */
+    AnchorSet(const AnchorSet &);
+
+public:
+    /*
+     * Create an empty set.
+     * @param a The arena the anchors are allocated from, it must outlive the set.
+     */
+    explicit AnchorSet(Arena &a);
+
+    ~AnchorSet();
+
+    /*
+     * Put an anchor at an offset.
+     * @param offset Where.
+     * @param g Where it goes when text is inserted right at it.
+     */
+    Anchor Add(unsigned int offset, GRAVITY g = GRAVITY::LEFT);
+
+    /*
+     * Take an anchor away.
+     * @param a The anchor, its handle is invalid afterwards.
+     */
+    void Remove(Anchor a);
+
+    /*
+     * Return where an anchor is now.
+     */
+    unsigned int Offset(Anchor a);
+
+    GRAVITY Gravity(Anchor a) const;
+
+    /*
+     * Move the anchors along with an edit of the text.
+     * @param d The edit.
+     */
+    void Apply(const TextDelta &d);
+
+    /*
+     * Move the anchors along with a change of the text, delta by delta.
+     * @param c The change.
+     */
+    void Apply(const TextChange &c);
+
+    /*
+     * Find the anchors in [from, to], in the order of their offsets.
+     * @param out The anchors are appended to it.
+     */
+    void Collect(unsigned int from, unsigned int to, std::vector<Anchor> &out);
+
+    /*
+     * Return the first anchor after an offset, null if there is none.
+     * @param offset The offset, an anchor right at it doesn't count.
+     */
+    Anchor Next(unsigned int offset);
+
+    /*
+     * Return the first anchor, null if there is none.
+     */
+    Anchor First();
+
+    size_t Count() const{ return count; }
+
+    /*
+     * Take all anchors away.
+     */
+    void Clear();
+};
+
+#endif
@@ -0,0 +1,179 @@
+#include "Arena.h"
+
+#include <cstring>
+#include <new>
+
+/* Headers are padded so that the pieces after them stay aligned. */
+static size_t Padded(size_t bytes){
+    return (bytes + Arena::MIN_PIECE - 1) / Arena::MIN_PIECE * Arena::MIN_PIECE;
+}
+
+/* Blocks smaller than this would leave no room for the size classes. */
+static const size_t MIN_BLOCK_SIZE = 1 << 10;
+
+Arena::Arena(size_t size):blocks(nullptr),current(nullptr),top(nullptr),end(nullptr),
+                          blockSize(size < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : size),classes(0),large(nullptr) {
+
+    memset(pools,0,sizeof(pools));
+    memset(&stats,0,sizeof(stats));
+
+    /* The largest class is at most a quarter of a block, so little of a block goes unused. */
+    size_t usable = blockSize - Padded(sizeof(Block));
+    for(size_t s = MIN_PIECE;s <= usable / 4 && classes < CLASSES;s <<= 1)
+        ++classes;
+}
+
+Arena::~Arena() {
+
+    Release();
+}
+
+/*
+ * Bump the pointer, blocks kept by Reset() are used again before new ones are taken.
+ */
+void * Arena::Carve(size_t bytes) {
+
+    if(top && (size_t)(end - top) >= bytes){
+        void *p = top;
+        top += bytes;
+        return p;
+    }
+
+    Block *next = current ? current->next : blocks;
+    if(!next){
+        next = static_cast<Block *>(::operator new(blockSize));
+        next->next = nullptr;
+        next->size = blockSize;
+        if(current)
+            current->next = next;
+        else
+            blocks = next;
+        ++stats.blocks;
+        stats.reserved += blockSize;
+    }
+
+    current = next;
+    top = reinterpret_cast<char *>(next) + Padded(sizeof(Block));
+    end = reinterpret_cast<char *>(next) + next->size;
+
+    void *p = top;
+    top += bytes;
+    return p;
+}
+
+/*
+ * Round up to the size class, take a freed piece of that class if there is one.
+ */
+void * Arena::Allocate(size_t bytes) {
+
+    ++stats.allocations;
+
+    unsigned c = 0;
+    size_t s = MIN_PIECE;
+    while(c < classes && s < bytes){
+        s <<= 1;
+        ++c;
+    }
+
+    void *p;
+    if(c == classes){
+        size_t total = Padded(sizeof(Large)) + bytes;
+        Large *l = static_cast<Large *>(::operator new(total));
+        l->prev = nullptr;
+        l->next = large;
+        l->size = total;
+        if(large)
+            large->prev = l;
+        large = l;
+        ++stats.largeAllocations;
+        stats.reserved += total;
+        s = bytes;
+        p = reinterpret_cast<char *>(l) + Padded(sizeof(Large));
+    }else if(pools[c]){
+        FreePiece *piece = pools[c];
+        pools[c] = piece->next;
+        ++stats.poolHits;
+        p = piece;
+    }else{
+        p = Carve(s);
+    }
+
+    stats.inUse += s;
+    if(stats.inUse > stats.peakInUse)
+        stats.peakInUse = stats.inUse;
+    return p;
+}
+
+void Arena::Free(void *p, size_t bytes) {
+
+    if(!p)
+        return;
+    ++stats.frees;
+
+    unsigned c = 0;
+    size_t s = MIN_PIECE;
+    while(c < classes && s < bytes){
+        s <<= 1;
+        ++c;
+    }
+
+    if(c == classes){
+        Large *l = reinterpret_cast<Large *>(static_cast<char *>(p) - Padded(sizeof(Large)));
+        if(l->prev)
+            l->prev->next = l->next;
+        else
+            large = l->next;
+        if(l->next)
+            l->next->prev = l->prev;
+        stats.reserved -= l->size;
+        stats.inUse -= bytes;
+        ::operator delete(l);
+        return;
+    }
+
+    FreePiece *piece = static_cast<FreePiece *>(p);
+    piece->next = pools[c];
+    pools[c] = piece;
+    stats.inUse -= s;
+}
+
+/*
+ * Forget the free lists and start carving from the first block again.
+ */
+void Arena::Reset() {
+
+    while(large){
+        Large *next = large->next;
+        stats.reserved -= large->size;
+        ::operator delete(large);
+        large = next;
+    }
+    memset(pools,0,sizeof(pools));
+    current = nullptr;
+    top = end = nullptr;
+    stats.inUse = 0;
+}
+
+void Arena::Release() {
+
+    Reset();
+    while(blocks){
+        Block *next = blocks->next;
+        stats.reserved -= blocks->size;
+        ::operator delete(blocks);
+        blocks = next;
+    }
+}
+
+/*
+ * Print the counters in a human readable form.
+ */
+void Arena::DumpStats(std::ostream &os, const char *name) const {
+
+    os << name << " arena stats:" << std::endl;
+    os << "  reserved = " << stats.reserved << ", in use = " << stats.inUse
+       << " (peak " << stats.peakInUse << ")" << std::endl;
+    os << "  allocations = " << stats.allocations << " (" << stats.poolHits << " from free lists, "
+       << stats.largeAllocations << " large), frees = " << stats.frees << std::endl;
+    os << "  blocks taken = " << stats.blocks << std::endl;
+}
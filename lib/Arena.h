@@ -0,0 +1,159 @@
+/*
+ * Arena allocator for the many small objects an editor keeps around its
+ * text: undo records, line cache entries, tokens, search matches, layout
+ * scratch.
+ *
+ * Memory is taken from the heap in large blocks and handed out by bumping
+ * a pointer. Sizes are rounded up to a power of two (size classes), a
+ * freed piece goes onto the free list of its class and the next request
+ * of that class takes it back, so a steady state of allocating and
+ * freeing doesn't touch the heap at all. Pieces larger than a quarter of
+ * a block come from the heap one by one.
+ *
+ * Nothing is given back to the heap piece by piece: Reset() takes back
+ * everything handed out at once and keeps the blocks for reuse, and
+ * Release() or the destructor gives all of it back. An arena is meant to
+ * live as long as what it serves, e.g. one per document, released when the
+ * document is closed.
+ *
+ * An arena is not thread-safe, it belongs to the thread that uses it.
+ */
+
+#ifndef ARENA_LIBRARY_H
+#define ARENA_LIBRARY_H
+
+#include <cstddef>
+#include <iostream>
+
+struct ArenaStats{
+    unsigned long long allocations;     //Allocate calls
+    unsigned long long frees;           //Free calls
+    unsigned long long poolHits;        //allocations served from a free list
+    unsigned long long blocks;          //blocks taken from the heap
+    unsigned long long largeAllocations;//allocations too big for a size class
+    size_t reserved;                    //bytes held, blocks and large allocations
+    size_t inUse;                       //bytes handed out and not freed, rounded to the size class
+    size_t peakInUse;
+};
+
+class Arena{
+private:
+    struct Block{
+        Block * next;
+        size_t size;                    //bytes including this header
+    };
+
+    struct FreePiece{
+        FreePiece * next;
+    };
+
+    struct Large{
+        Large * prev;
+        Large * next;
+        size_t size;                    //bytes including this header
+    };
+
+    static const unsigned CLASSES = 32;
+
+    Block * blocks;                     //in the order they were taken
+    Block * current;                    //the block being carved
+    char * top;
+    char * end;
+    size_t blockSize;
+    unsigned classes;                   //size classes in use, the largest is MIN_PIECE << (classes - 1)
+    FreePiece * pools[CLASSES];
+    Large * large;
+    ArenaStats stats;
+
+    /*
+     * Take bytes off the current block, moving on to the next block or a
+     * new one if it doesn't fit.
+     */
+    void * Carve(size_t bytes);
+
+    /* There is no need for copy construction. */
+    Arena(const Arena &);
+    Arena & operator=(const Arena &);
+
+public:
+    static const size_t DEFAULT_BLOCK_SIZE = 64 << 10;
+    static const size_t MIN_PIECE = 16; //the smallest size class, and the alignment of every piece
+
+    /*
+     * Create an empty arena, no memory is taken before the first allocation.
+     * @param blockSize The bytes taken from the heap at a time.
+     */
+    explicit Arena(size_t blockSize = DEFAULT_BLOCK_SIZE);
+
+    ~Arena();
+
+    /*
+     * Return bytes of memory aligned to MIN_PIECE.
+     * Throws std::bad_alloc if the heap has no more.
+     * @param bytes The number of bytes.
+     */
+    void * Allocate(size_t bytes);
+
+    /*
+     * Give a piece back to its size class.
+     * @param p The piece, null does nothing.
+     * @param bytes The number of bytes it was allocated with.
+     */
+    void Free(void * p, size_t bytes);
+
+    /*
+     * Take back everything handed out at once. The blocks are kept for
+     * what is allocated next, large allocations go back to the heap.
+     */
+    void Reset();
+
+    /*
+     * Give all memory back to the heap.
+     */
+    void Release();
+
+    /*
+     * Return the counters.
+     */
+    const ArenaStats & GetStats() const{ return stats; }
+
+    /*
+     * Print the counters in a human readable form.
+     * @param os The output stream to write to.
+     * @param name What the arena is used for.
+     */
+    void DumpStats(std::ostream &os, const char * name) const;
+};
+
+/*
+ * A standard allocator over an arena, so that containers keep their
+ * elements in it. T must not need more alignment than MIN_PIECE.
+ */
+template<class T>
+class ArenaAllocator{
+public:
+    typedef T value_type;
+
+    Arena * arena;
+
+    explicit ArenaAllocator(Arena &a):arena(&a){}
+
+    template<class U>
+    ArenaAllocator(const ArenaAllocator<U> &o):arena(o.arena){}
+
+    T * allocate(size_t n){
+        return static_cast<T *>(arena->Allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T * p, size_t n){
+        arena->Free(p,n * sizeof(T));
+    }
+
+    template<class U>
+    bool operator==(const ArenaAllocator<U> &o) const{ return arena == o.arena; }
+
+    template<class U>
+    bool operator!=(const ArenaAllocator<U> &o) const{ return arena != o.arena; }
+};
+
+#endif
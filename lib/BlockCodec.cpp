@@ -0,0 +1,146 @@
+#include "BlockCodec.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+static const size_t MIN_MATCH = 4;
+static const int HASH_BITS = 13;
+
+static inline unsigned Read32(const unsigned char *p){
+    unsigned v;
+    memcpy(&v,p,4);
+    return v;
+}
+
+static inline unsigned Hash(unsigned v){
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/*
+ * Write the rest of a length which didn't fit into its nibble.
+ */
+static void PutLength(size_t n, std::string &out){
+    while(n >= 255){
+        out += (char)255;
+        n -= 255;
+    }
+    out += (char)n;
+}
+
+/*
+ * Emit one sequence, a match of length 0 marks the last one.
+ */
+static void PutSequence(const unsigned char *literals, size_t litLen, size_t offset, size_t matchLen,
+                        std::string &out){
+
+    size_t m = matchLen ? matchLen - MIN_MATCH : 0;
+    unsigned char token = (unsigned char)(((litLen < 15 ? litLen : 15) << 4) | (m < 15 ? m : 15));
+    out += (char)token;
+    if(litLen >= 15)
+        PutLength(litLen - 15,out);
+    out.append((const char *)literals,litLen);
+
+    if(matchLen == 0)
+        return;
+    out += (char)(offset & 0xFF);
+    out += (char)(offset >> 8);
+    if(m >= 15)
+        PutLength(m - 15,out);
+}
+
+/*
+ * Greedy parse with one hash probe per position.
+ */
+size_t BlockCompress(const char *src, size_t len, std::string &out) {
+
+    if(len > BLOCKCODEC_MAX_BLOCK)
+        throw std::runtime_error("The block is too large.");
+
+    const size_t start = out.size();
+    const unsigned char *in = (const unsigned char *)src;
+    std::vector<unsigned> table(1 << HASH_BITS,0);    //position + 1, 0 is empty
+
+    size_t anchor = 0, i = 0;
+    while(i + MIN_MATCH <= len){
+        unsigned h = Hash(Read32(in + i));
+        size_t candidate = table[h];
+        table[h] = i + 1;
+
+        if(candidate == 0 || i - (candidate - 1) > 0xFFFF || Read32(in + candidate - 1) != Read32(in + i)){
+            ++i;
+            continue;
+        }
+
+        size_t ref = candidate - 1;
+        size_t n = MIN_MATCH;
+        while(i + n < len && in[ref + n] == in[i + n])
+            ++n;
+
+        PutSequence(in + anchor,i - anchor,i - ref,n,out);
+        i += n;
+        anchor = i;
+    }
+
+    PutSequence(in + anchor,len - anchor,0,0,out);
+    return out.size() - start;
+}
+
+/*
+ * Read the rest of a length, false if the block ends first.
+ */
+static bool GetLength(const unsigned char *&ip, const unsigned char *end, size_t &n){
+    unsigned char b;
+    do{
+        if(ip >= end)
+            return false;
+        b = *ip++;
+        n += b;
+    }while(b == 255);
+    return true;
+}
+
+/*
+ * Every length and offset is checked, a corrupt block can't write out of dst.
+ */
+bool BlockDecompress(const char *src, size_t len, char *dst, size_t dstLen) {
+
+    const unsigned char *ip = (const unsigned char *)src, *end = ip + len;
+    char *op = dst, *opEnd = dst + dstLen;
+
+    while(ip < end){
+        unsigned char token = *ip++;
+
+        size_t litLen = token >> 4;
+        if(litLen == 15 && !GetLength(ip,end,litLen))
+            return false;
+        if(litLen > (size_t)(end - ip) || litLen > (size_t)(opEnd - op))
+            return false;
+        memcpy(op,ip,litLen);
+        ip += litLen;
+        op += litLen;
+
+        /* The last sequence has no match. */
+        if(ip == end)
+            break;
+
+        if(end - ip < 2)
+            return false;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t matchLen = token & 15;
+        if(matchLen == 15 && !GetLength(ip,end,matchLen))
+            return false;
+        matchLen += MIN_MATCH;
+
+        if(offset == 0 || offset > (size_t)(op - dst) || matchLen > (size_t)(opEnd - op))
+            return false;
+        /* Byte by byte, the match may overlap what it writes. */
+        const char *ref = op - offset;
+        for(size_t k = 0;k < matchLen;++k)
+            op[k] = ref[k];
+        op += matchLen;
+    }
+
+    return op == opEnd;
+}
@@ -0,0 +1,44 @@
+/*
+ * A small LZ77 block codec, in the spirit of LZ4.
+ *
+ * A block is a run of sequences. Each sequence starts with a token byte,
+ * its high nibble is the number of literals and its low nibble the match
+ * length minus MIN_MATCH; 15 means more length bytes follow (255 means
+ * keep adding). Then come the literals, a 2 byte little-endian match
+ * offset and the extra match length bytes. The last sequence has
+ * literals only. Blocks are at most MAX_BLOCK bytes, so offsets fit in
+ * 16 bits.
+ *
+ * It trades ratio for speed: one hash probe per position, no entropy
+ * coding. Log-like text compresses to well under half.
+ */
+
+#ifndef BLOCKCODEC_LIBRARY_H
+#define BLOCKCODEC_LIBRARY_H
+
+#include <cstddef>
+#include <string>
+
+static const size_t BLOCKCODEC_MAX_BLOCK = 65536;
+
+/*
+ * Compress a block.
+ * Throws std::runtime_error if len is larger than BLOCKCODEC_MAX_BLOCK.
+ * @param src The data.
+ * @param len The number of bytes.
+ * @param out The compressed block is appended here.
+ * @return The number of bytes appended.
+ */
+size_t BlockCompress(const char * src, size_t len, std::string &out);
+
+/*
+ * Decompress a block.
+ * @param src The compressed block.
+ * @param len Its size.
+ * @param dst Where the data goes.
+ * @param dstLen The size the data had, exactly.
+ * @return false if the block is corrupt or doesn't decompress to dstLen bytes.
+ */
+bool BlockDecompress(const char * src, size_t len, char * dst, size_t dstLen);
+
+#endif
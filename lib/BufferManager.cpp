@@ -0,0 +1,366 @@
+#include "BufferManager.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <sys/stat.h>
+
+BufferManager::BufferManager(size_t budgetBytes):active(0),budget(budgetBytes),clock(0),
+                                                 evictions(0),compactions(0),compressions(0),reloads(0) {
+    New();
+}
+
+/*
+ * Add an empty untitled document.
+ */
+size_t BufferManager::New() {
+
+    std::unique_ptr<Document> d(new Document);
+    d->buffer.reset(new GapBuffer);
+    d->arena.reset(new Arena);
+    d->bookmarks.reset(new AnchorSet(*d->arena));
+    d->folds.reset(new FoldSet(*d->arena));
+    Watch(*d);
+    d->cursorOffset = 0;
+    d->modified = false;
+    d->lastUsed = ++clock;
+
+    documents.push_back(std::move(d));
+    active = documents.size() - 1;
+    EnforceBudget();
+    return active;
+}
+
+/*
+ * Open a file, or activate it if it is open already.
+ * An untouched empty untitled document is reused for the file.
+ */
+size_t BufferManager::Open(const std::string &path) {
+
+    int open = Find(path);
+    if(open >= 0){
+        SetActive(open);
+        return open;
+    }
+
+    std::unique_ptr<GapBuffer> buffer(new GapBuffer);
+    buffer->InsertFromFile(path.c_str());
+    buffer->SetCursor(0);
+
+    Document &current = *documents[active];
+    if(!(current.path.empty() && !current.modified && current.buffer && current.buffer->size() == 0)){
+        New();
+    }
+
+    Document &d = *documents[active];
+    d.path = path;
+    d.structure.reset();
+    d.bookmarks->Clear();
+    d.folds->Clear();
+    d.buffer = std::move(buffer);
+    d.disk = std::make_shared<FileSync>(path,*d.buffer);
+    Watch(d);
+    d.lastUsed = ++clock;
+    EnforceBudget();
+    return active;
+}
+
+/*
+ * Close a document.
+ */
+void BufferManager::Close(size_t i) {
+
+    if(i >= documents.size())
+        return;
+
+    documents.erase(documents.begin() + i);
+    if(documents.empty()){
+        New();
+        return;
+    }
+    if(active > i || active == documents.size())
+        --active;
+    SetActive(active);
+}
+
+/*
+ * Make a document active.
+ */
+void BufferManager::SetActive(size_t i) {
+
+    if(i >= documents.size())
+        return;
+
+    active = i;
+    Document &d = *documents[i];
+    d.lastUsed = ++clock;
+    if(!d.buffer)
+        Reload(d);
+    EnforceBudget();
+}
+
+/*
+ * Return the buffer of the active document.
+ */
+GapBuffer & BufferManager::Active() {
+
+    Document &d = *documents[active];
+    if(!d.buffer)
+        Reload(d);
+    return *d.buffer;
+}
+
+StructureIndex & BufferManager::Structure() {
+
+    Active();
+    return StructureOf(*documents[active]);
+}
+
+StructureIndex & BufferManager::StructureOf(Document &d) {
+
+    if(!d.structure)
+        d.structure.reset(new StructureIndex(*d.buffer,*d.arena));
+    return *d.structure;
+}
+
+int BufferManager::Find(const std::string &path) const {
+
+    for(size_t i = 0;i < documents.size();++i)
+        if(documents[i]->path == path)
+            return i;
+    return -1;
+}
+
+/*
+ * Set or clear the modified flag of the active document.
+ * A document found to match its file again takes its text as the synced
+ * text, the file may have changed while it was modified.
+ */
+void BufferManager::SetModified(bool modified) {
+
+    Document &d = *documents[active];
+    if(!modified && d.modified && d.disk && d.buffer)
+        d.disk->Reset(*d.buffer);
+    d.modified = modified;
+}
+
+/*
+ * The FileSync knows what the file holds, the buffer what changed since.
+ */
+SAVEKIND BufferManager::Save(const SavePolicy &policy) {
+
+    Document &d = *documents[active];
+    if(d.path.empty())
+        throw std::runtime_error("The document has no file name.");
+    if(!d.modified)
+        return SAVEKIND::NOTHING;
+
+    GapBuffer &gb = Active();
+    if(!d.disk){
+        /* Nothing is known of the file, all of the text is written. */
+        GapBuffer empty;
+        d.disk = std::make_shared<FileSync>(d.path,empty);
+    }
+    SAVEKIND kind = d.disk->Save(gb,policy);
+    d.modified = false;
+    return kind;
+}
+
+/*
+ * Only a resident, unmodified document still holds what its FileSync remembers.
+ */
+bool BufferManager::SyncWithDisk(size_t i, FileChange &c) {
+
+    Document &d = *documents[i];
+    if(!d.buffer || d.modified || !d.disk)
+        return false;
+    return d.disk->Apply(*d.buffer,c);
+}
+
+/*
+ * Thaw a compressed document or read an evicted one back.
+ * The file may have changed while the document was evicted, its FileSync
+ * still knows the text it was evicted with: the difference moves the
+ * bookmarks and folds as if it had been edited in, and a file which
+ * can't be compared clears them.
+ */
+void BufferManager::Reload(Document &d) {
+
+    FileChange c;
+    c.kind = SYNCKIND::UNCHANGED;
+    c.base = c.offset = c.removed = 0;
+
+    d.buffer.reset(new GapBuffer);
+    try{
+        if(d.cold){
+            d.cold->Thaw(*d.buffer);
+        }else{
+            if(d.disk)
+                c = d.disk->Diff();
+            else
+                c.kind = SYNCKIND::FAILED;
+            d.buffer->InsertFromFile(d.path.c_str());
+            d.disk = std::make_shared<FileSync>(d.path,*d.buffer);
+        }
+    }catch(const std::exception &ex){
+        c.kind = SYNCKIND::FAILED;
+        std::cout << ex.what() << " " << d.path << " is empty now." << std::endl;
+    }
+
+    /* The file may also have changed again between the comparison and the read. */
+    if(!d.cold && c.kind != SYNCKIND::FAILED){
+        unsigned long long expected = (unsigned long long)c.base - c.removed + c.inserted.size();
+        if(c.kind == SYNCKIND::UNCHANGED)
+            expected = c.base;
+        if(expected != d.buffer->size())
+            c.kind = SYNCKIND::FAILED;
+    }
+    if(c.kind == SYNCKIND::FAILED){
+        d.bookmarks->Clear();
+        d.folds->Clear();
+    }else if(c.kind != SYNCKIND::UNCHANGED){
+        TextChange change;
+        change.version = d.buffer->Version();
+        change.deltas.push_back(TextDelta{c.offset,c.removed,(unsigned)c.inserted.size()});
+        d.bookmarks->Apply(change);
+        if(d.folds->Count())
+            d.folds->Apply(StructureOf(d),change);
+    }
+    d.cold.reset();
+    d.buffer->SetCursor(std::min(d.cursorOffset,d.buffer->size()));
+    Watch(d);
+    ++reloads;
+}
+
+/*
+ * Documents don't move, they are held by pointer.
+ */
+void BufferManager::Watch(Document &d) {
+
+    Document *doc = &d;
+    d.buffer->Subscribe([this,doc](const TextChange &c){
+        doc->bookmarks->Apply(c);
+        if(doc->structure)
+            doc->structure->Apply(c);
+        if(doc->folds->Count())
+            doc->folds->Apply(StructureOf(*doc),c);
+        if(changed)
+            changed(*doc,c);
+    });
+}
+
+/*
+ * Compress a cold modified document if it pays, compact it otherwise.
+ */
+size_t BufferManager::Freeze(Document &d) {
+
+    size_t before = d.buffer->capacity();
+
+    std::unique_ptr<ColdText> cold(new ColdText(*d.buffer));
+    if(cold->ResidentBytes() < d.buffer->size()){
+        d.cursorOffset = d.buffer->CursorOffset();
+        d.cold = std::move(cold);
+        d.structure.reset();
+        d.buffer.reset();
+        ++compressions;
+        return before - d.cold->ResidentBytes();
+    }
+
+    if(d.buffer->gap_size() <= GapBuffer::DEFAULT_GAP_BUFFER_SIZE)
+        return 0;
+    d.buffer->ShrinkToFit();
+    ++compactions;
+    return before - d.buffer->capacity();
+}
+
+/*
+ * Copy a part of a document's text without thawing or reloading it.
+ */
+std::string BufferManager::Peek(size_t i, unsigned offset, unsigned len) {
+
+    Document &d = *documents[i];
+    if(d.buffer)
+        return d.buffer->GetString(offset,len);
+
+    std::string s;
+    if(d.cold){
+        s.resize(std::min(len,offset < d.cold->Size() ? d.cold->Size() - offset : 0));
+        if(!s.empty())
+            d.cold->Read(offset,s.size(),&s[0]);
+        return s;
+    }
+
+    std::ifstream in(d.path.c_str(),std::ios::binary);
+    in.seekg(offset);
+    s.resize(len);
+    in.read(&s[0],len);
+    s.resize(in ? len : in.gcount());
+    return s;
+}
+
+/*
+ * Dropping is only safe if the file still holds what the buffer holds.
+ * Comparing sizes is cheap and catches files which were truncated or replaced.
+ */
+bool BufferManager::CanEvict(Document &d) {
+
+    if(d.modified || d.path.empty() || !d.buffer)
+        return false;
+
+    struct stat st;
+    return stat(d.path.c_str(),&st) == 0 && (unsigned long long)st.st_size == d.buffer->size();
+}
+
+/*
+ * Return the bytes held by all buffers.
+ */
+size_t BufferManager::ResidentBytes() const {
+
+    size_t n = 0;
+    for(size_t i = 0;i < documents.size();++i){
+        if(documents[i]->buffer)
+            n += documents[i]->buffer->capacity();
+        if(documents[i]->cold)
+            n += documents[i]->cold->ResidentBytes();
+    }
+    return n;
+}
+
+void BufferManager::SetBudget(size_t budgetBytes) {
+    budget = budgetBytes;
+    EnforceBudget();
+}
+
+/*
+ * Give memory back, coldest documents first.
+ */
+void BufferManager::EnforceBudget() {
+
+    size_t resident = ResidentBytes();
+    if(resident <= budget)
+        return;
+
+    std::vector<Document *> cold;
+    for(size_t i = 0;i < documents.size();++i)
+        if(i != active && documents[i]->buffer)
+            cold.push_back(documents[i].get());
+    std::sort(cold.begin(),cold.end(),[](const Document *a, const Document *b){
+        return a->lastUsed < b->lastUsed;
+    });
+
+    for(size_t i = 0;i < cold.size() && resident > budget;++i){
+        Document &d = *cold[i];
+        size_t before = d.buffer->capacity();
+
+        if(CanEvict(d)){
+            d.cursorOffset = d.buffer->CursorOffset();
+            d.structure.reset();
+            d.buffer.reset();
+            resident -= before;
+            ++evictions;
+        }else{
+            resident -= Freeze(d);
+        }
+    }
+}
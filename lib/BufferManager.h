@@ -0,0 +1,225 @@
+/*
+ * The open documents of a workspace and the memory they may use.
+ *
+ * Every document has its own GapBuffer. When the buffers together hold
+ * more than the budget, the least recently used inactive documents give
+ * memory back: an unmodified document with a file is dropped and read
+ * again from disk when it is next used, a modified one is compressed into
+ * a ColdText (or compacted to its text plus a small gap if it doesn't
+ * compress) and thawed when it is next used. Cold text can be read
+ * without thawing through Peek(). The active document is never touched.
+ */
+
+#ifndef BUFFERMANAGER_LIBRARY_H
+#define BUFFERMANAGER_LIBRARY_H
+
+#include "GapBuffer.h"
+#include "ColdText.h"
+#include "FileSync.h"
+#include "Arena.h"
+#include "AnchorSet.h"
+#include "StructureIndex.h"
+#include "FoldSet.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct Document{
+    std::string path;                   //empty for an untitled document
+    std::unique_ptr<GapBuffer> buffer;  //null while evicted or compressed
+    std::unique_ptr<ColdText> cold;     //the text while compressed
+    unsigned cursorOffset;              //where the cursor was when evicted or compressed
+    bool modified;
+    unsigned long lastUsed;             //LRU clock value of the last use
+    std::shared_ptr<FileSync> disk;     //what the file held when last read, null if untitled
+    std::unique_ptr<Arena> arena;       //small objects kept for the document, released when it is closed
+    std::unique_ptr<AnchorSet> bookmarks;//in the arena, they follow every change of the text
+    std::unique_ptr<StructureIndex> structure;//of the buffer, built when first asked for, null without a buffer
+    std::unique_ptr<FoldSet> folds;     //in the arena, they follow every change of the text
+};
+
+class BufferManager{
+private:
+    std::vector<std::unique_ptr<Document> > documents;
+    size_t active;
+    size_t budget;
+    unsigned long clock;
+
+    unsigned long evictions;
+    unsigned long compactions;
+    unsigned long compressions;
+    unsigned long reloads;
+
+    /* Called with every change of a document's text. */
+    std::function<void(const Document &, const TextChange &)> changed;
+
+    /*
+     * Move the anchors and folds of a document along with the changes of
+     * its buffer, update its structure index and pass the changes on to
+     * changed, once its text is loaded.
+     */
+    void Watch(Document &d);
+
+    /*
+     * Return the structure index of a resident document, indexing its
+     * text if it isn't yet.
+     */
+    StructureIndex & StructureOf(Document &d);
+
+    /*
+     * Give an evicted or compressed document its buffer back.
+     * A file which can't be read any more leaves an empty, unmodified buffer.
+     * Bookmarks and folds follow what changed in the file while it was evicted.
+     */
+    void Reload(Document &d);
+
+    /*
+     * Compress a cold modified document, or compact it if that saves more.
+     * @return The bytes given back.
+     */
+    size_t Freeze(Document &d);
+
+    /*
+     * Return whether dropping d loses nothing: unmodified, and its file
+     * still has the size of the buffer.
+     */
+    static bool CanEvict(Document &d);
+
+    /* There is no need for copy construction. */
+    BufferManager(const BufferManager &);
+
+public:
+    static const size_t DEFAULT_BUDGET = 256 << 20;
+
+    /*
+     * Start with one empty untitled document.
+     * @param budgetBytes How much the buffers may hold together.
+     */
+    explicit BufferManager(size_t budgetBytes = DEFAULT_BUDGET);
+
+    /*
+     * Add an empty untitled document and make it active.
+     * @return Its index.
+     */
+    size_t New();
+
+    /*
+     * Open a file and make it active, an already open file is only activated.
+     * Throws std::runtime_error if the file can't be read.
+     * @param path The name of the file.
+     * @return Its index.
+     */
+    size_t Open(const std::string &path);
+
+    /*
+     * Close a document, the last one is replaced by an empty untitled one.
+     * Its arena goes back to the heap at once.
+     * @param i Its index.
+     */
+    void Close(size_t i);
+
+    /*
+     * Make a document active, reading it back if it was evicted or
+     * thawing it if it was compressed.
+     * @param i Its index.
+     */
+    void SetActive(size_t i);
+
+    /*
+     * Return the buffer of the active document.
+     */
+    GapBuffer & Active();
+
+    /*
+     * Return the bookmarks of the active document.
+     */
+    AnchorSet & Bookmarks(){ return *documents[active]->bookmarks; }
+
+    /*
+     * Return the structure index of the active document, indexing its
+     * text if it isn't yet.
+     */
+    StructureIndex & Structure();
+
+    /*
+     * Return the folds of the active document.
+     */
+    FoldSet & Folds(){ return *documents[active]->folds; }
+
+    /*
+     * Call a function with every change of the text of any document,
+     * whichever buffer holds it at the time.
+     * @param f The function, it must not edit the buffer.
+     */
+    void OnChange(const std::function<void(const Document &, const TextChange &)> &f){ changed = f; }
+
+    size_t ActiveIndex() const{ return active; }
+    size_t Count() const{ return documents.size(); }
+
+    /*
+     * Return a document, its buffer is null while it is evicted or compressed.
+     */
+    const Document & Get(size_t i) const{ return *documents[i]; }
+
+    /*
+     * Copy a part of a document's text without thawing or reloading it.
+     * An evicted document is read from its file.
+     * @param i Its index.
+     * @param offset The offset of the first character.
+     * @param len The number of characters, clipped at the end of text.
+     */
+    std::string Peek(size_t i, unsigned offset, unsigned len);
+
+    /*
+     * Return the index of the document of a file, -1 if it isn't open.
+     * @param path The name it was opened with.
+     */
+    int Find(const std::string &path) const;
+
+    /*
+     * Set or clear the modified flag of the active document. Clearing it
+     * says the buffer holds what the file holds.
+     */
+    void SetModified(bool modified);
+
+    /*
+     * Write the active document to its file if it has edits, and clear
+     * its modified flag.
+     * Throws std::runtime_error if it has no file or can't be written.
+     * @param policy When the file may be written in place.
+     * @return What was written.
+     */
+    SAVEKIND Save(const SavePolicy &policy = SavePolicy());
+
+    /*
+     * Bring an unmodified document up to date with its file.
+     * Documents with edits are left alone, and so are evicted ones, they
+     * are read fresh when next used.
+     * @param i Its index.
+     * @param c A change worked out by Diff() of the document's FileSync.
+     * @return false if the change wasn't applied.
+     */
+    bool SyncWithDisk(size_t i, FileChange &c);
+
+    /*
+     * Return the bytes held by all buffers, gaps and compressed text included.
+     */
+    size_t ResidentBytes() const;
+
+    void SetBudget(size_t budgetBytes);
+    size_t Budget() const{ return budget; }
+
+    /*
+     * Evict, compress or compact cold documents until the buffers fit the budget
+     * or nothing more can be given back.
+     */
+    void EnforceBudget();
+
+    unsigned long Evictions() const{ return evictions; }
+    unsigned long Compactions() const{ return compactions; }
+    unsigned long Compressions() const{ return compressions; }
+    unsigned long Reloads() const{ return reloads; }
+};
+
+#endif
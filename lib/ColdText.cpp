@@ -0,0 +1,113 @@
+#include "ColdText.h"
+#include "BlockCodec.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+/*
+ * Compress the buffer chunk by chunk.
+ */
+ColdText::ColdText(GapBuffer &gb):total(gb.size()),decompressions(0) {
+
+    std::vector<char> text(CHUNK_SIZE);
+
+    for(unsigned offset = 0;offset < total;offset += CHUNK_SIZE){
+        Chunk c;
+        c.size = gb.GetString(offset,CHUNK_SIZE,&text[0]);
+        BlockCompress(&text[0],c.size,c.packed);
+        c.raw = c.packed.size() >= c.size;
+        if(c.raw)
+            c.packed.assign(&text[0],c.size);
+        c.packed.shrink_to_fit();
+        chunks.push_back(std::move(c));
+    }
+}
+
+/*
+ * Return the text of a chunk, decompressing it on a cache miss.
+ */
+const std::string & ColdText::Load(size_t i) {
+
+    for(std::list<std::pair<size_t,std::string> >::iterator it = cache.begin();it != cache.end();++it){
+        if(it->first == i){
+            cache.splice(cache.begin(),cache,it);
+            return cache.front().second;
+        }
+    }
+
+    if(cache.size() >= CACHE_CHUNKS)
+        cache.pop_back();
+    cache.push_front(std::make_pair(i,std::string()));
+
+    const Chunk &c = chunks[i];
+    std::string &text = cache.front().second;
+    if(c.raw){
+        text = c.packed;
+    }else{
+        text.resize(c.size);
+        if(!BlockDecompress(c.packed.data(),c.packed.size(),&text[0],c.size)){
+            cache.pop_front();
+            throw std::runtime_error("A compressed chunk is corrupt.");
+        }
+        ++decompressions;
+    }
+    return text;
+}
+
+/*
+ * Copy a part of the text out, chunk by chunk.
+ */
+unsigned ColdText::Read(unsigned offset, unsigned len, char *out) {
+
+    if(offset >= total)
+        return 0;
+    if(len > total - offset)
+        len = total - offset;
+
+    unsigned copied = 0;
+    while(copied < len){
+        unsigned at = offset + copied;
+        const std::string &text = Load(at / CHUNK_SIZE);
+        unsigned inChunk = at % CHUNK_SIZE;
+        unsigned n = std::min<unsigned>(len - copied,text.size() - inChunk);
+        text.copy(out + copied,n,inChunk);
+        copied += n;
+    }
+    return copied;
+}
+
+/*
+ * Insert the whole text, the gap is sized once.
+ * Chunks are decompressed straight, they don't go through the cache.
+ */
+void ColdText::Thaw(GapBuffer &gb) {
+
+    gb.ReserveGap(total);
+
+    std::string text;
+    for(size_t i = 0;i < chunks.size();++i){
+        const Chunk &c = chunks[i];
+        if(c.raw){
+            gb.InsertString(c.packed.data(),c.size);
+            continue;
+        }
+        text.resize(c.size);
+        if(!BlockDecompress(c.packed.data(),c.packed.size(),&text[0],c.size))
+            throw std::runtime_error("A compressed chunk is corrupt.");
+        ++decompressions;
+        gb.InsertString(text.data(),c.size);
+    }
+}
+
+/*
+ * Return the bytes held.
+ */
+size_t ColdText::ResidentBytes() const {
+
+    size_t n = 0;
+    for(size_t i = 0;i < chunks.size();++i)
+        n += chunks[i].packed.capacity();
+    for(std::list<std::pair<size_t,std::string> >::const_iterator it = cache.begin();it != cache.end();++it)
+        n += it->second.capacity();
+    return n;
+}
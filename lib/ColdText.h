@@ -0,0 +1,85 @@
+/*
+ * Read-only text kept compressed in fixed-size chunks.
+ *
+ * Used for documents nobody is looking at: reads decompress only the chunks
+ * they touch and keep the last few in a small cache, so reading around one
+ * place costs one decompression per chunk. Chunks which don't compress are
+ * stored as they are.
+ */
+
+#ifndef COLDTEXT_LIBRARY_H
+#define COLDTEXT_LIBRARY_H
+
+#include "GapBuffer.h"
+#include <list>
+#include <string>
+#include <utility>
+#include <vector>
+
+class ColdText{
+private:
+    struct Chunk{
+        std::string packed;         //compressed, or the text itself when raw
+        unsigned size;              //characters of text
+        bool raw;
+    };
+
+    std::vector<Chunk> chunks;
+    unsigned total;
+
+    /* Decompressed chunks, most recently used first. */
+    std::list<std::pair<size_t,std::string> > cache;
+
+    unsigned long decompressions;
+
+    /*
+     * Return the text of a chunk through the cache.
+     * Throws std::runtime_error if the chunk is corrupt.
+     */
+    const std::string & Load(size_t i);
+
+    /* There is no need for copy construction. */
+    ColdText(const ColdText &);
+
+public:
+    static const unsigned CHUNK_SIZE = 64 << 10;
+    static const size_t CACHE_CHUNKS = 4;
+
+    /*
+     * Compress the whole text of a buffer, the buffer is left as it is.
+     * @param gb The buffer.
+     */
+    explicit ColdText(GapBuffer &gb);
+
+    /*
+     * Return the number of characters.
+     */
+    unsigned Size() const{ return total; }
+
+    /*
+     * Copy a part of the text out.
+     * @param offset The offset of the first character.
+     * @param len The number of characters, clipped at the end of text.
+     * @param out Where to copy, must hold len characters.
+     * @return The number of characters copied.
+     */
+    unsigned Read(unsigned offset, unsigned len, char * out);
+
+    /*
+     * Insert the whole text into a buffer at its cursor.
+     * @param gb The buffer.
+     */
+    void Thaw(GapBuffer &gb);
+
+    /*
+     * Return the bytes held, compressed chunks plus the cache.
+     */
+    size_t ResidentBytes() const;
+
+    /*
+     * Return how many chunks were decompressed so far, cache hits excluded.
+     */
+    unsigned long Decompressions() const{ return decompressions; }
+};
+
+#endif
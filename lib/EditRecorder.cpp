@@ -0,0 +1,115 @@
+#include "EditRecorder.h"
+
+/* How often the background thread writes the ring out. */
+static const std::chrono::milliseconds FLUSH_INTERVAL(200);
+
+/*
+ * Create the trace file and start the background writer.
+ */
+EditRecorder::EditRecorder(const char *filename, const std::string &startContent, unsigned ringSize):
+        ring(ringSize),writer(filename,startContent),start(std::chrono::steady_clock::now()),
+        stop(false),dropped(0),written(0){
+    flusher = std::thread(&EditRecorder::FlushLoop,this);
+}
+
+/*
+ * Write what is left and close the file.
+ */
+EditRecorder::~EditRecorder() {
+
+    {
+        std::lock_guard<std::mutex> lock(m);
+        stop = true;
+    }
+    wakeUp.notify_one();
+    flusher.join();
+}
+
+/*
+ * Write everything in the ring to the file.
+ */
+void EditRecorder::Drain() {
+
+    TraceRecord r;
+    unsigned long n = 0;
+
+    while(ring.TryPop(r)){
+        writer.Write(r.op,r.timestampUs,r.position,r.length,r.text.data());
+        ++n;
+    }
+
+    if(n){
+        writer.Flush();
+        written += n;
+    }
+}
+
+/*
+ * Body of the background thread.
+ */
+void EditRecorder::FlushLoop() {
+
+    std::unique_lock<std::mutex> lock(m);
+    while(!stop){
+        wakeUp.wait_for(lock,FLUSH_INTERVAL);
+        Drain();
+    }
+    Drain();
+}
+
+/*
+ * The editing thread side, never blocks.
+ */
+void EditRecorder::RecordInsert(unsigned int position, const char *s, unsigned int len) {
+
+    TraceRecord r;
+    r.timestampUs = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    r.op = TRACEOP::INSERT;
+    r.position = position;
+    r.length = len;
+    r.text.assign(s,len);
+
+    if(!ring.TryPush(std::move(r)))
+        ++dropped;
+}
+
+void EditRecorder::RecordDelete(unsigned int position, unsigned int len) {
+
+    TraceRecord r;
+    r.timestampUs = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    r.op = TRACEOP::DELETE;
+    r.position = position;
+    r.length = len;
+
+    if(!ring.TryPush(std::move(r)))
+        ++dropped;
+}
+
+void EditRecorder::RecordCursor(unsigned int position) {
+
+    TraceRecord r;
+    r.timestampUs = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    r.op = TRACEOP::CURSOR;
+    r.position = position;
+    r.length = 0;
+
+    if(!ring.TryPush(std::move(r)))
+        ++dropped;
+}
+
+/*
+ * Return the number of records lost because the ring was full.
+ */
+unsigned long EditRecorder::Dropped() const {
+    return dropped.load();
+}
+
+/*
+ * Return the number of records written to the file.
+ */
+unsigned long EditRecorder::Written() const {
+    return written.load();
+}
@@ -0,0 +1,98 @@
+/*
+ * Records every applied edit and cursor jump of a session into a binary
+ * edit trace (see EditTrace.h), so slow sessions can be replayed with
+ * trace_replay. The trace starts with the text the session starts from.
+ *
+ * The editing thread only pushes records into a preallocated lock-free ring,
+ * a background thread drains the ring and writes the file. Short inserts
+ * (typing) fit into std::string's small buffer, so recording a keystroke
+ * doesn't allocate. If the writer falls behind and the ring is full, records
+ * are dropped and counted rather than blocking the editing thread.
+ */
+
+#ifndef EDITRECORDER_LIBRARY_H
+#define EDITRECORDER_LIBRARY_H
+
+#include "EditTrace.h"
+#include "SpscQueue.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+class EditRecorder{
+private:
+    SpscQueue<TraceRecord> ring;
+    EditTraceWriter writer;
+    std::chrono::steady_clock::time_point start;
+
+    std::thread flusher;
+    std::mutex m;
+    std::condition_variable wakeUp;
+    std::atomic<bool> stop;
+    std::atomic<unsigned long> dropped;
+    std::atomic<unsigned long> written;
+
+    /*
+     * Body of the background thread.
+     */
+    void FlushLoop();
+
+    /*
+     * Write everything in the ring to the file.
+     */
+    void Drain();
+
+    /* There is no need for copy construction. */
+    EditRecorder(const EditRecorder &);
+
+public:
+    static const unsigned DEFAULT_RING_SIZE = 1 << 16;
+
+    /*
+     * Create the trace file and start the background writer.
+     * Throws std::runtime_error if the file can't be created.
+     * @param filename The name of trace file.
+     * @param startContent The text the session starts from.
+     * @param ringSize The number of records the ring holds.
+     */
+    EditRecorder(const char * filename, const std::string &startContent, unsigned ringSize = DEFAULT_RING_SIZE);
+
+    /* Write what is left and close the file. */
+    ~EditRecorder();
+
+    /*
+     * Record an insert, editing thread only.
+     * @param position The offset the text was inserted at.
+     * @param s The inserted characters.
+     * @param len The number of characters.
+     */
+    void RecordInsert(unsigned int position, const char * s, unsigned int len);
+
+    /*
+     * Record a delete, editing thread only.
+     * @param position The offset of the first deleted character.
+     * @param len The number of deleted characters.
+     */
+    void RecordDelete(unsigned int position, unsigned int len);
+
+    /*
+     * Record a cursor jump, editing thread only.
+     * @param position The new offset of the cursor.
+     */
+    void RecordCursor(unsigned int position);
+
+    /*
+     * Return the number of records lost because the ring was full.
+     */
+    unsigned long Dropped() const;
+
+    /*
+     * Return the number of records written to the file.
+     */
+    unsigned long Written() const;
+};
+
+#endif
@@ -0,0 +1,433 @@
+#include "EditTrace.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+static const char TRACE_MAGIC[] = "OOPTRACE";
+static const unsigned char TRACE_VERSION = 2;          //1 has no start content
+
+/*
+ * Read a whole file into memory.
+ */
+static std::string ReadFile(const char *filename){
+
+    std::ifstream in(filename,std::ios::binary);
+    if(!in.is_open())
+        throw std::runtime_error("Can't open this trace file.");
+
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+/*
+ * Binary format, see EditTrace.h.
+ */
+static void ParseBinary(const std::string &data, EditTrace &trace){
+
+    size_t i = sizeof(TRACE_MAGIC) - 1;
+
+    if(i >= data.size() || (unsigned char)data[i] < 1 || (unsigned char)data[i] > TRACE_VERSION)
+        throw std::runtime_error("Unknown trace version.");
+    unsigned char version = data[i++];
+
+    /* Read one varint, 7 bits per byte, low bits first. */
+    auto varint = [&data,&i]() -> unsigned long long{
+        unsigned long long v = 0;
+        for(int shift = 0;shift < 64;shift += 7){
+            if(i >= data.size())
+                throw std::runtime_error("Truncated trace record.");
+            unsigned char b = data[i++];
+            v |= (unsigned long long)(b & 0x7f) << shift;
+            if(!(b & 0x80))
+                return v;
+        }
+        throw std::runtime_error("Bad varint in trace.");
+    };
+
+    if(version >= 2){
+        unsigned long long length = varint();
+        if(data.size() - i < length)
+            throw std::runtime_error("Truncated trace start content.");
+        trace.startContent.assign(data,i,length);
+        i += length;
+    }
+
+    unsigned long long t = 0;
+    while(i < data.size()){
+        TraceRecord r;
+        r.op = static_cast<TRACEOP>(data[i++]);
+        t += varint();
+        r.timestampUs = t;
+        r.position = varint();
+        r.length = varint();
+
+        if(r.op == TRACEOP::INSERT){
+            if(data.size() - i < r.length)
+                throw std::runtime_error("Truncated trace record.");
+            r.text.assign(data,i,r.length);
+            i += r.length;
+        }else if(r.op != TRACEOP::DELETE && r.op != TRACEOP::CURSOR){
+            throw std::runtime_error("Unknown trace operation.");
+        }
+        trace.records.push_back(r);
+    }
+}
+
+/*
+ * Undo the escapes of the text format.
+ */
+static std::string Unescape(const std::string &s){
+
+    std::string out;
+    for(size_t i = 0;i < s.size();++i){
+        if(s[i] != '\\' || i + 1 == s.size()){
+            out += s[i];
+            continue;
+        }
+        char c = s[++i];
+        if(c == 'n')
+            out += '\n';
+        else if(c == 't')
+            out += '\t';
+        else if(c == 'r')
+            out += '\r';
+        else if(c == 's')
+            out += ' ';
+        else if(c == 'x' && i + 2 < s.size()){
+            out += (char)strtol(s.substr(i + 1,2).c_str(),nullptr,16);
+            i += 2;
+        }
+        else
+            out += c;
+    }
+    return out;
+}
+
+/*
+ * Text format, see EditTrace.h.
+ */
+static void ParseText(const std::string &data, EditTrace &trace){
+
+    std::istringstream in(data);
+    std::string line;
+    unsigned lineNo = 0;
+
+    while(std::getline(in,line)){
+        ++lineNo;
+        if(line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream ls(line);
+        char op;
+        TraceRecord r;
+        r.length = 0;
+
+        if(!(ls >> op >> r.timestampUs >> r.position)){
+            std::ostringstream msg;
+            msg << "Bad trace line " << lineNo << ".";
+            throw std::runtime_error(msg.str());
+        }
+
+        r.op = static_cast<TRACEOP>(op);
+        if(r.op == TRACEOP::INSERT){
+            /* Everything after the single separating space is text. */
+            std::string rest;
+            ls.get();
+            std::getline(ls,rest);
+            r.text = Unescape(rest);
+            r.length = r.text.size();
+        }else if(r.op == TRACEOP::DELETE){
+            ls >> r.length;
+        }else if(r.op != TRACEOP::CURSOR){
+            std::ostringstream msg;
+            msg << "Unknown operation on trace line " << lineNo << ".";
+            throw std::runtime_error(msg.str());
+        }
+        trace.records.push_back(r);
+    }
+}
+
+/*
+ * Just enough JSON to read the public editing traces.
+ */
+class TraceJsonReader{
+private:
+    const std::string &d;
+    size_t i;
+
+    void Fail(){
+        std::ostringstream msg;
+        msg << "Bad JSON trace near offset " << i << ".";
+        throw std::runtime_error(msg.str());
+    }
+
+    void SkipSpace(){
+        while(i < d.size() && (d[i] == ' ' || d[i] == '\n' || d[i] == '\r' || d[i] == '\t'))
+            ++i;
+    }
+
+    bool Peek(char c){
+        SkipSpace();
+        return i < d.size() && d[i] == c;
+    }
+
+    void Expect(char c){
+        if(!Peek(c))
+            Fail();
+        ++i;
+    }
+
+    /* Encode a code point as UTF-8. */
+    static void AppendUtf8(std::string &s, unsigned long cp){
+        if(cp < 0x80)
+            s += (char)cp;
+        else if(cp < 0x800){
+            s += (char)(0xc0 | (cp >> 6));
+            s += (char)(0x80 | (cp & 0x3f));
+        }else if(cp < 0x10000){
+            s += (char)(0xe0 | (cp >> 12));
+            s += (char)(0x80 | ((cp >> 6) & 0x3f));
+            s += (char)(0x80 | (cp & 0x3f));
+        }else{
+            s += (char)(0xf0 | (cp >> 18));
+            s += (char)(0x80 | ((cp >> 12) & 0x3f));
+            s += (char)(0x80 | ((cp >> 6) & 0x3f));
+            s += (char)(0x80 | (cp & 0x3f));
+        }
+    }
+
+public:
+    TraceJsonReader(const std::string &data):d(data),i(0){}
+
+    std::string String(){
+        Expect('"');
+        std::string s;
+        while(i < d.size() && d[i] != '"'){
+            char c = d[i++];
+            if(c != '\\'){
+                s += c;
+                continue;
+            }
+            if(i >= d.size())
+                Fail();
+            c = d[i++];
+            switch(c){
+                case 'n': s += '\n'; break;
+                case 't': s += '\t'; break;
+                case 'r': s += '\r'; break;
+                case 'b': s += '\b'; break;
+                case 'f': s += '\f'; break;
+                case 'u':{
+                    if(i + 4 > d.size())
+                        Fail();
+                    unsigned long cp = strtoul(d.substr(i,4).c_str(),nullptr,16);
+                    i += 4;
+                    /* Surrogate pair */
+                    if(cp >= 0xd800 && cp < 0xdc00 && i + 6 <= d.size() && d[i] == '\\' && d[i + 1] == 'u'){
+                        unsigned long lo = strtoul(d.substr(i + 2,4).c_str(),nullptr,16);
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                        i += 6;
+                    }
+                    AppendUtf8(s,cp);
+                    break;
+                }
+                default: s += c;
+            }
+        }
+        Expect('"');
+        return s;
+    }
+
+    double Number(){
+        SkipSpace();
+        const char *start = d.c_str() + i;
+        char *end;
+        double v = strtod(start,&end);
+        if(end == start)
+            Fail();
+        i += end - start;
+        return v;
+    }
+
+    /* Skip any value we are not interested in. */
+    void Skip(){
+        SkipSpace();
+        if(i >= d.size())
+            Fail();
+        if(d[i] == '"'){
+            String();
+        }else if(d[i] == '{'){
+            ++i;
+            if(Peek('}')){ ++i; return; }
+            do{ String(); Expect(':'); Skip(); }while(Next());
+            Expect('}');
+        }else if(d[i] == '['){
+            ++i;
+            if(Peek(']')){ ++i; return; }
+            do{ Skip(); }while(Next());
+            Expect(']');
+        }else if(d.compare(i,4,"true") == 0 || d.compare(i,4,"null") == 0){
+            i += 4;
+        }else if(d.compare(i,5,"false") == 0){
+            i += 5;
+        }else{
+            Number();
+        }
+    }
+
+    /* Consume a ',' between members, return false at the end of a list. */
+    bool Next(){
+        if(Peek(',')){
+            ++i;
+            return true;
+        }
+        return false;
+    }
+
+    /* [position, deleted, "inserted"] */
+    void Patch(EditTrace &trace, unsigned long long t){
+        Expect('[');
+        TraceRecord r;
+        r.timestampUs = t;
+        r.position = Number();
+        Expect(',');
+        r.length = Number();
+        Expect(',');
+        std::string ins = String();
+        Expect(']');
+
+        if(r.length > 0){
+            r.op = TRACEOP::DELETE;
+            trace.records.push_back(r);
+        }
+        if(!ins.empty()){
+            r.op = TRACEOP::INSERT;
+            r.length = ins.size();
+            r.text = ins;
+            trace.records.push_back(r);
+        }
+    }
+
+    /* {"patches": [...], ...} */
+    void Txn(EditTrace &trace, unsigned long long t){
+        Expect('{');
+        if(Peek('}')){ ++i; return; }
+        do{
+            std::string key = String();
+            Expect(':');
+            if(key == "patches"){
+                Expect('[');
+                if(Peek(']')){ ++i; continue; }
+                do{ Patch(trace,t); }while(Next());
+                Expect(']');
+            }else{
+                Skip();
+            }
+        }while(Next());
+        Expect('}');
+    }
+
+    void Trace(EditTrace &trace){
+        Expect('{');
+        if(Peek('}')){ ++i; return; }
+        do{
+            std::string key = String();
+            Expect(':');
+            if(key == "startContent"){
+                trace.startContent = String();
+            }else if(key == "endContent"){
+                trace.endContent = String();
+                trace.hasEndContent = true;
+            }else if(key == "txns"){
+                Expect('[');
+                if(Peek(']')){ ++i; continue; }
+                /* No usable timestamps, keep the order with one microsecond per transaction. */
+                unsigned long long t = 0;
+                do{ Txn(trace,t++); }while(Next());
+                Expect(']');
+            }else{
+                Skip();
+            }
+        }while(Next());
+        Expect('}');
+    }
+};
+
+/*
+ * Load a trace, the format is picked from the first bytes.
+ */
+EditTrace LoadEditTrace(const char *filename){
+
+    std::string data = ReadFile(filename);
+    EditTrace trace;
+    trace.hasEndContent = false;
+
+    size_t first = data.find_first_not_of(" \t\r\n");
+
+    if(data.compare(0,sizeof(TRACE_MAGIC) - 1,TRACE_MAGIC) == 0)
+        ParseBinary(data,trace);
+    else if(first != std::string::npos && data[first] == '{'){
+        TraceJsonReader reader(data);
+        reader.Trace(trace);
+    }
+    else
+        ParseText(data,trace);
+
+    return trace;
+}
+
+/*
+ * Create the file and write the header with the start content.
+ */
+EditTraceWriter::EditTraceWriter(const char *filename, const std::string &startContent):
+        out(filename,std::ios::binary | std::ios::trunc),lastTimestamp(0) {
+
+    if(!out)
+        throw std::runtime_error("Can't create this trace file.");
+
+    out.write(TRACE_MAGIC,sizeof(TRACE_MAGIC) - 1);
+    out.put((char)TRACE_VERSION);
+    WriteVarint(startContent.size());
+    out.write(startContent.data(),startContent.size());
+    if(!out)
+        throw std::runtime_error("Can't write this trace file.");
+}
+
+/*
+ * 7 bits per byte, low bits first, the high bit says another byte follows.
+ */
+void EditTraceWriter::WriteVarint(unsigned long long v) {
+
+    while(v >= 0x80){
+        out.put((char)(0x80 | (v & 0x7f)));
+        v >>= 7;
+    }
+    out.put((char)v);
+}
+
+/*
+ * Append one record, the timestamp is stored relative to the previous one.
+ */
+void EditTraceWriter::Write(TRACEOP op, unsigned long long timestampUs, unsigned int position,
+                            unsigned int length, const char *text) {
+
+    out.put((char)op);
+    WriteVarint(timestampUs >= lastTimestamp ? timestampUs - lastTimestamp : 0);
+    WriteVarint(position);
+    WriteVarint(length);
+    if(op == TRACEOP::INSERT && text)
+        out.write(text,length);
+
+    if(timestampUs > lastTimestamp)
+        lastTimestamp = timestampUs;
+}
+
+/*
+ * Push everything written so far to the file.
+ */
+void EditTraceWriter::Flush() {
+    out.flush();
+}
@@ -0,0 +1,97 @@
+/*
+ * Recorded editing sessions (edit traces).
+ *
+ * A trace is a list of timestamped insert/delete/cursor operations, all
+ * positions are character offsets from the start of the text. Three file
+ * formats are understood when loading:
+ *
+ * 1.Binary, written by EditTraceWriter:
+ *     "OOPTRACE" version(1 byte),
+ *     length(varint) and characters of the start content (version 2 only),
+ *     then per record
+ *     op(1 byte) dt(varint, microseconds since the previous record)
+ *     position(varint) length(varint) [length bytes of text for INSERT]
+ *
+ * 2.Text, one operation per line, '#' starts a comment:
+ *     I <usec> <position> <text, with \n \t \\ \xHH escapes>
+ *     D <usec> <position> <length>
+ *     C <usec> <position>
+ *
+ * 3.JSON in the layout of the public editing traces used in editor research:
+ *     {"startContent": "...", "endContent": "...",
+ *      "txns": [{"patches": [[position, deleted, "inserted"], ...]}, ...]}
+ *   Positions there count unicode characters, so they only match byte
+ *   offsets for ASCII traces. The transactions carry no usable timestamps.
+ */
+
+#ifndef EDITTRACE_LIBRARY_H
+#define EDITTRACE_LIBRARY_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+enum class TRACEOP : unsigned char{INSERT = 'I',DELETE = 'D',CURSOR = 'C'};
+
+struct TraceRecord{
+    unsigned long long timestampUs;     //since the start of the session
+    TRACEOP op;
+    unsigned int position;
+    unsigned int length;                //characters deleted or inserted
+    std::string text;                   //used by INSERT
+};
+
+struct EditTrace{
+    std::string startContent;
+    std::string endContent;             //empty if the format doesn't say
+    bool hasEndContent;
+    std::vector<TraceRecord> records;
+};
+
+/*
+ * Load a trace in any of the formats above.
+ * Throws std::runtime_error if the file can't be read or parsed.
+ * @param filename The name of trace file.
+ */
+EditTrace LoadEditTrace(const char * filename);
+
+/*
+ * Writes traces in the binary format.
+ */
+class EditTraceWriter{
+private:
+    std::ofstream out;
+    unsigned long long lastTimestamp;
+
+    void WriteVarint(unsigned long long v);
+
+    /* There is no need for copy construction. */
+    EditTraceWriter(const EditTraceWriter &);
+
+public:
+    /*
+     * Create the file and write the header.
+     * Throws std::runtime_error if the file can't be created.
+     * @param filename The name of trace file.
+     * @param startContent The text the first record applies to.
+     */
+    explicit EditTraceWriter(const char * filename, const std::string &startContent = std::string());
+
+    /*
+     * Append one record.
+     * @param op The operation.
+     * @param timestampUs Microseconds since the start of the session.
+     * @param position The offset the operation applies to.
+     * @param length Characters deleted or inserted.
+     * @param text The inserted characters, length of them, nullptr otherwise.
+     */
+    void Write(TRACEOP op, unsigned long long timestampUs, unsigned int position,
+               unsigned int length, const char * text);
+
+    /*
+     * Push everything written so far to the file.
+     */
+    void Flush();
+};
+
+#endif
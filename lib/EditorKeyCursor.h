@@ -76,6 +76,16 @@ public:
      */
     inline int get_cursorHeight() const;
 
+    /*
+     * Return the row of cursor
+     */
+    inline unsigned get_row() const;
+
+    /*
+     * Return the column of cursor
+     */
+    inline unsigned get_col() const;
+
     /*
      * Go to next line
      */
@@ -195,6 +205,20 @@ inline int EditorKeyCursor::get_cursorHeight() const{
     return cursorHeight;
 }
 
+/*
+ * Return the row of cursor
+ */
+inline unsigned EditorKeyCursor::get_row() const{
+    return row;
+}
+
+/*
+ * Return the column of cursor
+ */
+inline unsigned EditorKeyCursor::get_col() const{
+    return col;
+}
+
 /*
  * Go to next line
  */
@@ -1,6 +1,13 @@
 #include "EditorWindow.h"
 
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 
 /*
  * Log an SDL error with some error message to the output stream of our choice
@@ -22,6 +29,7 @@ void EditorWindow::logSDLError(std::ostream &os, const std::string &msg) {
  */
 void EditorWindow::renderTexture(SDL_Texture *tex, SDL_Renderer *ren, SDL_Rect dst, SDL_Rect *clip) {
     SDL_RenderCopy(ren, tex, clip, &dst);
+    profiler.Count(FRAMECOUNTER::DRAWCALL);
 }
 
 /*
@@ -60,27 +68,19 @@ void EditorWindow::renderTexture(SDL_Texture *tex, SDL_Renderer *ren, int x, int
  */
 SDL_Texture* EditorWindow::renderText(const std::string &message, const std::string &fontFile, SDL_Color color,
                                       int fontSize, SDL_Renderer *renderer) {
-    //Open the font
-    TTF_Font *font = TTF_OpenFont(fontFile.c_str(), fontSize);
-    if (font == nullptr){
-        logSDLError(std::cout, "TTF_OpenFont");
+    //The font comes from the manager, opened once per file and size
+    TTF_Font *font;
+    try{
+        font = fonts->Get(fontFile, fontSize);
+    }catch(const std::exception &ex){
+        std::cout << ex.what() << std::endl;
         return nullptr;
     }
 
-
-//    int w,h;
-//    if(TTF_SizeText(font,"IIII",&w,&h)) {
-//        // perhaps print the current TTF_GetError(), the string can't be rendered...
-//        std::cout << "ERROR" << std::endl;
-//    } else {
-//        printf("width=%d height=%d\n",w,h);
-//    }
-
     //We need to first render to a surface as that's what TTF_RenderText returns, then
     //load that surface into a texture
     SDL_Surface *surf = TTF_RenderText_Blended(font, message.c_str(), color);
     if (surf == nullptr){
-        TTF_CloseFont(font);
         logSDLError(std::cout, "TTF_RenderText");
         return nullptr;
     }
@@ -88,9 +88,9 @@ SDL_Texture* EditorWindow::renderText(const std::string &message, const std::str
     if (texture == nullptr){
         logSDLError(std::cout, "CreateTexture");
     }
-    //Clean up the surface and font
+    profiler.Count(FRAMECOUNTER::TEXTUREUPLOAD);
+    //Clean up the surface
     SDL_FreeSurface(surf);
-    TTF_CloseFont(font);
     return texture;
 }
 
@@ -121,7 +121,7 @@ Uint32 my_callbackfunc(Uint32 interval, void *param) {
     same interval: */
 
     userevent.type = SDL_USEREVENT;
-    userevent.code = 0;
+    userevent.code = CURSOR_FLASH;
     userevent.data1 = NULL;
     userevent.data2 = NULL;
 
@@ -135,10 +135,20 @@ Uint32 my_callbackfunc(Uint32 interval, void *param) {
 /*
  * Construction function
  */
-EditorWindow::EditorWindow():window(nullptr),renderer(nullptr){
+EditorWindow::EditorWindow(bool offscreen, std::shared_ptr<FontManager> sharedFonts):gb(&buffers.Active()),bufferVersion(0),lastWatchPoll(0),
+                            textVersion(0),lastEdit(0),diffRunning(false),fileVersion(0),lineOpRunning(false),topLine(0),statsInterval(0),lastStatsDump(0),showOverlay(false),
+                            injectRemaining(0),injectSent(0),injectInterval(16),injectTimerID(0),window(nullptr),renderer(nullptr),
+                            timerID(0),offscreen(offscreen),frameSurface(nullptr),
+                            layoutArena(8 * layoutTextSize(MIN_FONT_SIZE)),fonts(sharedFonts),fontSize(FONT_SIZE),snapshots(64),quit(false){
+
+    buffers.OnChange([this](const Document &d, const TextChange &c){ textChanged(d,c); });
+
+    const char *statsEnv = getenv("OOPEDITOR_GB_STATS");
+    if(statsEnv)
+        statsInterval = atoi(statsEnv) * 1000;
 
-    //Start up SDL and make sure it went ok
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) != 0){
+    //Start up SDL and make sure it went ok, offscreen drawing needs no video subsystem
+    if (SDL_Init(offscreen ? SDL_INIT_TIMER : SDL_INIT_VIDEO | SDL_INIT_TIMER) != 0){
         logSDLError(std::cout, "SDL_Init");
         throw std::runtime_error("Can not initialize SDL!!");
     }
@@ -149,6 +159,22 @@ EditorWindow::EditorWindow():window(nullptr),renderer(nullptr){
         SDL_Quit();
         throw std::runtime_error("Can not initialize TTF!!");
     }
+    if (!fonts)
+        fonts.reset(new FontManager);
+
+    if (offscreen){
+        frameSurface = SDL_CreateRGBSurfaceWithFormat(0, SCREEN_WIDTH, SCREEN_HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888);
+        if (frameSurface != nullptr)
+            renderer = SDL_CreateSoftwareRenderer(frameSurface);
+        if (renderer == nullptr){
+            logSDLError(std::cout, "CreateSoftwareRenderer");
+            cleanup(frameSurface);
+            TTF_Quit();
+            SDL_Quit();
+            throw std::runtime_error("Can not create offscreen renderer.");
+        }
+        return;
+    }
 
     //Setup our window and renderere
     window = SDL_CreateWindow("OopEditor", SDL_WINDOWPOS_CENTERED,
@@ -161,108 +187,1441 @@ EditorWindow::EditorWindow():window(nullptr),renderer(nullptr){
         throw std::runtime_error("Can not create window.");
     }
 
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-    if (renderer == nullptr){
-        logSDLError(std::cout, "CreateRenderer");
-        cleanup(window);
+    /* The renderer is created by the render thread, see renderLoop(). */
+    timerID = SDL_AddTimer( 500, my_callbackfunc, nullptr);
+}
+
+
+/*
+ * Decomposition function
+ */
+EditorWindow::~EditorWindow() {
+
+    /* A window is cleaned up by show(). */
+    if (offscreen){
+        atlases.clear();
+        cleanup(renderer, frameSurface);
         TTF_Quit();
         SDL_Quit();
-        throw std::runtime_error("Can not create renderer.");
     }
+}
 
-    timerID = SDL_AddTimer( 500, my_callbackfunc, nullptr);
+/*
+ * Start writing the session to an edit trace, from the text of the
+ * active document.
+ */
+void EditorWindow::startRecording(const char *filename) {
+    recorder.reset(new EditRecorder(filename,gb->GetString(0,gb->size())));
+    recorder->RecordCursor(gb->CursorOffset());
 }
 
+/*
+ * Write the rest of the trace out and close it.
+ */
+void EditorWindow::stopRecording() {
+
+    if(recorder && recorder->Dropped())
+        std::cout << "Edit trace lost " << recorder->Dropped() << " records." << std::endl;
+    recorder.reset();
+}
 
 /*
- * Decomposition function
+ * Write a frame trace when the window is closed.
  */
-EditorWindow::~EditorWindow() {
+void EditorWindow::startProfiling(const char *filename) {
+    profiler.StartTrace(filename);
+}
+
+/*
+ * Open a file as a new document.
+ */
+void EditorWindow::openFile(const char *filename) {
+
+    buffers.Open(filename);
+    activateDocument();
+    if(!watcher.Add(filename))
+        std::cout << "Can't watch " << filename << " for changes." << std::endl;
+}
+
+/*
+ * Limit the memory of all open documents.
+ */
+void EditorWindow::setMemoryBudget(size_t bytes) {
+    buffers.SetBudget(bytes);
+}
+
+/*
+ * Follow the active document after a switch.
+ * A trace holds one text, it ends at a switch.
+ */
+void EditorWindow::activateDocument() {
+
+    if(recorder){
+        std::cout << "Another document is active, the edit trace ends here." << std::endl;
+        stopRecording();
+    }
+    gb = &buffers.Active();
+    ++bufferVersion;
+    ++textVersion;
+    lastEdit = 0;
+    topLine = 0;
+    diff.reset();
+    updateTitle();
+}
+
+/*
+ * Flag the active document as modified, the title shows it.
+ */
+void EditorWindow::markModified() {
+
+    if (!buffers.Get(buffers.ActiveIndex()).modified){
+        buffers.SetModified(true);
+        updateTitle();
+    }
+}
+
+/*
+ * Edits of other documents (a sync of their file) are picked up when
+ * they are activated.
+ */
+void EditorWindow::textChanged(const Document &d, const TextChange &c) {
+
+    (void)c;
+    if(&d != &buffers.Get(buffers.ActiveIndex()))
+        return;
+    ++bufferVersion;
+    ++textVersion;
+    lastEdit = SDL_GetTicks();
+}
+
+/*
+ * Show the name of the active document in the title, '*' if modified.
+ */
+void EditorWindow::updateTitle() {
+
+    if (!window)
+        return;
+    const Document &d = buffers.Get(buffers.ActiveIndex());
+    std::string title = "OopEditor - " + (d.path.empty() ? std::string("untitled") : d.path);
+    if (d.modified)
+        title += " *";
+    SDL_SetWindowTitle(window, title.c_str());
+}
+
+/*
+ * Lay out and draw one frame into frameSurface.
+ */
+void EditorWindow::drawOffscreen() {
+
+    if (!offscreen)
+        throw std::runtime_error("The editor isn't offscreen.");
+    renderFrame(*takeSnapshot());
+}
+
+/*
+ * Draw offscreen and save the frame.
+ */
+bool EditorWindow::saveFrame(const char *filename) {
+
+    drawOffscreen();
+    if (SDL_SaveBMP(frameSurface, filename) != 0){
+        logSDLError(std::cout, "SaveBMP");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Draw offscreen and count the pixels which differ from a golden frame.
+ */
+unsigned long EditorWindow::compareFrame(const char *filename) {
+
+    drawOffscreen();
+
+    SDL_Surface *loaded = SDL_LoadBMP(filename);
+    if (loaded == nullptr){
+        logSDLError(std::cout, "LoadBMP");
+        throw std::runtime_error("Can not load golden frame.");
+    }
+    SDL_Surface *golden = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0);
+    cleanup(loaded);
+    if (golden == nullptr || golden->w != frameSurface->w || golden->h != frameSurface->h){
+        cleanup(golden);
+        throw std::runtime_error("The golden frame doesn't match the frame size.");
+    }
+
+    if (SDL_MUSTLOCK(golden))
+        SDL_LockSurface(golden);
+    if (SDL_MUSTLOCK(frameSurface))
+        SDL_LockSurface(frameSurface);
+
+    unsigned long diff = 0;
+    for (int y = 0;y < golden->h;++y){
+        const Uint32 *a = (const Uint32 *)((const Uint8 *)golden->pixels + y * golden->pitch);
+        const Uint32 *b = (const Uint32 *)((const Uint8 *)frameSurface->pixels + y * frameSurface->pitch);
+        for (int x = 0;x < golden->w;++x)
+            diff += a[x] != b[x];
+    }
+
+    if (SDL_MUSTLOCK(frameSurface))
+        SDL_UnlockSurface(frameSurface);
+    if (SDL_MUSTLOCK(golden))
+        SDL_UnlockSurface(golden);
+    cleanup(golden);
+    return diff;
+}
+
+/*
+ * Time full frames offscreen, layout included.
+ */
+void EditorWindow::benchRender(unsigned frames, std::ostream &os) {
+
+    typedef FrameProfiler::clock clock;
+    std::vector<double> times;
+
+    for (unsigned i = 0;i < frames;++i){
+        clock::time_point start = clock::now();
+        drawOffscreen();
+        times.push_back(std::chrono::duration<double,std::milli>(clock::now() - start).count());
+    }
+    if (times.empty())
+        return;
+
+    FrameStats s = profiler.GetStats();
+    double first = times[0];
+    std::sort(times.begin() + 1,times.end());
+    size_t warm = times.size() - 1;
+
+    os << "render bench: " << frames << " frames, first " << first << "ms";
+    if (warm)
+        os << ", p50 " << times[1 + warm / 2] << "ms, p99 " << times[1 + std::min(warm - 1,warm * 99 / 100)]
+           << "ms, max " << times.back() << "ms";
+    os << std::endl;
+    os << "last frame: " << s.counterLast[(int)FRAMECOUNTER::DRAWCALL] << " draw calls, "
+       << s.counterLast[(int)FRAMECOUNTER::TEXTUREUPLOAD] << " texture uploads, "
+       << s.counterLast[(int)FRAMECOUNTER::GLYPHCACHEMISS] << " glyph cache misses" << std::endl;
+}
+
+/*
+ * Write the latency histogram when the window is closed.
+ */
+void EditorWindow::reportLatency(const char *filename) {
+    latencyFile = filename;
+}
+
+/*
+ * Type synthetic keystrokes once show() runs.
+ */
+void EditorWindow::injectKeys(unsigned n, Uint32 interval) {
+    injectRemaining = n;
+    injectInterval = interval;
+}
+
+/*
+ * Push one synthetic keystroke, runs on the SDL timer thread.
+ * A row of letters is followed by a RETURN, so layout gets exercised too.
+ * SDL_PushEvent stamps the events, the same as real input.
+ */
+Uint32 EditorWindow::injectKey(Uint32 interval, void *param) {
+
+    EditorWindow *w = static_cast<EditorWindow *>(param);
+    SDL_Event event;
+    memset(&event,0,sizeof(event));
+
+    if(w->injectRemaining == 0){
+        event.type = SDL_QUIT;
+        SDL_PushEvent(&event);
+        return 0;
+    }
+
+    if(w->injectSent % w->CHARACTERS_PER_ROW == w->CHARACTERS_PER_ROW - 1){
+        event.type = SDL_KEYDOWN;
+        event.key.keysym.sym = SDLK_RETURN;
+    }else{
+        event.type = SDL_TEXTINPUT;
+        event.text.text[0] = 'a' + w->injectSent % 26;
+    }
+    SDL_PushEvent(&event);
+
+    ++w->injectSent;
+    --w->injectRemaining;
+    return interval;
 }
 
 /*
- * Display the window
+ * Check the watched files now and then.
+ */
+void EditorWindow::pollFiles() {
+
+    if(SDL_GetTicks() - lastWatchPoll < WATCH_INTERVAL)
+        return;
+    lastWatchPoll = SDL_GetTicks();
+
+    std::vector<std::string> changed = watcher.Poll();
+    for(size_t i = 0;i < changed.size();++i)
+        syncFile(changed[i]);
+}
+
+/*
+ * Diff a changed file in the background. The task isn't tied to the
+ * buffer version: typing elsewhere must not drop a sync.
+ */
+void EditorWindow::syncFile(const std::string &path) {
+
+    if(syncing.count(path)){
+        syncing[path] = true;
+        return;
+    }
+
+    int i = buffers.Find(path);
+    if(i < 0){
+        watcher.Remove(path);
+        return;
+    }
+    const Document &d = buffers.Get(i);
+    if(!d.buffer || !d.disk)
+        return;
+    if(d.modified){
+        std::cout << path << " changed on disk, the edits are kept." << std::endl;
+        return;
+    }
+
+    std::shared_ptr<FileSync> disk = d.disk;
+    syncing[path] = false;
+    scheduler.Submit(TASKPRIORITY::BACKGROUND,CancelToken(),[this,path,disk](const CancelToken &){
+        std::shared_ptr<FileChange> c = std::make_shared<FileChange>(disk->Diff());
+        return TaskScheduler::Completion([this,path,disk,c]{ finishSync(path,disk,*c); });
+    },[this,path,disk]{
+        FileChange c;
+        c.kind = SYNCKIND::FAILED;
+        c.error = "the file couldn't be compared with the document.";
+        finishSync(path,disk,c);
+    });
+}
+
+/*
+ * The document may have been closed, reloaded or edited meanwhile,
+ * the FileSync and the buffer size tell.
+ */
+void EditorWindow::finishSync(const std::string &path, const std::shared_ptr<FileSync> &disk, FileChange &c) {
+
+    bool again = syncing[path];
+    syncing.erase(path);
+
+    int i = buffers.Find(path);
+    if(i >= 0 && buffers.Get(i).disk == disk){
+        if(c.kind == SYNCKIND::FAILED)
+            std::cout << path << ": " << c.error << std::endl;
+        else if(c.kind != SYNCKIND::UNCHANGED && buffers.SyncWithDisk(i,c) && (size_t)i == buffers.ActiveIndex()){
+            if(recorder){
+                if(c.removed)
+                    recorder->RecordDelete(c.offset,c.removed);
+                if(!c.inserted.empty())
+                    recorder->RecordInsert(c.offset,c.inserted.data(),c.inserted.size());
+                recorder->RecordCursor(gb->CursorOffset());
+            }
+            publishSnapshot();
+        }
+        if(fileLinesOf == disk){
+            fileLines.reset();
+            ++fileVersion;
+        }
+    }
+
+    if(again)
+        syncFile(path);
+}
+
+/*
+ * Start a diff of the active document if it has a file, has edits, and
+ * its last diff is older than its text.
+ */
+void EditorWindow::pollDiff() {
+
+    const Document &d = buffers.Get(buffers.ActiveIndex());
+    if(diffRunning || !d.disk || !d.modified || (diff && diff->textVersion == textVersion)
+       || SDL_GetTicks() - lastEdit < DIFF_DELAY)
+        return;
+
+    diffRunning = true;
+    std::shared_ptr<std::string> text = std::make_shared<std::string>(gb->GetString(0,gb->size()));
+    std::shared_ptr<FileSync> disk = d.disk;
+    std::shared_ptr<DocumentDiff> r = std::make_shared<DocumentDiff>();
+    r->textVersion = textVersion;
+    r->fileVersion = fileVersion;
+    r->fileLines = fileLinesOf == disk ? fileLines : std::shared_ptr<const LineIndex>();
+
+    /* A cancelled diff still hands over the file lines it read. */
+    runInBackground(TASKPRIORITY::BACKGROUND,[this,text,disk,r](const CancelToken &token){
+        if(!r->fileLines){
+            std::ifstream in(disk->Path().c_str(),std::ios::binary);
+            if(in){
+                std::string file((std::istreambuf_iterator<char>(in)),std::istreambuf_iterator<char>());
+                std::shared_ptr<LineIndex> fl = std::make_shared<LineIndex>();
+                IndexLines(file.data(),file.size(),*fl);
+                r->fileLines = fl;
+            }
+        }
+        if(r->fileLines && !token.IsCancelled()){
+            std::shared_ptr<LineIndex> bl = std::make_shared<LineIndex>();
+            IndexLines(text->data(),text->size(),*bl);
+            if(token.IsCancelled())
+                return TaskScheduler::Completion();
+            r->bufferLines = bl;
+            r->hunks = DiffLines(*r->fileLines,*bl);
+        }
+        return TaskScheduler::Completion([this,disk,r]{ finishDiff(disk,r); });
+    },[this,disk,r]{ finishDiff(disk,r,false); });
+}
+
+/*
+ * A diff of a document which is no longer active, or of text which was
+ * edited meanwhile, is dropped. The file lines are kept unless the file
+ * was saved or synced meanwhile.
+ */
+void EditorWindow::finishDiff(const std::shared_ptr<FileSync> &disk, const std::shared_ptr<const DocumentDiff> &d,
+                              bool complete) {
+
+    diffRunning = false;
+
+    const Document &doc = buffers.Get(buffers.ActiveIndex());
+    if(doc.disk != disk || d->fileVersion != fileVersion)
+        return;
+    if(d->fileLines){
+        fileLines = d->fileLines;
+        fileLinesOf = disk;
+    }
+    if(!complete || d->textVersion != textVersion)
+        return;
+
+    diff = d;
+    if(!d->fileLines){
+        std::cout << "Can't read " << disk->Path() << " to diff against." << std::endl;
+        return;
+    }
+
+    /* No hunks, the edits were undone by hand. */
+    bool modified = !d->hunks.empty();
+    if(modified != doc.modified && !syncing.count(doc.path)){
+        buffers.SetModified(modified);
+        updateTitle();
+    }
+    publishSnapshot();
+}
+
+/*
+ * What the file holds now is the text, an older diff or file index no
+ * longer applies.
+ */
+void EditorWindow::saveDocument() {
+
+    const Document &d = buffers.Get(buffers.ActiveIndex());
+    if(d.path.empty()){
+        std::cout << "An untitled document has no file to save to." << std::endl;
+        return;
+    }
+    if(syncing.count(d.path)){
+        std::cout << d.path << " is being read from disk, save again in a moment." << std::endl;
+        return;
+    }
+
+    static const char * const done[] = {"nothing to write","appended","patched in place","rewritten"};
+    try{
+        SAVEKIND kind = buffers.Save();
+        std::cout << "Saved " << d.path << ", " << done[(int)kind] << "." << std::endl;
+    }catch(const std::exception &ex){
+        std::cout << ex.what() << " " << d.path << std::endl;
+        return;
+    }
+
+    ++fileVersion;
+    diff.reset();
+    fileLines.reset();
+    fileLinesOf.reset();
+    updateTitle();
+    publishSnapshot();
+}
+
+/*
+ * The diff knows where the lines of the hunk are in both versions, the
+ * old text is read back from the file.
+ */
+void EditorWindow::revertHunk() {
+
+    if(!diff || diff->textVersion != textVersion || !diff->fileLines)
+        return;
+
+    const LineIndex &newLines = *diff->bufferLines, &oldLines = *diff->fileLines;
+    unsigned lines = newLines.hashes.size();
+    unsigned cursorOffset = gb->CursorOffset();
+    unsigned line = std::upper_bound(newLines.starts.begin(),newLines.starts.end() - 1,cursorOffset)
+                    - newLines.starts.begin() - 1;
+    if(LineChange(diff->hunks,line,lines) == LINECHANGE::NONE)
+        return;
+
+    const DiffHunk *h = nullptr;
+    for(size_t i = 0;i < diff->hunks.size() && !h;++i){
+        const DiffHunk &c = diff->hunks[i];
+        if((line >= c.newLine && line < c.newLine + std::max(c.newCount,1u))
+           || (c.newCount == 0 && c.newLine >= lines && line + 1 == lines))
+            h = &c;
+    }
+    if(!h)
+        return;
+
+    unsigned from = newLines.starts[h->newLine], to = newLines.starts[h->newLine + h->newCount];
+    unsigned oldFrom = oldLines.starts[h->oldLine], oldTo = oldLines.starts[h->oldLine + h->oldCount];
+
+    std::ifstream in(buffers.Get(buffers.ActiveIndex()).path.c_str(),std::ios::binary | std::ios::ate);
+    if(!in || (unsigned long long)in.tellg() != oldLines.starts.back()){
+        std::cout << "The file changed on disk, the hunk isn't reverted." << std::endl;
+        return;
+    }
+    std::string old(oldTo - oldFrom,'\0');
+    in.seekg(oldFrom);
+    if(!old.empty() && !in.read(&old[0],old.size()))
+        return;
+
+    {
+        GapBuffer::Transaction t(*gb);
+        gb->SetCursor(to);
+        if(to > from){
+            if(recorder)
+                recorder->RecordDelete(from,to - from);
+            gb->DeleteString(to - from);
+        }
+        if(!old.empty()){
+            if(recorder)
+                recorder->RecordInsert(from,old.data(),old.size());
+            gb->InsertString(old);
+        }
+        gb->SetCursor(from);
+    }
+    if(recorder)
+        recorder->RecordCursor(from);
+    markModified();
+}
+
+/*
+ * The transform runs on a worker, its own threads under it.
+ */
+void EditorWindow::runLineOp(const LineOp &op) {
+
+    if(lineOpRunning)
+        return;
+    lineOpRunning = true;
+
+    std::shared_ptr<const std::string> before = std::make_shared<std::string>(gb->GetString(0,gb->size()));
+    unsigned long version = textVersion;
+    runInBackground(TASKPRIORITY::BACKGROUND,[this,op,before,version](const CancelToken &token){
+        std::shared_ptr<std::string> after = std::make_shared<std::string>();
+        if(!RunLineOp(op,before->data(),before->size(),*after,0,[&token]{ return token.IsCancelled(); }))
+            return TaskScheduler::Completion();
+        return TaskScheduler::Completion([this,before,after,version]{ finishLineOp(version,before,after); });
+    },[this,version]{
+        lineOpRunning = false;
+        if(version != textVersion)
+            std::cout << "The text changed meanwhile, the line operation is dropped." << std::endl;
+    });
+}
+
+void EditorWindow::finishLineOp(unsigned long version, const std::shared_ptr<const std::string> &before,
+                                const std::shared_ptr<const std::string> &after) {
+
+    lineOpRunning = false;
+    if(version != textVersion){
+        std::cout << "The text changed meanwhile, the line operation is dropped." << std::endl;
+        return;
+    }
+
+    TextDelta d = ReplaceText(*gb,*before,*after);
+    if(d.removed == 0 && d.inserted == 0)
+        return;
+    if(recorder){
+        if(d.removed)
+            recorder->RecordDelete(d.offset,d.removed);
+        if(d.inserted)
+            recorder->RecordInsert(d.offset,after->data() + d.offset,d.inserted);
+        recorder->RecordCursor(gb->CursorOffset());
+    }
+    markModified();
+}
+
+/*
+ * A bookmark stays in front of text typed at it.
+ */
+void EditorWindow::toggleBookmark() {
+
+    AnchorSet &marks = buffers.Bookmarks();
+    unsigned cursorOffset = gb->CursorOffset();
+    std::vector<Anchor> here;
+    marks.Collect(cursorOffset,cursorOffset,here);
+    if(here.empty())
+        marks.Add(cursorOffset,GRAVITY::LEFT);
+    for(size_t i = 0;i < here.size();++i)
+        marks.Remove(here[i]);
+}
+
+void EditorWindow::nextBookmark() {
+
+    AnchorSet &marks = buffers.Bookmarks();
+    Anchor a = marks.Next(gb->CursorOffset());
+    if(!a)
+        a = marks.First();
+    if(!a)
+        return;
+
+    jumpTo(marks.Offset(a));
+}
+
+void EditorWindow::matchBracket() {
+
+    StructureIndex &structure = buffers.Structure();
+    unsigned cursorOffset = gb->CursorOffset(), match;
+    if(structure.Match(cursorOffset,match) || (cursorOffset > 0 && structure.Match(cursorOffset - 1,match)))
+        jumpTo(match);
+}
+
+void EditorWindow::enclosingBlock() {
+
+    unsigned open, close;
+    if(buffers.Structure().Enclosing(gb->CursorOffset(),open,close))
+        jumpTo(open);
+}
+
+void EditorWindow::foldBlock() {
+
+    StructureIndex &structure = buffers.Structure();
+    unsigned cursorOffset = gb->CursorOffset();
+    unsigned line = structure.LineOf(cursorOffset);
+    unsigned first = line + 1, last = line;
+
+    /* The last character of the line which isn't blank. */
+    unsigned start = structure.LineStart(line), end = structure.LineStart(line + 1);
+    if(end > start && line + 1 < structure.Lines())
+        --end;
+    char ch = ' ';
+    while(end > start && gb->GetString(end - 1,1,&ch) == 1 && isspace((unsigned char)ch))
+        --end;
+
+    unsigned open, close;
+    if(end > start && structure.Match(end - 1,close) && close > end - 1)
+        last = structure.LineOf(close) - 1;
+    if(last < first)
+        last = structure.BlockEnd(line);
+    if(last < first && structure.Enclosing(cursorOffset,open,close)){
+        first = structure.LineOf(open) + 1;
+        last = close < gb->size() ? structure.LineOf(close) : structure.Lines();
+        last = last > first ? last - 1 : 0;
+    }
+
+    if(!buffers.Folds().Fold(structure,first,last))
+        return;
+    skipFolds(false);
+    jumpTo(gb->CursorOffset());
+}
+
+void EditorWindow::unfoldBlock() {
+
+    StructureIndex &structure = buffers.Structure();
+    if(buffers.Folds().Unfold(structure.LineOf(gb->CursorOffset())))
+        ++bufferVersion;
+}
+
+void EditorWindow::moveLines(int count) {
+
+    StructureIndex &structure = buffers.Structure();
+    FoldSet &folds = buffers.Folds();
+    unsigned cursorOffset = gb->CursorOffset();
+    unsigned line = structure.LineOf(cursorOffset);
+    unsigned column = cursorOffset - structure.LineStart(line);
+
+    long long row = (long long)folds.VisualLine(line) + count;
+    row = std::max(0LL,std::min(row,(long long)folds.VisualLines(structure) - 1));
+    line = folds.BufferLine(structure,(unsigned)row);
+
+    unsigned start = structure.LineStart(line), end = structure.LineStart(line + 1);
+    if(end > start && line + 1 < structure.Lines())
+        --end;
+    jumpTo(start + std::min(column,end - start));
+}
+
+void EditorWindow::skipFolds(bool forward) {
+
+    FoldSet &folds = buffers.Folds();
+    if(!folds.Count())
+        return;
+
+    StructureIndex &structure = buffers.Structure();
+    unsigned line = structure.LineOf(gb->CursorOffset());
+    unsigned row = folds.VisualLine(line);
+    unsigned header = folds.BufferLine(structure,row);
+    if(header == line)
+        return;
+
+    if(forward && row + 1 < folds.VisualLines(structure))
+        gb->SetCursor(structure.LineStart(folds.BufferLine(structure,row + 1)));
+    else
+        gb->SetCursor(structure.LineStart(header + 1) - 1);
+}
+
+void EditorWindow::jumpTo(unsigned offset) {
+
+    gb->SetCursor(offset);
+    if(recorder)
+        recorder->RecordCursor(offset);
+    ++bufferVersion;
+}
+
+/*
+ * Run work off the SDL thread, tied to the current buffer version.
+ */
+void EditorWindow::runInBackground(TASKPRIORITY p, TaskScheduler::Work w, TaskScheduler::Completion onFailure) {
+    scheduler.Submit(p,CancelToken(&textVersion),w,onFailure);
+}
+
+/*
+ * Turn an SDL event into an edit command.
+ * Return false if the event doesn't edit anything.
+ */
+bool EditorWindow::translateEvent(const SDL_Event &ev, EditCommand &c) {
+
+    c.count = 1;
+
+    if(ev.type == SDL_TEXTINPUT){
+        c.type = EDITTYPE::INSERTSTRING;
+        c.text = ev.text.text;
+        return true;
+    }
+
+    if(ev.type != SDL_KEYDOWN)
+        return false;
+
+    /* A paste is one insert however large it is, see applyCommand(). */
+    if(ev.key.keysym.sym == SDLK_v && (ev.key.keysym.mod & KMOD_CTRL)){
+        c.type = EDITTYPE::PASTE;
+        return true;
+    }
+
+    switch(ev.key.keysym.sym){
+        case SDLK_BACKSPACE:
+            c.type = EDITTYPE::DELETESTRING;
+            return true;
+        case SDLK_RETURN:
+            c.type = EDITTYPE::INSERTSTRING;
+            c.text = "\n";
+            return true;
+        case SDLK_LEFT:
+            c.type = EDITTYPE::CURSORBACKWARD;
+            return true;
+        case SDLK_RIGHT:
+            c.type = EDITTYPE::CURSORFORWARD;
+            return true;
+        case SDLK_UP:
+            c.type = EDITTYPE::CURSORUP;
+            return true;
+        case SDLK_DOWN:
+            c.type = EDITTYPE::CURSORDOWN;
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Fold c into pending if they form one run.
+ * Typing followed by backspace eats into the pending insert.
+ */
+bool EditorWindow::mergeCommand(EditCommand &pending, const EditCommand &c) {
+
+    if(pending.type == EDITTYPE::INSERTSTRING && c.type == EDITTYPE::DELETESTRING
+       && c.count <= pending.text.size()){
+        pending.text.resize(pending.text.size() - c.count);
+        return true;
+    }
+
+    if(pending.type != c.type || c.type == EDITTYPE::PASTE)
+        return false;
+
+    if(c.type == EDITTYPE::INSERTSTRING)
+        pending.text += c.text;
+    else
+        pending.count += c.count;
+    return true;
+}
+
+/*
+ * Apply an edit command to the buffer.
+ * Only the input thread touches the buffer.
+ */
+void EditorWindow::applyCommand(const EditCommand &c) {
+
+    unsigned n;
+    char *clip;
+
+    switch(c.type){
+        case EDITTYPE::INSERTSTRING:
+            if(c.text.empty())
+                return;
+            if(recorder)
+                recorder->RecordInsert(gb->CursorOffset(),c.text.data(),c.text.size());
+            gb->InsertString(c.text);
+            markModified();
+            break;
+        case EDITTYPE::DELETESTRING:
+            n = gb->CursorOffset();
+            if(n == 0)
+                return;
+            n = c.count < n ? c.count : n;
+            if(recorder)
+                recorder->RecordDelete(gb->CursorOffset() - n,n);
+            gb->DeleteString(n);
+            markModified();
+            break;
+        case EDITTYPE::PASTE:
+            /* The clipboard is copied straight into the gap, no intermediate string. */
+            clip = SDL_GetClipboardText();
+            if(!clip)
+                return;
+            n = strlen(clip);
+            if(recorder)
+                recorder->RecordInsert(gb->CursorOffset(),clip,n);
+            gb->InsertString(clip,n);
+            markModified();
+            SDL_free(clip);
+            break;
+        case EDITTYPE::CURSORFORWARD:
+            for(n = 0;n < c.count;++n)
+                gb->CursorForward();
+            skipFolds(true);
+            if(recorder)
+                recorder->RecordCursor(gb->CursorOffset());
+            /* Text changes bump the version through textChanged(). */
+            ++bufferVersion;
+            break;
+        case EDITTYPE::CURSORBACKWARD:
+            for(n = 0;n < c.count;++n)
+                gb->CursorBackward();
+            skipFolds(false);
+            if(recorder)
+                recorder->RecordCursor(gb->CursorOffset());
+            ++bufferVersion;
+            break;
+        case EDITTYPE::CURSORUP:
+            moveLines(-(int)c.count);
+            break;
+        case EDITTYPE::CURSORDOWN:
+            moveLines((int)c.count);
+            break;
+    }
+}
+
+/*
+ * Lay out the visible part of the buffer.
+ * A row ends at '\n' or after charactersPerRowFor(fontSize) characters.
+ * The view starts at topLine, which follows the cursor. Folded lines are
+ * never read: the layout reads up to a fold and goes on after it.
+ */
+std::shared_ptr<const EditorSnapshot> EditorWindow::takeSnapshot() {
+
+    FrameProfiler::Scope scope(profiler,FRAMEPHASE::LAYOUT);
+
+    std::shared_ptr<EditorSnapshot> snap(new EditorSnapshot);
+    snap->version = bufferVersion;
+    snap->cursor = cursor;
+    snap->overlay = showOverlay;
+    snap->inputs.swap(pendingInputs);
+    snap->fontSize = fontSize;
+    snap->rowHeight = rowHeightFor(fontSize);
+
+    const unsigned charactersPerRow = charactersPerRowFor(fontSize);
+    unsigned visibleRows = SCREEN_HEIGHT / snap->rowHeight + 1;
+
+    layoutArena.Reset();
+    unsigned headSize = layoutTextSize(fontSize);
+    char *head = static_cast<char *>(layoutArena.Allocate(headSize));
+    unsigned cursorOffset = gb->CursorOffset();
+    FoldSet &folds = buffers.Folds();
+
+    /*
+     * A short text at the top of the view, without folds, is laid out
+     * without the structure index, it is built once the view has to move.
+     */
+    StructureIndex *structure = nullptr;
+    if(topLine > 0 || folds.Count() || cursorOffset >= headSize){
+        structure = &buffers.Structure();
+        unsigned lines = structure->Lines();
+        unsigned row = folds.VisualLine(structure->LineOf(cursorOffset));
+        unsigned top = folds.VisualLine(std::min(topLine,lines - 1));
+        /* The last row may be cut off, the cursor is kept above it. */
+        if(row < top)
+            top = row;
+        else if(row + 2 > top + visibleRows)
+            top = row + 2 - visibleRows;
+        topLine = folds.BufferLine(*structure,top);
+    }
+
+    /* Off screen until we find it. */
+    unsigned cursorRow = visibleRows, cursorCol = 0;
+    std::string line;
+
+    /* The buffer line every row belongs to, for the gutter marks. */
+    std::vector<unsigned,ArenaAllocator<unsigned> > rowLines((ArenaAllocator<unsigned>(layoutArena)));
+    rowLines.reserve(visibleRows);
+    snap->rows.reserve(visibleRows);
+
+    /* Long wrapped lines may still push the cursor off, then the view starts a line further. */
+    for(;;){
+        snap->rows.clear();
+        snap->foldedRows.clear();
+        rowLines.clear();
+        line.clear();
+        cursorRow = visibleRows;
+        cursorCol = 0;
+
+        unsigned pos = structure ? structure->LineStart(topLine) : 0;
+        unsigned lineNumber = structure ? topLine : 0;
+        unsigned foldFrom = UINT_MAX, foldTo = 0, foldLines = 0;
+        if(structure && folds.Count() && !folds.Next(*structure,pos,foldFrom,foldTo,foldLines))
+            foldFrom = UINT_MAX;
+
+        for(;;){
+            unsigned n = std::min(foldFrom - pos,(visibleRows - (unsigned)snap->rows.size()) * (charactersPerRow + 1));
+            n = gb->GetString(pos,std::min(n,headSize),head);
+            unsigned i = 0;
+            for(;i < n && snap->rows.size() < visibleRows;++i){
+                if(pos + i == cursorOffset){
+                    cursorRow = snap->rows.size();
+                    cursorCol = line.size();
+                }
+                if(head[i] == '\n'){
+                    snap->rows.push_back(line);
+                    rowLines.push_back(lineNumber++);
+                    line.clear();
+                    continue;
+                }
+                line += head[i];
+                if(line.size() == charactersPerRow){
+                    snap->rows.push_back(line);
+                    rowLines.push_back(lineNumber);
+                    line.clear();
+                }
+            }
+            pos += i;
+            if(pos != foldFrom || snap->rows.size() >= visibleRows)
+                break;
+
+            /* The header row was the last one pushed, the fold's lines are skipped unread. */
+            if(!snap->rows.empty())
+                snap->foldedRows.push_back(snap->rows.size() - 1);
+            lineNumber += foldLines;
+            pos = foldTo;
+            if(!folds.Next(*structure,pos,foldFrom,foldTo,foldLines))
+                foldFrom = UINT_MAX;
+        }
+
+        if(pos == cursorOffset && snap->rows.size() < visibleRows){
+            cursorRow = snap->rows.size();
+            cursorCol = line.size();
+        }
+        if(!line.empty() && snap->rows.size() < visibleRows){
+            snap->rows.push_back(line);
+            rowLines.push_back(lineNumber);
+        }
+
+        if(cursorRow + 1 < visibleRows || cursorOffset < pos)
+            break;
+        if(!structure)
+            structure = &buffers.Structure();
+        unsigned next = folds.BufferLine(*structure,folds.VisualLine(topLine) + 1);
+        if(next <= topLine || next > structure->LineOf(cursorOffset))
+            break;
+        topLine = next;
+    }
+
+    /* A diff a few keystrokes old still marks about the right lines until the next one is in. */
+    if(diff && diff->bufferLines && !diff->hunks.empty()){
+        unsigned lines = diff->bufferLines->hashes.size();
+        for(unsigned r = 0;r < rowLines.size();++r)
+            snap->marks.push_back(rowLines[r] < lines ? LineChange(diff->hunks,rowLines[r],lines) : LINECHANGE::NONE);
+    }
+
+    snap->cursor.set(cursorRow,cursorCol);
+    return snap;
+}
+
+/*
+ * Hand the current state over to the render thread.
+ * If the render thread is behind and the queue is full, the newest snapshot
+ * is kept and pushed again next time, older ones are never needed.
+ */
+void EditorWindow::publishSnapshot() {
+
+    /* The inputs of a snapshot that never made it are shown by this one. */
+    if(unpublished)
+        pendingInputs.insert(pendingInputs.begin(),unpublished->inputs.begin(),unpublished->inputs.end());
+    unpublished = takeSnapshot();
+    flushSnapshot();
+}
+
+/*
+ * Retry a snapshot which didn't fit into the queue.
+ */
+void EditorWindow::flushSnapshot() {
+
+    if(unpublished && snapshots.TryPush(unpublished)){
+        unpublished.reset();
+        wakeRenderer();
+    }
+}
+
+/*
+ * The lock orders the push before the render thread's check of the queue,
+ * so the notification can't fall between its check and its wait.
+ */
+void EditorWindow::wakeRenderer() {
+
+    {
+        std::lock_guard<std::mutex> lock(renderMutex);
+    }
+    renderWake.notify_one();
+}
+
+/*
+ * Return the atlas of a text size, building it on first use.
+ * A font that can't be opened is remembered, it isn't retried every frame.
+ */
+EditorWindow::SizedAtlas * EditorWindow::atlasFor(int size) {
+
+    std::map<int,SizedAtlas>::iterator it = atlases.find(size);
+    if (it == atlases.end()){
+        it = atlases.insert(std::make_pair(size,SizedAtlas())).first;
+        try{
+            it->second.atlas.reset(new GlyphAtlas(renderer, fonts->Get(TTF_file, size), &profiler));
+            it->second.batch.reset(new GlyphBatch(*it->second.atlas));
+        }catch(const std::exception &ex){
+            std::cout << ex.what() << std::endl;
+            it->second.atlas.reset();
+        }
+    }
+    return it->second.atlas ? &it->second : nullptr;
+}
+
+/*
+ * Row height for a text size.
+ */
+int EditorWindow::rowHeightFor(int size) const {
+    return LineSpacing * size / FONT_SIZE;
+}
+
+/*
+ * Characters per row for a text size.
+ */
+int EditorWindow::charactersPerRowFor(int size) const {
+    return CHARACTERS_PER_ROW * FONT_SIZE / size;
+}
+
+/*
+ * The most characters the rows of a view hold, each with its '\n'.
+ */
+unsigned EditorWindow::layoutTextSize(int size) const {
+    return (SCREEN_HEIGHT / rowHeightFor(size) + 1) * (charactersPerRowFor(size) + 1);
+}
+
+/*
+ * Draw frame times and counters in the bottom left corner.
+ * It is a debugging aid drawn with renderText at a small size, outside the
+ * glyph batch, so turning it on adds its own uploads and draw calls.
+ */
+void EditorWindow::renderOverlay() {
+
+    FrameStats s = profiler.GetStats();
+    char lines[3][128];
+
+    snprintf(lines[0],sizeof(lines[0]),"frame p50 %.2fms  p99 %.2fms  (%lu frames)",
+             s.frameP50,s.frameP99,s.frames);
+    snprintf(lines[1],sizeof(lines[1]),"drain %.2f  apply %.2f  layout %.2f  render %.2f  present %.2f",
+             s.phaseLast[(int)FRAMEPHASE::EVENTDRAIN],s.phaseLast[(int)FRAMEPHASE::EDITAPPLY],
+             s.phaseLast[(int)FRAMEPHASE::LAYOUT],s.phaseLast[(int)FRAMEPHASE::RENDER],
+             s.phaseLast[(int)FRAMEPHASE::PRESENT]);
+    snprintf(lines[2],sizeof(lines[2]),"draw calls %lu  texture uploads %lu  glyph misses %lu",
+             s.counterLast[(int)FRAMECOUNTER::DRAWCALL],s.counterLast[(int)FRAMECOUNTER::TEXTUREUPLOAD],
+             s.counterLast[(int)FRAMECOUNTER::GLYPHCACHEMISS]);
+
+    const int lineHeight = 18;
+    SDL_Rect back = { 0, SCREEN_HEIGHT - 3 * lineHeight - 4, SCREEN_WIDTH, 3 * lineHeight + 4};
+    SDL_SetRenderDrawColor(renderer,0,0,0,255);
+    SDL_RenderFillRect(renderer,&back);
+    profiler.Count(FRAMECOUNTER::DRAWCALL);
+
+    SDL_Color overlayColor = { 255, 255, 0, 255 };
+    for(int i = 0;i < 3;++i){
+        SDL_Texture *image = renderText(lines[i], TTF_file, overlayColor, 14, renderer);
+        if(image)
+            renderTexture(image, renderer, 4, back.y + 2 + i * lineHeight);
+        cleanup(image);
+    }
+}
+
+/*
+ * Draw one snapshot.
+ */
+void EditorWindow::renderFrame(const EditorSnapshot &snap) {
+
+    FrameProfiler::clock::time_point frameStart = FrameProfiler::clock::now();
+
+    SDL_SetRenderDrawColor( renderer,backColor.r,backColor.g,backColor.b,backColor.a);
+    SDL_RenderClear(renderer);
+
+    //Glyphs come from the atlas, the whole screen is one geometry call per atlas page
+    SizedAtlas *sized = atlasFor(snap.fontSize);
+    if(sized){
+        for(unsigned i = 0;i < snap.rows.size();++i)
+            sized->batch->AddText(snap.rows[i], 0, i*snap.rowHeight, color);
+    }
+
+    //Gutter marks of the line diff, removed lines are a short bar at the top of the row after them
+    for(unsigned i = 0;i < snap.marks.size();++i){
+        if(snap.marks[i] == LINECHANGE::NONE)
+            continue;
+        SDL_Color markColor = snap.marks[i] == LINECHANGE::ADDED ? addedColor
+                            : snap.marks[i] == LINECHANGE::CHANGED ? changedColor : removedColor;
+        SDL_Rect mark = { 0, (int)i * snap.rowHeight, GUTTER_WIDTH,
+                          snap.marks[i] == LINECHANGE::REMOVED ? GUTTER_WIDTH : snap.rowHeight };
+        if(sized){
+            sized->batch->AddRect(mark, markColor);
+        }else{
+            SDL_SetRenderDrawColor(renderer,markColor.r,markColor.g,markColor.b,markColor.a);
+            SDL_RenderFillRect(renderer, &mark);
+            profiler.Count(FRAMECOUNTER::DRAWCALL);
+        }
+    }
+
+    //Folded lines are a short bar after the header row's text
+    if(sized){
+        for(unsigned i = 0;i < snap.foldedRows.size();++i){
+            unsigned r = snap.foldedRows[i];
+            SDL_Rect mark = { sized->atlas->Width(snap.rows[r], snap.rows[r].size()) + GUTTER_WIDTH,
+                              (int)r * snap.rowHeight + snap.rowHeight / 3, snap.rowHeight, snap.rowHeight / 3 };
+            sized->batch->AddRect(mark, foldColor);
+        }
+    }
+
+    //Draw cursor, in the same batch as the text
+    EditorKeyCursor c = snap.cursor;
+    if(c.isVisable()){
+        c.calcCoordinate();
+        SDL_Rect cursorRect = { c.get_x(), c.get_y(), c.get_cursorWidth(),c.get_cursorHeight()};
+        if(sized){
+            //Glyph widths vary, place the cursor after the glyphs before it
+            const std::string &row = c.get_row() < snap.rows.size() ? snap.rows[c.get_row()] : std::string();
+            cursorRect.x = sized->atlas->Width(row, c.get_col());
+            cursorRect.y = c.get_row() * snap.rowHeight;
+            cursorRect.h = sized->atlas->LineHeight();
+            sized->batch->AddRect(cursorRect, cursorColor);
+        }else{
+            SDL_SetRenderDrawColor(renderer,cursorColor.r,cursorColor.g,cursorColor.b,cursorColor.a);
+            SDL_RenderFillRect( renderer, &cursorRect);
+            profiler.Count(FRAMECOUNTER::DRAWCALL);
+        }
+    }
+
+    if(sized)
+        profiler.Count(FRAMECOUNTER::DRAWCALL, sized->batch->Flush(renderer));
+
+    if(snap.overlay)
+        renderOverlay();
+
+    /* Present blocks on vsync, time it on its own. */
+    FrameProfiler::clock::time_point presentStart = FrameProfiler::clock::now();
+    profiler.AddPhase(FRAMEPHASE::RENDER,frameStart,presentStart);
+    SDL_RenderPresent(renderer);
+    profiler.AddPhase(FRAMEPHASE::PRESENT,presentStart,FrameProfiler::clock::now());
+
+    profiler.EndFrame(frameStart);
+}
+
+/*
+ * Body of the render thread.
+ * It owns the renderer, so waiting for vsync never holds up the input thread.
+ * With nothing new to draw it sleeps until wakeRenderer().
+ */
+void EditorWindow::renderLoop() {
+
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    if (renderer == nullptr){
+        /* No GPU, e.g. the dummy video driver of a headless run. */
+        logSDLError(std::cout, "CreateRenderer (accelerated)");
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+    }
+    if (renderer == nullptr){
+        logSDLError(std::cout, "CreateRenderer");
+        quit = true;
+        return;
+    }
+
+    std::shared_ptr<const EditorSnapshot> current,next;
+    std::vector<Uint32> inputs;
+
+    while (!quit){
+        /* Only the newest snapshot matters, but the inputs of skipped ones still count. */
+        bool fresh = false;
+        while(snapshots.TryPop(next)){
+            current = next;
+            inputs.insert(inputs.end(),current->inputs.begin(),current->inputs.end());
+            fresh = true;
+        }
+
+        if(!fresh || !current){
+            std::unique_lock<std::mutex> lock(renderMutex);
+            renderWake.wait(lock,[this]{ return quit || !snapshots.Empty(); });
+            continue;
+        }
+        renderFrame(*current);
+
+        /* The frame is on screen, every input it carries is done. */
+        Uint32 now = SDL_GetTicks();
+        for(size_t i = 0;i < inputs.size();++i)
+            latency.Add(now - inputs[i]);
+        inputs.clear();
+    }
+
+    atlases.clear();
+    cleanup(renderer);
+    renderer = nullptr;
+}
+
+/*
+ * Display the window.
+ * The calling thread handles input and owns the buffer, a second thread renders.
  */
 void EditorWindow::show(){
 
+    if (offscreen)
+        throw std::runtime_error("An offscreen editor can't be shown.");
+
     SDL_StartTextInput();
 
-    int l;
-    std::string text,tstr;
-    SDL_Texture *image;
+    renderThread = std::thread(&EditorWindow::renderLoop,this);
+    publishSnapshot();
+
+    if(injectRemaining)
+        injectTimerID = SDL_AddTimer(injectInterval, injectKey, this);
+
+    EditCommand c,pending;
 
     while (!quit){
-        //Event Polling
-        while (SDL_PollEvent(&e)){
+        /* Sleep until something happens, but wake up now and then to retry a snapshot. */
+        if(!SDL_WaitEventTimeout(&e,10)){
+            pollFiles();
+            pollDiff();
+            flushSnapshot();
+            continue;
+        }
+
+        bool changed = false;
+        bool hasPending = false;
+
+        /*
+         * Event Polling
+         * Everything queued so far is drained, runs of text input and
+         * backspace are coalesced into one buffer operation each.
+         * The drain phase includes the edits applied while draining.
+         */
+        FrameProfiler::clock::time_point drainStart = FrameProfiler::clock::now();
+        do{
             if (e.type == SDL_QUIT){
                 quit = true;
             }
             if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE){
                 quit = true;
             }
-            if (e.type == SDL_TEXTINPUT || (e.type == SDL_KEYDOWN && e.key.repeat == 0)){
-                if(e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_BACKSPACE && text.length() > 0){
-                    l = text.length();
-                    text = text.substr(0,l-1);
-                        cursor.moveBackward();
-                    //std::cout << "Delete word!" << std::endl;
+            if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F3 && !e.key.repeat){
+                showOverlay = !showOverlay;
+                changed = true;
+            }
+            //Next / previous document
+            if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_TAB && (e.key.keysym.mod & KMOD_CTRL)){
+                if (hasPending){
+                    applyCommand(pending);
+                    hasPending = false;
+                }
+                size_t n = buffers.Count();
+                buffers.SetActive((buffers.ActiveIndex() + ((e.key.keysym.mod & KMOD_SHIFT) ? n - 1 : 1)) % n);
+                activateDocument();
+                changed = true;
+            }
+            //Save the active document
+            if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_s && (e.key.keysym.mod & KMOD_CTRL)){
+                if (hasPending){
+                    applyCommand(pending);
+                    hasPending = false;
+                }
+                saveDocument();
+                changed = true;
+            }
+            //Revert the diff hunk at the cursor
+            if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_r && (e.key.keysym.mod & KMOD_CTRL)){
+                if (hasPending){
+                    applyCommand(pending);
+                    hasPending = false;
+                }
+                revertHunk();
+                changed = true;
+            }
+            //Bookmarks
+            if (e.type == SDL_KEYDOWN && (e.key.keysym.sym == SDLK_b || e.key.keysym.sym == SDLK_j)
+                && (e.key.keysym.mod & KMOD_CTRL)){
+                if (hasPending){
+                    applyCommand(pending);
+                    hasPending = false;
+                }
+                if (e.key.keysym.sym == SDLK_b)
+                    toggleBookmark();
+                else
+                    nextBookmark();
+                changed = true;
+            }
+            //Matching bracket, enclosing block
+            if (e.type == SDL_KEYDOWN && (e.key.keysym.sym == SDLK_m || e.key.keysym.sym == SDLK_u)
+                && (e.key.keysym.mod & KMOD_CTRL)){
+                if (hasPending){
+                    applyCommand(pending);
+                    hasPending = false;
+                }
+                if (e.key.keysym.sym == SDLK_m)
+                    matchBracket();
+                else
+                    enclosingBlock();
+                changed = true;
+            }
+            //Bulk line operations
+            if (e.type == SDL_KEYDOWN && !e.key.repeat && e.key.keysym.sym >= SDLK_F5 && e.key.keysym.sym <= SDLK_F9){
+                if (hasPending){
+                    applyCommand(pending);
+                    hasPending = false;
                 }
-                else if(e.type == SDL_TEXTINPUT){
-                    tstr = e.text.text;
-                    text += tstr;
-                        cursor.moveForward();
-                    //std::cout << "e.text.text.length " << tstr.length() << ' ' << e.text.text << std::endl;
+                bool shift = (e.key.keysym.mod & KMOD_SHIFT) != 0;
+                LineOp op;
+                op.invert = shift;
+                op.tabs = shift;
+                if (e.key.keysym.sym == SDLK_F5)
+                    op.type = LINEOP::SORT;
+                else if (e.key.keysym.sym == SDLK_F6)
+                    op.type = LINEOP::UNIQUE;
+                else if (e.key.keysym.sym == SDLK_F7)
+                    op.type = LINEOP::TRIM;
+                else if (e.key.keysym.sym == SDLK_F8)
+                    op.type = LINEOP::REINDENT;
+                else
+                    op.type = LINEOP::FILTER;
+                if (op.type == LINEOP::FILTER){
+                    char *clip = SDL_GetClipboardText();
+                    if (clip){
+                        op.pattern = clip;
+                        SDL_free(clip);
+                    }
+                }
+                if (op.type != LINEOP::FILTER || !op.pattern.empty())
+                    runLineOp(op);
+            }
+            //Fold, unfold
+            if (e.type == SDL_KEYDOWN && (e.key.keysym.sym == SDLK_LEFTBRACKET || e.key.keysym.sym == SDLK_RIGHTBRACKET)
+                && (e.key.keysym.mod & KMOD_CTRL)){
+                if (hasPending){
+                    applyCommand(pending);
+                    hasPending = false;
+                }
+                if (e.key.keysym.sym == SDLK_LEFTBRACKET)
+                    foldBlock();
+                else
+                    unfoldBlock();
+                changed = true;
+            }
+            //Zoom, the font of a new size comes from memory, never from disk
+            if (e.type == SDL_KEYDOWN && (e.key.keysym.mod & KMOD_CTRL)){
+                int size = fontSize;
+                if (e.key.keysym.sym == SDLK_EQUALS)
+                    size = std::min(fontSize + 4, MAX_FONT_SIZE);
+                else if (e.key.keysym.sym == SDLK_MINUS)
+                    size = std::max(fontSize - 4, MIN_FONT_SIZE);
+                else if (e.key.keysym.sym == SDLK_0)
+                    size = FONT_SIZE;
+                if (size != fontSize){
+                    fontSize = size;
+                    changed = true;
+                }
+            }
+            if (translateEvent(e,c)){
+                pendingInputs.push_back(e.common.timestamp);
+                if(!hasPending){
+                    pending = c;
+                    hasPending = true;
+                }else if(!mergeCommand(pending,c)){
+                    FrameProfiler::Scope scope(profiler,FRAMEPHASE::EDITAPPLY);
+                    applyCommand(pending);
+                    pending = c;
                 }
-                //std::cout << "text length = "<<text.length() << " Text is -> " << text << std::endl;
-                //cursor.debug();
+                changed = true;
             }
-            if(e.type == SDL_USEREVENT){
-                //std::cout << "change visibility." << std::endl;
+            if(e.type == SDL_USEREVENT && e.user.code == CURSOR_FLASH){
                 cursor.changeVisibility();
+                changed = true;
             }
+            //A completion checks the text version, so the text typed before it must be in first
+            if(e.type == SDL_USEREVENT && e.user.code == TASK_COMPLETE){
+                if (hasPending){
+                    applyCommand(pending);
+                    hasPending = false;
+                }
+                TaskScheduler::RunCompletion(e);
+            }
+        }while (SDL_PollEvent(&e));
+        profiler.AddPhase(FRAMEPHASE::EVENTDRAIN,drainStart,FrameProfiler::clock::now());
+
+        if(hasPending){
+            FrameProfiler::Scope scope(profiler,FRAMEPHASE::EDITAPPLY);
+            applyCommand(pending);
         }
-        SDL_RenderClear(renderer);
 
-        //draw a rectangle
-        SDL_Rect r;
-        r.x = 0;
-        r.y = 600;
-        r.w = 10;
-        r.h = 10;
+        if(statsInterval && SDL_GetTicks() - lastStatsDump >= statsInterval){
+            gb->DumpStats(std::cout);
+            layoutArena.DumpStats(std::cout,"Layout");
+            buffers.Get(buffers.ActiveIndex()).arena->DumpStats(std::cout,"Document");
+            lastStatsDump = SDL_GetTicks();
+        }
 
-        //SDL_SetRenderDrawColor( renderer, 0, 0, 255, 255 );
-        //SDL_RenderDrawRect(renderer,&r);
+        pollFiles();
+        pollDiff();
 
+        if(changed)
+            publishSnapshot();
+        else
+            flushSnapshot();
+    }
 
-        //We can draw our message as we do any other texture, since it's been
-        //rendered to a texture
-        if(text.size() > 0){
-            for(int i = 0;text.length() > CHARACTERS_PER_ROW*i ;++i ){
-                image = renderText(text.substr(i*CHARACTERS_PER_ROW,CHARACTERS_PER_ROW), TTF_file, color, 32, renderer);
-                renderTexture(image, renderer, 0, i*LineSpacing);
-            }
-        }
+    wakeRenderer();
+    renderThread.join();
+    profiler.WriteTrace();
 
-//        SDL_Rect fillRect = { SCREEN_WIDTH / 4, SCREEN_HEIGHT / 4, 20, 20 };
-//        SDL_SetRenderDrawColor( renderer, 0xFF, 0x00, 0x00, 0xFF );
-//        SDL_RenderFillRect( renderer, &fillRect );
+    if(latency.Count())
+        latency.Print(std::cout);
+    if(!latencyFile.empty()){
+        std::ofstream out(latencyFile.c_str());
+        if(out)
+            latency.WriteJson(out);
+        else
+            std::cout << "Can't write latency report " << latencyFile << std::endl;
+    }
 
-        //Draw cursor
-        if(cursor.isVisable()){
-            cursor.calcCoordinate();
-            SDL_Rect cursorRect = { cursor.get_x(), cursor.get_y(), cursor.get_cursorWidth(),cursor.get_cursorHeight()};
-            SDL_SetRenderDrawColor(renderer,cursorColor.r,cursorColor.g,cursorColor.b,cursorColor.a);
-            SDL_RenderFillRect( renderer, &cursorRect);
-        }
+    stopRecording();
 
-        //if we don't SDL_SetRenderDrawColor again
-        SDL_SetRenderDrawColor( renderer,backColor.r,backColor.g,backColor.b,backColor.a);
-        SDL_RenderPresent(renderer);
-    }
     SDL_StopTextInput();
     SDL_RemoveTimer( timerID );
+    if(injectTimerID)
+        SDL_RemoveTimer( injectTimerID );
     //Clean up
-    cleanup(image, renderer, window);
+    cleanup(window);
     TTF_Quit();
     SDL_Quit();
-}
\ No newline at end of file
+}
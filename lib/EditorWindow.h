@@ -8,18 +8,140 @@
 #include "SDL2/SDL.h"
 #include "SDL2/SDL_ttf.h"
 #include "SDL2/SDL_image.h"
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
 #include <cstdio>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 #include "cleanup.h"
 #include "res_path.h"
 #include "EditorKeyCursor.h"
 #include "GapBuffer.h"
+#include "BufferManager.h"
+#include "TaskScheduler.h"
+#include "SpscQueue.h"
+#include "EditRecorder.h"
+#include "FrameProfiler.h"
+#include "LatencyHistogram.h"
+#include "GlyphAtlas.h"
+#include "FontManager.h"
+#include "FileWatcher.h"
+#include "FileSync.h"
+#include "LineDiff.h"
+#include "Arena.h"
+#include "LineOps.h"
+#include <map>
+
+/* What the input thread asks the buffer to do. */
+enum class EDITTYPE{INSERTSTRING,DELETESTRING,CURSORFORWARD,CURSORBACKWARD,CURSORUP,CURSORDOWN,PASTE};
+
+/*
+ * One edit. Runs of the same kind of input are coalesced into a single
+ * command, which is also the unit an undo record is made of.
+ */
+struct EditCommand{
+    EDITTYPE type;
+    std::string text;       //used by INSERTSTRING
+    unsigned count;         //characters to delete or steps to move
+};
+
+/*
+ * Everything the render thread needs to draw one frame.
+ * Built by the input thread, never modified after it is published.
+ */
+struct EditorSnapshot{
+    unsigned long version;              //buffer version the snapshot was taken at
+    std::vector<std::string> rows;      //visible rows after layout
+    EditorKeyCursor cursor;
+    bool overlay;                       //draw the performance overlay
+    int fontSize;                       //text size the rows were laid out for
+    int rowHeight;                      //pixels from one row to the next
+    std::vector<Uint32> inputs;         //timestamps of the input events this snapshot is first to show
+    std::vector<LINECHANGE> marks;      //gutter mark of every row, empty without a diff
+    std::vector<unsigned> foldedRows;   //rows ending a line with folded lines under it
+};
+
+/*
+ * A line diff of a document against its file.
+ */
+struct DocumentDiff{
+    unsigned long textVersion;                  //the text it was worked out for
+    unsigned long fileVersion;                  //the files it was worked out against
+    std::vector<DiffHunk> hunks;
+    std::shared_ptr<const LineIndex> fileLines; //null if the file can't be read
+    std::shared_ptr<const LineIndex> bufferLines;
+};
 
 class EditorWindow{
 private:
 
-    GapBuffer gb;
+    /* Open documents, Ctrl+Tab / Ctrl+Shift+Tab switch between them. */
+    BufferManager buffers;
+
+    /* Buffer of the active document, input thread only. */
+    GapBuffer *gb;
+
+    /* Bumped on every edit, background work tied to an older version is dropped. */
+    std::atomic<unsigned long> bufferVersion;
+
+    /* Background work (save, search, highlighting, indexing, file loading). */
+    TaskScheduler scheduler;
+
+    /* Open files are checked for changes on disk every WATCH_INTERVAL ms. */
+    FileWatcher watcher;
+    const Uint32 WATCH_INTERVAL = 100;
+    Uint32 lastWatchPoll;
+    std::map<std::string,bool> syncing;     //path -> changed again while its sync runs
+
+    /*
+     * Line diff of the active document against its file, worked out in the
+     * background DIFF_DELAY ms after the last edit. It draws the gutter
+     * marks, clears the modified flag when the edits are undone by hand
+     * and lets Ctrl+R revert the hunk at the cursor.
+     */
+    const Uint32 DIFF_DELAY = 150;
+    std::atomic<unsigned long> textVersion;     //bumped by every edit of the text, cancels the tasks tied to it
+    Uint32 lastEdit;
+    bool diffRunning;
+    std::shared_ptr<const DocumentDiff> diff;
+    std::shared_ptr<const LineIndex> fileLines; //lines of the file of fileLinesOf, kept between diffs
+    std::shared_ptr<FileSync> fileLinesOf;
+    unsigned long fileVersion;                  //bumped when a file is saved or synced
+
+    /* A bulk line operation is running in the background, see runLineOp(). */
+    bool lineOpRunning;
+
+    /* Writes the session to an edit trace, null unless recording. */
+    std::unique_ptr<EditRecorder> recorder;
+
+    /* The line at the top of the view, moved by the layout to keep the cursor in view. */
+    unsigned topLine;
+
+    /* GapBuffer stats are dumped every statsInterval ms, 0 turns it off (OOPEDITOR_GB_STATS=seconds). */
+    Uint32 statsInterval;
+    Uint32 lastStatsDump;
+
+    /* Frame timing, shared by both threads. F3 toggles the overlay. */
+    FrameProfiler profiler;
+    bool showOverlay;
+
+    /*
+     * Keystroke-to-photon latency. Input timestamps ride along with the
+     * snapshots and are counted by the render thread once presented.
+     */
+    std::vector<Uint32> pendingInputs;
+    LatencyHistogram latency;
+    std::string latencyFile;
+
+    /* Synthetic keystrokes still to inject, see injectKeys(). */
+    std::atomic<unsigned> injectRemaining;
+    unsigned injectSent;
+    Uint32 injectInterval;
+    SDL_TimerID injectTimerID;
 
     /* Parameter of window size. */
     const int SCREEN_WIDTH  = 644;
@@ -31,19 +153,69 @@ private:
     SDL_Renderer *renderer;
     SDL_TimerID timerID;
 
+    /* Offscreen mode: no window, the renderer draws into frameSurface. */
+    bool offscreen;
+    SDL_Surface *frameSurface;
+
     /* Color used for characters  */
     SDL_Color color = { 255, 255, 255, 255 };
     SDL_Color backColor = {39,40,34,255};
     SDL_Color cursorColor = { 255, 255, 255, 255};
 
-    /* Default TTF file */
-    const char * TTF_file = "../simhei.ttf";
+    /* Gutter marks of the line diff. */
+    const int GUTTER_WIDTH = 3;
+    SDL_Color addedColor = {120,200,80,255};
+    SDL_Color changedColor = {230,180,60,255};
+    SDL_Color removedColor = {220,80,80,255};
+
+    /* Marker after the header line of a fold. */
+    SDL_Color foldColor = {120,120,140,255};
+
+    /* Default TTF file, shipped with the sources. The layout constants above are for FONT_SIZE. */
+    const char * TTF_file = "../SourceSansVariable-Roman.ttf";
+    const int FONT_SIZE = 32;
+    const int MIN_FONT_SIZE = 8;
+    const int MAX_FONT_SIZE = 96;
+
+    /*
+     * Scratch memory of the layout, taken back at the start of every
+     * snapshot: the text read for the view and the line of every row. Its
+     * blocks are large enough for the text of a view at MIN_FONT_SIZE to
+     * fit a size class. The rows themselves go to the render thread with
+     * the snapshot, they are strings of their own.
+     */
+    Arena layoutArena;
+
+    /* Font files and handles, may be shared with other windows. */
+    std::shared_ptr<FontManager> fonts;
+
+    /* Current text size, changed by Ctrl+= / Ctrl+- / Ctrl+0 on the input thread. */
+    int fontSize;
+
+    /*
+     * One glyph atlas per text size, built on first use and kept so zooming
+     * back is free. Owned by whichever thread owns the renderer.
+     */
+    struct SizedAtlas{
+        std::unique_ptr<GlyphAtlas> atlas;      //null if the font can't be opened
+        std::unique_ptr<GlyphBatch> batch;
+    };
+    std::map<int,SizedAtlas> atlases;
 
     /* Keyboard cursor */
     EditorKeyCursor cursor;
 
+    /* Input thread -> render thread. */
+    SpscQueue<std::shared_ptr<const EditorSnapshot> > snapshots;
+    std::shared_ptr<const EditorSnapshot> unpublished;
+    std::thread renderThread;
+
+    /* The render thread sleeps here until a snapshot is pushed or the window quits. */
+    std::mutex renderMutex;
+    std::condition_variable renderWake;
+
     SDL_Event e;
-    bool quit = false;
+    std::atomic<bool> quit;
 
 
 
@@ -102,12 +274,255 @@ private:
     SDL_Texture* renderCh(const char ch, const std::string &fontFile, SDL_Color color, int fontSize,
                             SDL_Renderer *renderer);
 
+    /*
+     * Turn an SDL event into an edit command.
+     * @param ev The event polled by the input thread
+     * @param c The command to fill
+     * @return false if the event doesn't edit anything
+     */
+    bool translateEvent(const SDL_Event &ev, EditCommand &c);
+
+    /*
+     * Fold c into the pending command if they form one run.
+     * @param pending The command being built for this batch of events
+     * @param c The next command
+     * @return false if c starts a new run
+     */
+    static bool mergeCommand(EditCommand &pending, const EditCommand &c);
+
+    /*
+     * Apply an edit command to the buffer, input thread only.
+     * @param c The command
+     */
+    void applyCommand(const EditCommand &c);
+
+    /*
+     * Follow the active document after a switch: buffer pointer, title, redraw.
+     */
+    void activateDocument();
+
+    /*
+     * Write the rest of the edit trace out, if recording.
+     */
+    void stopRecording();
+
+    /*
+     * Flag the active document as modified, the title shows it.
+     */
+    void markModified();
+
+    /*
+     * Follow a committed change of a document's text: a new snapshot for
+     * the active one, and a new diff once typing pauses. A compound edit
+     * is one change.
+     * @param d The document.
+     * @param c What changed.
+     */
+    void textChanged(const Document &d, const TextChange &c);
+
+    /*
+     * Show the active document in the window title.
+     */
+    void updateTitle();
+
+    /*
+     * Start a sync for every watched file which changed, at most every WATCH_INTERVAL ms.
+     */
+    void pollFiles();
+
+    /*
+     * Bring the document of a changed file up to date, the file is diffed
+     * off the SDL thread. One sync per file runs at a time, a change
+     * meanwhile starts another one when it is done.
+     * @param path The name of the file.
+     */
+    void syncFile(const std::string &path);
+
+    /*
+     * Diff the active document against its file in the background, once
+     * the text has rested for DIFF_DELAY ms. The text is copied, the
+     * file is read and indexed only if it wasn't before.
+     */
+    void pollDiff();
+
+    /*
+     * Take the result of a diff, SDL thread only.
+     * @param disk The FileSync of the document the diff was made for.
+     * @param d The diff.
+     * @param complete False if it was cancelled or failed, only the file
+     * lines it read are kept then.
+     */
+    void finishDiff(const std::shared_ptr<FileSync> &disk, const std::shared_ptr<const DocumentDiff> &d,
+                    bool complete = true);
+
+    /*
+     * Run a bulk line operation over the active document in the background
+     * (F5 sort, F6 drop duplicates, F7 trim, F8 reindent, F9 keep the
+     * lines holding the clipboard text; with Shift: descending, tabs, drop
+     * them). The text is copied and the result written back as one change.
+     */
+    void runLineOp(const LineOp &op);
+
+    /*
+     * Write back the result of a line operation, SDL thread only.
+     * It is dropped if the text changed meanwhile.
+     * @param version The textVersion the operation started from.
+     * @param before The text it started from.
+     * @param after The new text.
+     */
+    void finishLineOp(unsigned long version, const std::shared_ptr<const std::string> &before,
+                      const std::shared_ptr<const std::string> &after);
+
+    /*
+     * Save the active document (Ctrl+S), writing only what changed when
+     * that is safe. Not while a sync of its file is running.
+     */
+    void saveDocument();
+
+    /*
+     * Put back what the file holds for the hunk at the cursor.
+     * Does nothing while the diff is out of date.
+     */
+    void revertHunk();
+
+    /*
+     * Put a bookmark at the cursor, or take away the one that is there (Ctrl+B).
+     */
+    void toggleBookmark();
+
+    /*
+     * Move the cursor to the next bookmark, from the last one to the first (Ctrl+J).
+     */
+    void nextBookmark();
+
+    /*
+     * Move the cursor to the bracket matching the one at it, or the one
+     * before it (Ctrl+M).
+     */
+    void matchBracket();
+
+    /*
+     * Move the cursor to the opening bracket of the block around it, again
+     * for the block around that (Ctrl+U).
+     */
+    void enclosingBlock();
+
+    /*
+     * Hide the block the cursor's line opens, or else the block around it (Ctrl+[).
+     * A line ending in an opening bracket folds up to its closing bracket,
+     * other lines fold the lines indented deeper below them.
+     */
+    void foldBlock();
+
+    /*
+     * Show the lines of the fold at the cursor's line again (Ctrl+]).
+     */
+    void unfoldBlock();
+
+    /*
+     * Move the cursor up or down by shown lines, keeping its column where
+     * the line is long enough. Folded lines are stepped over.
+     */
+    void moveLines(int count);
+
+    /*
+     * Move the cursor out of folded lines, to the line after the fold when
+     * going forward and to the end of its header when going back.
+     */
+    void skipFolds(bool forward);
+
+    /*
+     * Move the cursor somewhere else without editing.
+     */
+    void jumpTo(unsigned offset);
+
+    /*
+     * Apply what a sync found, SDL thread only.
+     * @param path The name of the file.
+     * @param disk The FileSync the change was worked out against.
+     * @param c The change.
+     */
+    void finishSync(const std::string &path, const std::shared_ptr<FileSync> &disk, FileChange &c);
+
+    /*
+     * Lay out the visible part of the buffer into a snapshot.
+     */
+    std::shared_ptr<const EditorSnapshot> takeSnapshot();
+
+    /*
+     * Take a snapshot and hand it over to the render thread.
+     */
+    void publishSnapshot();
+
+    /*
+     * Retry a snapshot which didn't fit into the queue.
+     */
+    void flushSnapshot();
+
+    /*
+     * Wake the render thread after a snapshot was pushed or quit was set.
+     */
+    void wakeRenderer();
+
+    /*
+     * Return the atlas of a text size, building an empty one on first use.
+     * Text isn't drawn if the font can't be opened, the cursor still is.
+     * @param size The text size.
+     * @return null if there is no font
+     */
+    SizedAtlas * atlasFor(int size);
+
+    /*
+     * Row height and characters per row for a text size, scaled from the
+     * FONT_SIZE layout constants.
+     */
+    int rowHeightFor(int size) const;
+    int charactersPerRowFor(int size) const;
+
+    /*
+     * Return the characters the layout reads at most for a text size.
+     */
+    unsigned layoutTextSize(int size) const;
+
+    /*
+     * Draw frame times and counters over the text, render thread only.
+     */
+    void renderOverlay();
+
+    /*
+     * Draw a snapshot and present it, render thread only.
+     * @param snap The snapshot to draw
+     */
+    void renderFrame(const EditorSnapshot &snap);
+
+    /*
+     * Body of the render thread.
+     */
+    void renderLoop();
+
+    /*
+     * Lay out and draw the buffer into frameSurface, offscreen mode only.
+     */
+    void drawOffscreen();
+
+    /*
+     * Timer callback pushing one synthetic keystroke, SDL_QUIT after the last.
+     * @param param The EditorWindow
+     */
+    static Uint32 injectKey(Uint32 interval, void *param);
+
     /*  There is no need for a copy construction function. */
     EditorWindow(const EditorWindow &);
 
 public:
-    /* Construction function */
-    EditorWindow();
+    /*
+     * Construction function
+     * @param offscreen Draw into a software surface instead of a window.
+     *        Needs no display or GPU, show() can't be used then.
+     * @param sharedFonts Fonts shared with other windows, a new manager is made if null.
+     */
+    explicit EditorWindow(bool offscreen = false,
+                          std::shared_ptr<FontManager> sharedFonts = std::shared_ptr<FontManager>());
     /* Decomposition function*/
     ~EditorWindow();
 
@@ -115,6 +530,86 @@ public:
      * Display the window.
      */
     void show();
+
+    /*
+     * Open a file as a new document and make it active. While it has no
+     * unsaved edits, the document follows changes other programs make to
+     * the file.
+     * Throws std::runtime_error if the file can't be read.
+     * @param filename The name of the file.
+     */
+    void openFile(const char * filename);
+
+    /*
+     * Limit the memory all open documents may hold together.
+     * @param bytes The budget.
+     */
+    void setMemoryBudget(size_t bytes);
+
+    /*
+     * Draw the current buffer offscreen and save the frame as a BMP.
+     * @param filename The name of the BMP file.
+     * @return false if the file can't be written.
+     */
+    bool saveFrame(const char * filename);
+
+    /*
+     * Draw the current buffer offscreen and compare it with a golden frame.
+     * Throws std::runtime_error if the golden BMP can't be loaded or its size differs.
+     * @param filename The name of the golden BMP file.
+     * @return The number of pixels which differ.
+     */
+    unsigned long compareFrame(const char * filename);
+
+    /*
+     * Time layout and drawing of full frames offscreen and print the result.
+     * The first frame is reported on its own, it pays for every cold cache.
+     * @param frames The number of frames to draw.
+     * @param os Where the result goes.
+     */
+    void benchRender(unsigned frames, std::ostream &os);
+
+    /*
+     * Record every applied edit and cursor jump into a binary edit trace,
+     * starting from the text of the active document. Recording stops when
+     * another document is made active.
+     * Throws std::runtime_error if the file can't be created.
+     * @param filename The name of trace file.
+     */
+    void startRecording(const char * filename);
+
+    /*
+     * Write the timing of every frame phase to a Chrome trace-event JSON
+     * file when the window is closed.
+     * @param filename The name of the JSON file.
+     */
+    void startProfiling(const char * filename);
+
+    /*
+     * Write the keystroke latency histogram as JSON when the window is
+     * closed. A summary is printed either way.
+     * @param filename The name of the JSON file.
+     */
+    void reportLatency(const char * filename);
+
+    /*
+     * Type n synthetic keystrokes through the SDL event queue, one every
+     * interval ms once the window is shown, then quit. Used to measure
+     * latency without a user.
+     * @param n The number of keystrokes.
+     * @param interval Milliseconds between two keystrokes.
+     */
+    void injectKeys(unsigned n, Uint32 interval = 16);
+
+    /*
+     * Run work off the SDL thread, tied to the text it starts from. The
+     * completion returned by w runs on the SDL thread unless the text was
+     * edited in the meantime, onFailure runs then. w should poll its token.
+     * @param p The lane of the task.
+     * @param w The work itself.
+     * @param onFailure Clears what the caller keeps for the task.
+     */
+    void runInBackground(TASKPRIORITY p, TaskScheduler::Work w, TaskScheduler::Completion onFailure);
 };
 
 /*
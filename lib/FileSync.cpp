@@ -0,0 +1,492 @@
+#include "FileSync.h"
+#include "TextHash.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* Characters read at a time while chunking a file or a buffer. */
+static const unsigned READ_BLOCK = 256 << 10;
+
+/* A boundary is cut where the top 13 bits of the rolling hash are zero, every 8K on average. */
+static const unsigned long long BOUNDARY_MASK = 0xFFF8000000000000ULL;
+
+/*
+ * Random values the rolling hash adds per byte, the same on every run.
+ */
+struct GearTable{
+    unsigned long long v[256];
+
+    GearTable(){
+        unsigned long long x = 0x9E3779B97F4A7C15ULL;
+        for(int i = 0;i < 256;++i){
+            /* splitmix64 */
+            unsigned long long z = (x += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            v[i] = z ^ (z >> 31);
+        }
+    }
+};
+
+static const GearTable GEAR;
+
+static bool SameChunk(const TextChunk &a, const TextChunk &b){
+    return a.hash == b.hash && a.length == b.length;
+}
+
+/*
+ * Cut where the rolling hash says, never shorter than MIN_CHUNK nor longer than MAX_CHUNK.
+ * The hash starts from zero at every chunk, so chunking a text from any
+ * chunk boundary gives the same chunks as chunking it from the start.
+ */
+unsigned FileSync::Chunk(const char *s, unsigned len, bool final, std::vector<TextChunk> &out) {
+
+    unsigned start = 0;
+    unsigned long long h = 0;
+
+    for(unsigned i = 0;i < len;++i){
+        h = (h << 1) + GEAR.v[(unsigned char)s[i]];
+        unsigned n = i + 1 - start;
+        if((n >= MIN_CHUNK && !(h & BOUNDARY_MASK)) || n >= MAX_CHUNK){
+            TextChunk c = {HashText(s + start,n),n};
+            out.push_back(c);
+            start = i + 1;
+            h = 0;
+        }
+    }
+
+    if(final && start < len){
+        TextChunk c = {HashText(s + start,len - start),len - start};
+        out.push_back(c);
+        start = len;
+    }
+    return start;
+}
+
+/*
+ * Chunk everything read returns, a block at a time. An unfinished chunk is
+ * carried over into the next block, it is never longer than MAX_CHUNK.
+ * @return The number of characters read.
+ */
+static unsigned long long ChunkStream(const std::function<unsigned(char *, unsigned)> &read,
+                                      std::vector<TextChunk> &out){
+
+    std::vector<char> buf(FileSync::MAX_CHUNK + READ_BLOCK);
+    unsigned have = 0;
+    unsigned long long total = 0;
+
+    for(;;){
+        unsigned n = read(&buf[have],READ_BLOCK);
+        total += n;
+        have += n;
+        unsigned used = FileSync::Chunk(&buf[0],have,n == 0,out);
+        memmove(&buf[0],&buf[used],have - used);
+        have -= used;
+        if(n == 0)
+            return total;
+    }
+}
+
+/*
+ * Read everything from offset to the end of the file.
+ */
+static void ReadFrom(std::ifstream &in, unsigned offset, std::string &out){
+
+    in.clear();
+    in.seekg(offset);
+    std::vector<char> buf(READ_BLOCK);
+    while(in.read(&buf[0],buf.size()) || in.gcount() > 0)
+        out.append(&buf[0],in.gcount());
+}
+
+/*
+ * Read len characters at offset, false if the file is shorter.
+ */
+static bool ReadAt(std::ifstream &in, unsigned offset, unsigned len, std::string &out){
+
+    out.resize(len);
+    in.clear();
+    in.seekg(offset);
+    in.read(&out[0],len);
+    return (unsigned)in.gcount() == len;
+}
+
+bool FileStamp::Read(const std::string &path) {
+
+    struct stat st;
+    seen = time(nullptr);
+    if(stat(path.c_str(),&st) != 0){
+        size = -1;
+        mtime = mtimeNsec = 0;
+        inode = 0;
+        return false;
+    }
+    size = st.st_size;
+    mtime = st.st_mtime;
+#ifdef __linux__
+    mtimeNsec = st.st_mtim.tv_nsec;
+#else
+    mtimeNsec = 0;
+#endif
+    inode = st.st_ino;
+    return true;
+}
+
+#ifndef _WIN32
+/*
+ * Write the characters [from, to) of the buffer at the same offset of the file.
+ */
+static bool WriteRange(int fd, GapBuffer &gb, unsigned from, unsigned to){
+
+    std::vector<char> buf(READ_BLOCK);
+    while(from < to){
+        unsigned n = gb.GetString(from,std::min(to - from,READ_BLOCK),&buf[0]);
+        for(unsigned done = 0;done < n;){
+            ssize_t w = pwrite(fd,&buf[done],n - done,(off_t)from + done);
+            if(w < 0 && errno == EINTR)
+                continue;
+            if(w <= 0)
+                return false;
+            done += w;
+        }
+        from += n;
+    }
+    return true;
+}
+#endif
+
+FileSync::FileSync(const std::string &filename, GapBuffer &gb):path(filename),size(0) {
+    Reset(gb);
+}
+
+/*
+ * Chunk the whole buffer, the gap doesn't move.
+ */
+void FileSync::Reset(GapBuffer &gb) {
+
+    unsigned offset = 0;
+    chunks.clear();
+    size = ChunkStream([&](char *out, unsigned len){
+        unsigned n = gb.GetString(offset,len,out);
+        offset += n;
+        return n;
+    },chunks);
+    stamp.Read(path);
+    gb.MarkUnchanged();
+}
+
+/*
+ * Chunking starts over at every boundary, so once a new boundary falls
+ * on an old one inside the unchanged tail, every chunk after it is the
+ * same as before.
+ */
+void FileSync::Rechunk(GapBuffer &gb, unsigned head, unsigned tail) {
+
+    unsigned n = gb.size();
+    long long delta = (long long)n - size;
+
+    /* Redo from the chunk holding head, the last chunk was cut by the end of text. */
+    size_t a = 0;
+    unsigned start = 0;
+    while(a + 1 < chunks.size() && start + chunks[a].length <= head)
+        start += chunks[a++].length;
+
+    /* Old chunks starting inside the unchanged tail, by their new offset. */
+    std::map<unsigned,size_t> meet;
+    unsigned oldStart = size;
+    for(size_t j = chunks.size();j-- > a + 1;){
+        oldStart -= chunks[j].length;
+        if(oldStart < size - tail)
+            break;
+        meet[oldStart + delta] = j;
+    }
+
+    std::vector<TextChunk> fresh;
+    std::vector<char> buf(MAX_CHUNK + READ_BLOCK);
+    unsigned have = 0, bufStart = start, offset = start;
+    size_t resume = chunks.size();
+
+    for(bool done = false;!done;){
+        unsigned got = gb.GetString(offset,READ_BLOCK,&buf[have]);
+        offset += got;
+        have += got;
+        done = got == 0;
+
+        size_t first = fresh.size();
+        unsigned used = Chunk(&buf[0],have,done,fresh);
+        unsigned end = bufStart;
+        for(size_t k = first;k < fresh.size();++k){
+            end += fresh[k].length;
+            std::map<unsigned,size_t>::iterator m = meet.find(end);
+            if(m != meet.end()){
+                fresh.resize(k + 1);
+                resume = m->second;
+                done = true;
+                break;
+            }
+        }
+
+        memmove(&buf[0],&buf[used],have - used);
+        have -= used;
+        bufStart += used;
+    }
+
+    chunks.erase(chunks.begin() + std::min(a,chunks.size()),chunks.begin() + resume);
+    chunks.insert(chunks.begin() + std::min(a,chunks.size()),fresh.begin(),fresh.end());
+}
+
+/*
+ * Write the whole text to a temporary file beside the real file and
+ * rename it over it, a crash leaves either the old or the new file.
+ * A symbolic link is followed so the link stays a link. A file with
+ * other hard links is overwritten in place instead, a rename would
+ * leave the other names on the old text.
+ */
+void FileSync::Rewrite(GapBuffer &gb, const SavePolicy &policy) {
+
+#ifndef _WIN32
+    std::string target = path;
+    char *real = realpath(path.c_str(),nullptr);
+    if(real){
+        target = real;
+        free(real);
+    }
+
+    struct stat st;
+    bool exists = stat(target.c_str(),&st) == 0;
+    if(exists && st.st_nlink > 1){
+        int fd = open(target.c_str(),O_WRONLY | O_TRUNC);
+        if(fd < 0)
+            throw std::runtime_error("Can't write this text file.");
+        bool ok = WriteRange(fd,gb,0,gb.size()) && (!policy.sync || fsync(fd) == 0);
+        ok = close(fd) == 0 && ok;
+        if(!ok)
+            throw std::runtime_error("Can't write this text file.");
+        return;
+    }
+
+    std::string pattern = target + ".XXXXXX";
+    std::vector<char> tmp(pattern.begin(),pattern.end());
+    tmp.push_back('\0');
+
+    int fd = mkstemp(&tmp[0]);
+    if(fd < 0)
+        throw std::runtime_error("Can't create a temporary file.");
+
+    if(exists)
+        fchmod(fd,st.st_mode & 07777);
+
+    bool ok = WriteRange(fd,gb,0,gb.size()) && (!policy.sync || fsync(fd) == 0);
+    ok = close(fd) == 0 && ok;
+    if(!ok || rename(&tmp[0],target.c_str()) != 0){
+        unlink(&tmp[0]);
+        throw std::runtime_error("Can't write this text file.");
+    }
+
+    //The rename itself is only durable once the directory is on disk
+    if(policy.sync){
+        size_t slash = target.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : target.substr(0,slash);
+        int dfd = open(dir.c_str(),O_RDONLY);
+        if(dfd >= 0){
+            fsync(dfd);
+            close(dfd);
+        }
+    }
+#else
+    (void)policy;
+    if(gb.SaveBufferToFile(path.c_str()))
+        throw std::runtime_error("Can't write this text file.");
+#endif
+}
+
+/*
+ * The changed region is what lies between the unchanged head and tail of
+ * the buffer. It is written in place only if the file is still the one
+ * the buffer was last in step with.
+ */
+SAVEKIND FileSync::Save(GapBuffer &gb, const SavePolicy &policy) {
+
+    unsigned n = gb.size();
+    unsigned common = std::min(n,size);
+    unsigned head = std::min(gb.UnchangedHead(),common);
+    unsigned tail = std::min(gb.UnchangedTail(),common - head);
+
+    FileStamp now;
+    bool same = now.Read(path) && now == stamp && (unsigned long long)now.size == size;
+    if(same && head == n && n == size)
+        return SAVEKIND::NOTHING;
+
+    SAVEKIND kind = SAVEKIND::REWRITE;
+#ifndef _WIN32
+    if(same && policy.append && head == size && n > size)
+        kind = SAVEKIND::APPEND;
+    else if(same && policy.patch && n == size && n - head - tail <= policy.maxPatch)
+        kind = SAVEKIND::PATCH;
+
+    if(kind != SAVEKIND::REWRITE){
+        int fd = open(path.c_str(),O_WRONLY);
+        if(fd < 0){
+            kind = SAVEKIND::REWRITE;
+        }else{
+            bool ok = WriteRange(fd,gb,head,kind == SAVEKIND::APPEND ? n : n - tail)
+                      && (!policy.sync || fsync(fd) == 0);
+            ok = close(fd) == 0 && ok;
+            if(!ok)
+                throw std::runtime_error("Can't write this text file.");
+        }
+    }
+#endif
+    if(kind == SAVEKIND::REWRITE)
+        Rewrite(gb,policy);
+
+    Rechunk(gb,head,tail);
+    size = n;
+    stamp.Read(path);
+    gb.MarkUnchanged();
+    return kind;
+}
+
+/*
+ * Growth is only taken as an append if the file is still the one last
+ * read (same inode, logs grow in place while editors save by renaming a
+ * new file over it) and it still starts with the first chunk and ends the
+ * old text with the last one. Everything else is chunked again.
+ */
+FileChange FileSync::Diff() const {
+
+    FileChange c;
+    c.kind = SYNCKIND::FAILED;
+    c.base = size;
+    c.offset = 0;
+    c.removed = 0;
+
+    /* Nothing to read if it is still the file last read or saved, e.g. after our own save. */
+    if(c.stamp.Read(path) && c.stamp == stamp && !stamp.Racy() && (unsigned long long)c.stamp.size == size){
+        c.kind = SYNCKIND::UNCHANGED;
+        return c;
+    }
+
+    std::ifstream in(path.c_str(),std::ios::binary | std::ios::ate);
+    if(!in.is_open()){
+        c.error = "Can't open this text file.";
+        return c;
+    }
+    unsigned long long fileSize = in.tellg();
+    if(fileSize > UINT_MAX / 2){
+        c.error = "There is no enough space.";
+        return c;
+    }
+
+    if(fileSize > size && c.stamp.inode == stamp.inode && stamp.size >= 0){
+        unsigned firstLength = chunks.size() > 1 ? chunks.front().length : 0;
+        unsigned lastLength = chunks.empty() ? 0 : chunks.back().length;
+        std::string first, last;
+        if(ReadAt(in,0,firstLength,first)
+           && (firstLength == 0 || HashText(first.data(),firstLength) == chunks.front().hash)
+           && ReadAt(in,size - lastLength,lastLength,last)
+           && (chunks.empty() || HashText(last.data(),lastLength) == chunks.back().hash)){
+            /* Read up to wherever the file ends now, it may still be growing. */
+            c.inserted.reserve(fileSize - size);
+            ReadFrom(in,size,c.inserted);
+            if(c.inserted.size() > UINT_MAX / 2 - size){
+                c.error = "There is no enough space.";
+                return c;
+            }
+
+            c.kind = SYNCKIND::APPEND;
+            c.offset = size;
+            c.chunks.assign(chunks.begin(),chunks.end() - (chunks.empty() ? 0 : 1));
+            last += c.inserted;
+            Chunk(last.data(),last.size(),true,c.chunks);
+            return c;
+        }
+    }
+
+    in.clear();
+    in.seekg(0);
+    unsigned long long newSize = ChunkStream([&](char *out, unsigned len){
+        in.read(out,len);
+        return (unsigned)in.gcount();
+    },c.chunks);
+    if(newSize > UINT_MAX / 2){
+        c.error = "There is no enough space.";
+        return c;
+    }
+
+    size_t p = 0, s = 0, common = std::min(chunks.size(),c.chunks.size());
+    unsigned head = 0, oldTail = 0, newTail = 0;
+    while(p < common && SameChunk(chunks[p],c.chunks[p]))
+        head += chunks[p++].length;
+    while(s < common - p && SameChunk(chunks[chunks.size() - 1 - s],c.chunks[c.chunks.size() - 1 - s])){
+        oldTail += chunks[chunks.size() - 1 - s].length;
+        newTail += c.chunks[c.chunks.size() - 1 - s].length;
+        ++s;
+    }
+
+    if(p == chunks.size() && p == c.chunks.size()){
+        c.kind = SYNCKIND::UNCHANGED;
+        return c;
+    }
+
+    c.offset = head;
+    c.removed = size - oldTail - head;
+    if(!ReadAt(in,head,newSize - newTail - head,c.inserted)){
+        c.error = "The file got shorter while reading it.";
+        return c;
+    }
+    c.kind = SYNCKIND::REPLACE;
+    return c;
+}
+
+/*
+ * Replace the changed region in place and keep the cursor on its text:
+ * after the region it moves with it, inside it it stays as far in as the
+ * new text allows.
+ */
+bool FileSync::Apply(GapBuffer &gb, FileChange &c) {
+
+    /* The synced text is the same, so are the changes the buffer tracks against it. */
+    if(c.kind == SYNCKIND::UNCHANGED){
+        stamp = c.stamp;
+        return true;
+    }
+    if(c.kind == SYNCKIND::FAILED || c.base != size || gb.size() != size)
+        return false;
+
+    unsigned cursor = gb.CursorOffset();
+    unsigned inserted = c.inserted.size();
+
+    /* One change for whoever follows the buffer. */
+    gb.BeginTransaction();
+    gb.SetCursor(c.offset + c.removed);
+    if(c.removed)
+        gb.DeleteString(c.removed);
+    gb.InsertString(c.inserted.data(),inserted);
+    gb.CommitTransaction();
+
+    if(cursor >= c.offset + c.removed)
+        cursor = cursor - c.removed + inserted;
+    else if(cursor > c.offset + inserted)
+        cursor = c.offset + inserted;
+    gb.SetCursor(cursor);
+
+    chunks.swap(c.chunks);
+    size = size - c.removed + inserted;
+    stamp = c.stamp;
+    gb.MarkUnchanged();
+    return true;
+}
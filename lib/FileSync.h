@@ -0,0 +1,189 @@
+/*
+ * Keeps a buffer in step with a file other programs write to.
+ *
+ * The text as last read from disk is remembered as a list of chunks with
+ * their hashes. Chunk boundaries are content-defined (a rolling hash over
+ * the last 64 bytes picks them), so an insertion or a deletion only
+ * changes the chunks around it and every chunk after it is found again.
+ *
+ * When the file changes, Diff() works out what changed without touching
+ * the buffer, so it can run on a worker thread:
+ *  - a file which grew in place (same inode) is checked through its first
+ *    and last chunks and only the new tail is read,
+ *  - anything else is chunked again in one streaming pass, the chunks
+ *    both versions share at the start and at the end are skipped and only
+ *    the region between them is read.
+ * Apply() then replaces just that region of the buffer, the cursor stays
+ * on the text it was on.
+ * A file whose size, modification time and inode are still those last
+ * seen isn't read at all, unless it was modified too recently to tell.
+ *
+ * Save() goes the other way and writes as little of the buffer as is
+ * safe, from what the buffer knows it changed since it matched the file:
+ *  - text only added at the end is appended to the file,
+ *  - changes which keep the length are written over the old bytes,
+ *  - anything else replaces the file atomically (temporary file, rename),
+ *    or in place if the file has other hard links.
+ * In-place writes are only made if the file is still what was last read
+ * or saved (same size, modification time and inode), and SavePolicy
+ * can turn them off or limit them.
+ */
+
+#ifndef FILESYNC_LIBRARY_H
+#define FILESYNC_LIBRARY_H
+
+#include "GapBuffer.h"
+#include <string>
+#include <vector>
+
+/* What Diff() found. */
+enum class SYNCKIND{UNCHANGED,APPEND,REPLACE,FAILED};
+
+/* What Save() did. */
+enum class SAVEKIND{NOTHING,APPEND,PATCH,REWRITE};
+
+/* What a file looked like when it was last read or written. */
+struct FileStamp{
+    long long size;
+    long long mtime;
+    long long mtimeNsec;
+    unsigned long long inode;
+    long long seen;                     //when it was read, in seconds
+
+    /*
+     * Stat a file, false if it doesn't exist.
+     */
+    bool Read(const std::string &path);
+
+    /*
+     * Whether the file may have been written again since without the
+     * modification time moving, which only has the resolution of the clock.
+     */
+    bool Racy() const{ return mtime + 1 >= seen; }
+
+    bool operator==(const FileStamp &o) const{
+        return size == o.size && mtime == o.mtime && mtimeNsec == o.mtimeNsec && inode == o.inode;
+    }
+};
+
+/* When Save() may write into the existing file instead of replacing it. */
+struct SavePolicy{
+    bool append;                        //append text added at the end
+    bool patch;                         //overwrite changes which keep the length
+    unsigned maxPatch;                  //largest region patched in place
+    bool sync;                          //fsync before returning
+
+    SavePolicy():append(true),patch(true),maxPatch(1 << 20),sync(true){}
+};
+
+/* One content-defined piece of text. */
+struct TextChunk{
+    unsigned long long hash;
+    unsigned length;
+};
+
+/*
+ * A change of the file against the text last synced: removed characters
+ * at offset are replaced by inserted.
+ */
+struct FileChange{
+    SYNCKIND kind;
+    unsigned base;                      //size of the synced text the change applies to
+    unsigned offset;
+    unsigned removed;
+    std::string inserted;
+    std::vector<TextChunk> chunks;      //chunks of the whole file after the change
+    FileStamp stamp;                    //of the file the change was read from
+    std::string error;                  //why it FAILED
+};
+
+class FileSync{
+private:
+    std::string path;
+    std::vector<TextChunk> chunks;
+    unsigned size;
+    FileStamp stamp;                    //size is -1 if the file wasn't there
+
+    /*
+     * Chunk the buffer again after it was saved, only from the first
+     * changed chunk to where the chunks meet the old ones again.
+     */
+    void Rechunk(GapBuffer &gb, unsigned head, unsigned tail);
+
+    /*
+     * Replace the file with the text of the buffer, through a temporary
+     * file in the same directory as the file a symbolic link points to,
+     * which is renamed over it.
+     * Throws std::runtime_error if it can't be written.
+     */
+    void Rewrite(GapBuffer &gb, const SavePolicy &policy);
+
+    /* There is no need for copy construction. */
+    FileSync(const FileSync &);
+
+public:
+    static const unsigned MIN_CHUNK = 2 << 10;
+    static const unsigned MAX_CHUNK = 64 << 10;
+
+    /*
+     * Remember the text of a buffer as what the file holds, the buffer is
+     * marked unchanged.
+     * @param filename The name of the file.
+     * @param gb The buffer, just read from the file.
+     */
+    FileSync(const std::string &filename, GapBuffer &gb);
+
+    const std::string & Path() const{ return path; }
+
+    /*
+     * Return the number of characters of the synced text.
+     */
+    unsigned Size() const{ return size; }
+
+    /*
+     * Return the number of chunks of the synced text.
+     */
+    size_t ChunkCount() const{ return chunks.size(); }
+
+    /*
+     * Work out how the file differs from the synced text, reading as
+     * little of it as possible. Doesn't change anything, so it may run on
+     * another thread as long as nothing is applied meanwhile.
+     */
+    FileChange Diff() const;
+
+    /*
+     * Apply a change to the buffer and take it as the synced text.
+     * The buffer is marked unchanged.
+     * @param gb The buffer, it must still hold the synced text.
+     * @param c The change made by Diff().
+     * @return false if the buffer no longer matches, nothing is changed then.
+     */
+    bool Apply(GapBuffer &gb, FileChange &c);
+
+    /*
+     * Take the text of a buffer as what the file holds.
+     * @param gb The buffer.
+     */
+    void Reset(GapBuffer &gb);
+
+    /*
+     * Write the buffer to the file, only what changed when that is safe.
+     * Throws std::runtime_error if it can't be written.
+     * @param gb The buffer, its changes are counted from when it last matched the file.
+     * @param policy When the file may be written in place.
+     * @return What was done.
+     */
+    SAVEKIND Save(GapBuffer &gb, const SavePolicy &policy = SavePolicy());
+
+    /*
+     * Cut text into chunks, appending them to out.
+     * @param s The text.
+     * @param len The number of characters.
+     * @param final Whether the text ends here, a last chunk is cut at the end then.
+     * @return The number of characters chunked, the rest starts an unfinished chunk.
+     */
+    static unsigned Chunk(const char * s, unsigned len, bool final, std::vector<TextChunk> &out);
+};
+
+#endif
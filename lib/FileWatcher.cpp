@@ -0,0 +1,153 @@
+#include "FileWatcher.h"
+
+#include <algorithm>
+
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+/*
+ * "a/b/c.txt" -> "a/b", "c.txt" and "c.txt" -> ".", "c.txt".
+ */
+void FileWatcher::SplitPath(const std::string &path, std::string &dir, std::string &name) {
+
+    std::string::size_type slash = path.rfind('/');
+    if(slash == std::string::npos){
+        dir = ".";
+        name = path;
+    }else{
+        dir = slash ? path.substr(0,slash) : "/";
+        name = path.substr(slash + 1);
+    }
+}
+
+#ifdef __linux__
+
+FileWatcher::FileWatcher():fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) {
+}
+
+FileWatcher::~FileWatcher() {
+    if(fd >= 0)
+        close(fd);
+}
+
+/*
+ * Watch the directory of the file. A directory is watched once however it
+ * is named, inotify hands out one watch per directory.
+ */
+bool FileWatcher::Add(const std::string &path) {
+
+    if(fd < 0)
+        return false;
+    if(files.count(path))
+        return true;
+
+    std::string dir,name;
+    SplitPath(path,dir,name);
+
+    int wd = inotify_add_watch(fd,dir.c_str(),IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ATTRIB);
+    if(wd < 0)
+        return false;
+    files[path] = wd;
+    return true;
+}
+
+void FileWatcher::Remove(const std::string &path) {
+
+    std::map<std::string,int>::iterator it = files.find(path);
+    if(it == files.end())
+        return;
+    int wd = it->second;
+    files.erase(it);
+
+    for(it = files.begin();it != files.end();++it)
+        if(it->second == wd)
+            return;
+    inotify_rm_watch(fd,wd);
+}
+
+/*
+ * Drain the inotify queue. A burst of writes to one file is a single change.
+ */
+std::vector<std::string> FileWatcher::Poll() {
+
+    std::vector<std::string> changed;
+    if(fd < 0)
+        return changed;
+
+    alignas(struct inotify_event) char events[16 << 10];
+    for(;;){
+        ssize_t n = read(fd,events,sizeof(events));
+        if(n <= 0)
+            break;
+
+        for(char *p = events;p < events + n;p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len){
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            for(std::map<std::string,int>::iterator it = files.begin();it != files.end();++it){
+                /* Events were lost, every file may have changed. */
+                if(ev->mask & IN_Q_OVERFLOW){
+                    changed.push_back(it->first);
+                    continue;
+                }
+                std::string dir,name;
+                SplitPath(it->first,dir,name);
+                if(it->second == ev->wd && ev->len && name == ev->name)
+                    changed.push_back(it->first);
+            }
+        }
+    }
+
+    std::sort(changed.begin(),changed.end());
+    changed.erase(std::unique(changed.begin(),changed.end()),changed.end());
+    return changed;
+}
+
+#else
+
+FileWatcher::FileWatcher() {
+}
+
+FileWatcher::~FileWatcher() {
+}
+
+/*
+ * Remember the size and modification time to compare against.
+ */
+bool FileWatcher::Add(const std::string &path) {
+
+    struct stat st;
+    if(stat(path.c_str(),&st) != 0)
+        return false;
+
+    FileState &s = files[path];
+    s.size = st.st_size;
+    s.mtime = st.st_mtime;
+    return true;
+}
+
+void FileWatcher::Remove(const std::string &path) {
+    files.erase(path);
+}
+
+/*
+ * Stat every file, a different size or modification time is a change.
+ */
+std::vector<std::string> FileWatcher::Poll() {
+
+    std::vector<std::string> changed;
+    for(std::map<std::string,FileState>::iterator it = files.begin();it != files.end();++it){
+        struct stat st;
+        if(stat(it->first.c_str(),&st) != 0)
+            continue;
+        if(st.st_size != it->second.size || st.st_mtime != it->second.mtime){
+            it->second.size = st.st_size;
+            it->second.mtime = st.st_mtime;
+            changed.push_back(it->first);
+        }
+    }
+    return changed;
+}
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * Tells which watched files changed on disk.
+ *
+ * On Linux the directories holding the files are watched with inotify, so
+ * a file which is replaced by rename (as most editors save) is still seen.
+ * Elsewhere Poll() compares size and modification time of every file.
+ * Poll() never blocks, it is meant to be called from the event loop.
+ */
+
+#ifndef FILEWATCHER_LIBRARY_H
+#define FILEWATCHER_LIBRARY_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+class FileWatcher{
+private:
+#ifdef __linux__
+    int fd;                                         //the inotify instance, -1 if there is none
+    std::map<std::string,int> files;                //path -> watch of its directory
+#else
+    struct FileState{
+        long long size;
+        long long mtime;
+    };
+    std::map<std::string,FileState> files;
+#endif
+
+    /*
+     * Split a path into its directory and its name.
+     */
+    static void SplitPath(const std::string &path, std::string &dir, std::string &name);
+
+    /* There is no need for copy construction. */
+    FileWatcher(const FileWatcher &);
+
+public:
+    FileWatcher();
+    ~FileWatcher();
+
+    /*
+     * Start watching a file, watching it twice does nothing.
+     * @param path The name of the file.
+     * @return false if it can't be watched.
+     */
+    bool Add(const std::string &path);
+
+    /*
+     * Stop watching a file.
+     * @param path The name it was added with.
+     */
+    void Remove(const std::string &path);
+
+    /*
+     * Return the files which changed since the last call, each one once,
+     * named as they were added.
+     */
+    std::vector<std::string> Poll();
+};
+
+#endif
@@ -0,0 +1,297 @@
+#include "FoldSet.h"
+
+#include <algorithm>
+
+/*
+ * Fenwick trees, 1-based: t[i] sums the values of (i - (i & -i), i].
+ */
+template<class T>
+static void FenwickAdd(std::vector<T> &t, size_t i, T v) {
+
+    for(;i < t.size();i += i & (0 - i))
+        t[i] += v;
+}
+
+template<class T>
+static T FenwickSum(const std::vector<T> &t, size_t i) {
+
+    T n = 0;
+    for(;i > 0;i -= i & (0 - i))
+        n += t[i];
+    return n;
+}
+
+/*
+ * Add a value after the last one.
+ */
+template<class T>
+static void FenwickAppend(std::vector<T> &t, T v) {
+
+    size_t i = t.size();
+    t.push_back(v + FenwickSum(t,i - 1) - FenwickSum(t,i - (i & (0 - i))));
+}
+
+FoldSet::FoldSet(Arena &a):anchors(a),tree(1,0),shifts(1,0),hidden(0),textLines(0) {
+}
+
+void FoldSet::Rebuild() {
+
+    tree.assign(folds.size() + 1,0);
+    shifts.assign(folds.size() + 1,0);
+    hidden = 0;
+    for(size_t i = 1;i <= folds.size();++i){
+        tree[i] += folds[i - 1].lines;
+        hidden += folds[i - 1].lines;
+        size_t parent = i + (i & (0 - i));
+        if(parent <= folds.size())
+            tree[parent] += tree[i];
+    }
+}
+
+void FoldSet::Settle() {
+
+    for(size_t k = 0;k < folds.size();++k){
+        int shift = Shift(k);
+        folds[k].firstLine += shift;
+        folds[k].lastLine += shift;
+    }
+    std::fill(shifts.begin(),shifts.end(),0);
+}
+
+int FoldSet::Shift(size_t k) const {
+    return FenwickSum(shifts,k + 1);
+}
+
+void FoldSet::SetLineNumbers(size_t k, unsigned int first, unsigned int last) {
+
+    int shift = Shift(k);
+    folds[k].firstLine = first - shift;
+    folds[k].lastLine = last - shift;
+}
+
+void FoldSet::SetLines(size_t k, unsigned int lines) {
+
+    FenwickAdd(tree,k + 1,lines - folds[k].lines);
+    hidden += lines - folds[k].lines;
+    folds[k].lines = lines;
+}
+
+unsigned int FoldSet::HiddenBefore(size_t k) const {
+    return FenwickSum(tree,k);
+}
+
+size_t FoldSet::FoldsFrom(unsigned int line) const {
+
+    size_t lo = 0, hi = folds.size();
+    while(lo < hi){
+        size_t mid = (lo + hi) / 2;
+        if(FirstLine(mid) <= line)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+size_t FoldSet::FoldsBefore(unsigned int line) const {
+
+    size_t lo = 0, hi = folds.size();
+    while(lo < hi){
+        size_t mid = (lo + hi) / 2;
+        if(LastLine(mid) < line)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+void FoldSet::Erase(size_t from, size_t to) {
+
+    Settle();
+    for(size_t k = from;k < to;++k){
+        anchors.Remove(folds[k].start);
+        anchors.Remove(folds[k].last);
+    }
+    folds.erase(folds.begin() + from,folds.begin() + to);
+}
+
+bool FoldSet::Fold(StructureIndex &s, unsigned int first, unsigned int last) {
+
+    /* Changes are not applied while there are no folds, the line numbers start over. */
+    if(folds.empty())
+        textLines = s.Lines();
+
+    last = std::min(last,s.Lines() - 1);
+    if(first == 0 || first > last)
+        return false;
+
+    /* The folds from the one touching the header to the one touching the line after last. */
+    size_t from = FoldsBefore(first - 1), to = FoldsFrom(last + 1);
+    if(from < to){
+        first = std::min(first,FirstLine(from));
+        last = std::max(last,LastLine(to - 1));
+        Erase(from,to);
+    }
+
+    Region f;
+    f.start = anchors.Add(s.LineStart(first),GRAVITY::LEFT);
+    f.last = anchors.Add(s.LineStart(last),GRAVITY::LEFT);
+    f.lines = last - first + 1;
+    f.firstLine = first;
+    f.lastLine = last;
+
+    /* Folding down the text appends, which the trees take in O(log folds). */
+    if(from == to && from == folds.size()){
+        FenwickAppend(shifts,0);
+        folds.push_back(f);
+        SetLineNumbers(from,first,last);
+        FenwickAppend(tree,f.lines);
+        hidden += f.lines;
+        return true;
+    }
+    Settle();
+    folds.insert(folds.begin() + from,f);
+    Rebuild();
+    return true;
+}
+
+bool FoldSet::Unfold(unsigned int line) {
+
+    size_t k = FoldsFrom(line + 1);
+    if(k == 0 || LastLine(k - 1) < line)
+        return false;
+    Erase(k - 1,k);
+    Rebuild();
+    return true;
+}
+
+/*
+ * Only folds the changed range reaches can have lost or gained lines, the
+ * anchors moved all others along with their text and the ones after it
+ * are shifted by the lines it added.
+ */
+void FoldSet::Apply(StructureIndex &s, const TextChange &c) {
+
+    anchors.Apply(c);
+    int added = (int)(s.Lines() - textLines);
+    textLines = s.Lines();
+    if(folds.empty() || c.deltas.empty())
+        return;
+
+    /* The range of the new text outside of which nothing changed. */
+    unsigned long long lo = c.deltas[0].offset, hi = lo;
+    for(size_t i = 0;i < c.deltas.size();++i){
+        const TextDelta &d = c.deltas[i];
+        hi = hi >= d.offset + d.removed ? hi + d.inserted - d.removed : d.offset + d.inserted;
+        lo = std::min(lo,(unsigned long long)d.offset);
+    }
+
+    size_t from = 0, to = folds.size();
+    while(from < to){
+        size_t mid = (from + to) / 2;
+        if(anchors.Offset(folds[mid].last) < lo)
+            from = mid + 1;
+        else
+            to = mid;
+    }
+    to = from;
+    while(to < folds.size() && anchors.Offset(folds[to].start) <= hi)
+        ++to;
+    if(added != 0 && to < folds.size())
+        FenwickAdd(shifts,to + 1,added);
+
+    /*
+     * Recount them, and check them and their neighbours for headers lost
+     * and folds touching. A fold whose first hidden line was joined to its
+     * header starts at the line after it, the joined line is the header.
+     */
+    bool erased = false;
+    size_t k = from > 0 ? from - 1 : 0;
+    to = std::min(to + 1,folds.size());
+    while(k < to){
+        unsigned int start = anchors.Offset(folds[k].start), first = s.LineOf(start);
+        if(s.LineStart(first) != start && ++first < s.Lines()){
+            anchors.Remove(folds[k].start);
+            folds[k].start = anchors.Add(s.LineStart(first),GRAVITY::LEFT);
+        }
+        unsigned int lastStart = anchors.Offset(folds[k].last), last = s.LineOf(lastStart);
+        if(s.LineStart(last) != lastStart){
+            anchors.Remove(folds[k].last);
+            folds[k].last = anchors.Add(s.LineStart(last),GRAVITY::LEFT);
+        }
+        if(first == 0 || last < first || first >= s.Lines()){
+            Erase(k,k + 1);
+            to = std::min(to - 1,folds.size());
+            erased = true;
+            continue;
+        }
+        if(k + 1 < folds.size() && s.LineOf(anchors.Offset(folds[k + 1].start)) <= last + 1){
+            if(s.LineOf(anchors.Offset(folds[k + 1].last)) > last)
+                std::swap(folds[k].last,folds[k + 1].last);
+            Erase(k + 1,k + 2);
+            to = std::max(k + 1,std::min(to - 1,folds.size()));
+            erased = true;
+            continue;
+        }
+        SetLineNumbers(k,first,last);
+        if(erased)
+            folds[k].lines = last - first + 1;
+        else if(folds[k].lines != last - first + 1)
+            SetLines(k,last - first + 1);
+        ++k;
+    }
+    if(erased)
+        Rebuild();
+}
+
+unsigned int FoldSet::VisualLine(unsigned int line) const {
+
+    size_t k = FoldsFrom(line);
+    if(k > 0 && LastLine(k - 1) >= line)
+        return FirstLine(k - 1) - 1 - HiddenBefore(k - 1);
+    return line - HiddenBefore(k);
+}
+
+/*
+ * The line shown on a row is the row plus the lines hidden before it, by
+ * the folds whose first line would be shown on that row or before it.
+ */
+unsigned int FoldSet::BufferLine(StructureIndex &s, unsigned int visual) const {
+
+    size_t lo = 0, hi = folds.size();
+    while(lo < hi){
+        size_t mid = (lo + hi) / 2;
+        if(FirstLine(mid) - HiddenBefore(mid) <= visual)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return std::min(visual + HiddenBefore(lo),s.Lines() - 1);
+}
+
+bool FoldSet::Next(StructureIndex &s, unsigned int offset, unsigned int &from, unsigned int &to, unsigned int &lines) {
+
+    size_t lo = 0, hi = folds.size();
+    while(lo < hi){
+        size_t mid = (lo + hi) / 2;
+        if(anchors.Offset(folds[mid].start) < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if(lo == folds.size())
+        return false;
+
+    from = anchors.Offset(folds[lo].start);
+    to = s.LineStart(LastLine(lo) + 1);
+    lines = folds[lo].lines;
+    return true;
+}
+
+void FoldSet::Clear() {
+
+    anchors.Clear();
+    folds.clear();
+    Rebuild();
+}
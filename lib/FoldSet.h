@@ -0,0 +1,165 @@
+/*
+ * Folds: runs of whole lines hidden from view under a header line which
+ * stays visible, the line before the first hidden one.
+ *
+ * A fold is held by two anchors (see AnchorSet.h), at the starts of its
+ * first and last hidden lines, so it follows the edits of the text around
+ * it and in it. Folds are kept in the order of the text, apart from each
+ * other: folding lines which overlap or touch a fold makes one fold of
+ * both. The hidden lines of the folds are added up in a Fenwick tree.
+ *
+ * The line numbers of a fold are kept too, less a shift held in a second
+ * Fenwick tree: a change only recounts the folds it reaches, the folds
+ * after it are shifted by the lines it added or took away in O(log folds).
+ * Mapping a line to the row it is shown on and back is a binary search
+ * over the folds which never reads the text.
+ *
+ * The lines are counted by a StructureIndex of the same text, passed to
+ * every call which needs them. It must be up to date, Apply it first.
+ * While there are folds every change must be applied to the set, without
+ * folds it may skip changes.
+ */
+
+#ifndef FOLDSET_LIBRARY_H
+#define FOLDSET_LIBRARY_H
+
+#include "AnchorSet.h"
+#include "StructureIndex.h"
+#include <vector>
+
+class FoldSet{
+private:
+    struct Region{
+        Anchor start;                   //where the first hidden line starts
+        Anchor last;                    //where the last hidden line starts
+        unsigned int lines;             //hidden lines
+        unsigned int firstLine;         //first and last hidden line, less the shift
+        unsigned int lastLine;
+    };
+
+    AnchorSet anchors;
+    std::vector<Region> folds;          //in the order of the text
+    std::vector<unsigned int> tree;     //Fenwick tree over the hidden lines of folds
+    std::vector<int> shifts;            //Fenwick tree over the shift each fold adds to the ones after it
+    unsigned int hidden;                //all hidden lines
+    unsigned int textLines;             //lines of the text the line numbers are for
+
+    /*
+     * Build the Fenwick trees again after folds were added or removed.
+     * Settle() the shifts first.
+     */
+    void Rebuild();
+
+    /*
+     * Move the shifts into the line numbers of the folds.
+     */
+    void Settle();
+
+    /*
+     * Return the shift of the line numbers of fold k.
+     */
+    int Shift(size_t k) const;
+
+    /*
+     * Set the line numbers of fold k.
+     */
+    void SetLineNumbers(size_t k, unsigned int first, unsigned int last);
+
+    /*
+     * Change the hidden lines of a fold.
+     */
+    void SetLines(size_t k, unsigned int lines);
+
+    /*
+     * Return the hidden lines of the folds before fold k.
+     */
+    unsigned int HiddenBefore(size_t k) const;
+
+    unsigned int FirstLine(size_t k) const{ return folds[k].firstLine + Shift(k); }
+    unsigned int LastLine(size_t k) const{ return folds[k].lastLine + Shift(k); }
+
+    /*
+     * Return the number of folds whose first hidden line is at most line.
+     */
+    size_t FoldsFrom(unsigned int line) const;
+
+    /*
+     * Return the number of folds whose last hidden line is before line.
+     */
+    size_t FoldsBefore(unsigned int line) const;
+
+    /*
+     * Take folds [from, to) away, without rebuilding the trees.
+     */
+    void Erase(size_t from, size_t to);
+
+    /* There is no need for copy construction. */
+    FoldSet(const FoldSet &);
+
+public:
+    /*
+     * Create an empty set.
+     * @param a The arena its anchors are allocated from, it must outlive the set.
+     */
+    explicit FoldSet(Arena &a);
+
+    /*
+     * Hide lines. Folds they overlap or touch are made part of the fold.
+     * @param first The first line hidden, at least 1: line first - 1 is the header.
+     * @param last The last line hidden.
+     * @return False if there is nothing to hide.
+     */
+    bool Fold(StructureIndex &s, unsigned int first, unsigned int last);
+
+    /*
+     * Show the lines of the fold a line is the header of, or is hidden in.
+     * @return False if there is no such fold.
+     */
+    bool Unfold(unsigned int line);
+
+    /*
+     * Follow a change of the text. Folds which lose their header or all of
+     * their lines are dropped, folds which come to touch are joined.
+     * @param s The structure index, already updated for the change.
+     */
+    void Apply(StructureIndex &s, const TextChange &c);
+
+    /*
+     * Return the row a line is shown on, counting lines and not wrapped
+     * rows. A hidden line is shown on the row of its header.
+     */
+    unsigned int VisualLine(unsigned int line) const;
+
+    /*
+     * Return the line shown on a row, the last line past the last row.
+     */
+    unsigned int BufferLine(StructureIndex &s, unsigned int visual) const;
+
+    /*
+     * Return the number of rows the lines are shown on.
+     */
+    unsigned int VisualLines(StructureIndex &s) const{ return s.Lines() - hidden; }
+
+    /*
+     * Find the first fold starting at an offset or after it.
+     * @param from Set to the offset of its first hidden character.
+     * @param to Set to the offset after its last hidden line.
+     * @param lines Set to the number of lines it hides.
+     * @return False if there is none.
+     */
+    bool Next(StructureIndex &s, unsigned int offset, unsigned int &from, unsigned int &to, unsigned int &lines);
+
+    size_t Count() const{ return folds.size(); }
+
+    /*
+     * Return the number of hidden lines.
+     */
+    unsigned int Hidden() const{ return hidden; }
+
+    /*
+     * Show all lines.
+     */
+    void Clear();
+};
+
+#endif
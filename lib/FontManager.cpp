@@ -0,0 +1,116 @@
+#include "FontManager.h"
+
+#include <fstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ * SDL_ttf counts its initializations, so every manager can hold its own.
+ */
+FontManager::FontManager() {
+    if(TTF_Init() != 0)
+        throw std::runtime_error(std::string("Can not initialize TTF: ") + TTF_GetError());
+}
+
+/*
+ * Close the fonts first, they read from the file data.
+ */
+FontManager::~FontManager() {
+
+    for(std::map<std::pair<std::string,int>,TTF_Font *>::iterator it = fonts.begin();it != fonts.end();++it)
+        TTF_CloseFont(it->second);
+
+    for(std::map<std::string,FontData *>::iterator it = files.begin();it != files.end();++it){
+#ifndef _WIN32
+        if(it->second->mapped)
+            munmap(const_cast<unsigned char *>(it->second->data),it->second->size);
+#endif
+        delete it->second;
+    }
+    TTF_Quit();
+}
+
+/*
+ * Map the font file, or read it into memory if it can't be mapped.
+ */
+FontManager::FontData * FontManager::Load(const std::string &face) {
+
+    std::map<std::string,FontData *>::iterator it = files.find(face);
+    if(it != files.end())
+        return it->second;
+
+    FontData *f = new FontData;
+    f->data = nullptr;
+    f->size = 0;
+    f->mapped = false;
+
+#ifndef _WIN32
+    int fd = open(face.c_str(),O_RDONLY);
+    struct stat st;
+    if(fd >= 0 && fstat(fd,&st) == 0 && st.st_size > 0){
+        void *p = mmap(nullptr,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+        if(p != MAP_FAILED){
+            f->data = static_cast<const unsigned char *>(p);
+            f->size = st.st_size;
+            f->mapped = true;
+        }
+    }
+    if(fd >= 0)
+        close(fd);
+#endif
+
+    if(!f->mapped){
+        std::ifstream in(face.c_str(),std::ios::binary);
+        if(in)
+            f->copy.assign(std::istreambuf_iterator<char>(in),std::istreambuf_iterator<char>());
+        if(f->copy.empty()){
+            delete f;
+            throw std::runtime_error("Can not read font " + face + ".");
+        }
+        f->data = &f->copy[0];
+        f->size = f->copy.size();
+    }
+
+    files[face] = f;
+    return f;
+}
+
+/*
+ * Return the font of a face at a size, opening it from memory on first use.
+ */
+TTF_Font * FontManager::Get(const std::string &face, int size) {
+
+    std::lock_guard<std::mutex> lock(m);
+
+    std::pair<std::string,int> key(face,size);
+    std::map<std::pair<std::string,int>,TTF_Font *>::iterator it = fonts.find(key);
+    if(it != fonts.end())
+        return it->second;
+
+    FontData *f = Load(face);
+    SDL_RWops *rw = SDL_RWFromConstMem(f->data,f->size);
+    TTF_Font *font = rw ? TTF_OpenFontRW(rw,1,size) : nullptr;
+    if(font == nullptr)
+        throw std::runtime_error("Can not open font " + face + ": " + TTF_GetError());
+
+    fonts[key] = font;
+    return font;
+}
+
+/*
+ * Return the number of bytes of font files held in memory.
+ */
+size_t FontManager::ResidentBytes() {
+
+    std::lock_guard<std::mutex> lock(m);
+    size_t n = 0;
+    for(std::map<std::string,FontData *>::iterator it = files.begin();it != files.end();++it)
+        n += it->second->size;
+    return n;
+}
@@ -0,0 +1,68 @@
+/*
+ * Shared font resources.
+ *
+ * Every font file is read once: memory-mapped where the platform allows it,
+ * copied into memory otherwise. TTF_Font handles for a (face, size) pair
+ * are opened lazily from that memory and kept, so changing the font size
+ * never touches the disk again. One manager can be shared by several
+ * windows and their glyph atlases.
+ */
+
+#ifndef FONTMANAGER_LIBRARY_H
+#define FONTMANAGER_LIBRARY_H
+
+#include "SDL2/SDL.h"
+#include "SDL2/SDL_ttf.h"
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+class FontManager{
+private:
+    /* The bytes of one font file. */
+    struct FontData{
+        const unsigned char *data;
+        size_t size;
+        bool mapped;                        //munmap instead of the copy
+        std::vector<unsigned char> copy;
+    };
+
+    std::mutex m;
+    std::map<std::string,FontData *> files;
+    std::map<std::pair<std::string,int>,TTF_Font *> fonts;
+
+    /*
+     * Return the bytes of a font file, loading them on first use, m must be held.
+     * Throws std::runtime_error if the file can't be read.
+     */
+    FontData * Load(const std::string &face);
+
+    /* There is no need for copy construction. */
+    FontManager(const FontManager &);
+
+public:
+    /* Initializes SDL_ttf, the manager holds a reference on it until destroyed. */
+    FontManager();
+
+    /* Closes every font and releases the file data. */
+    ~FontManager();
+
+    /*
+     * Return the font of a face at a size, opening it on first use.
+     * The handle stays valid while the manager lives; a TTF_Font must not
+     * be used by two threads at the same time.
+     * Throws std::runtime_error if the file can't be read or isn't a font.
+     * @param face The path of the font file.
+     * @param size The point size.
+     */
+    TTF_Font * Get(const std::string &face, int size);
+
+    /*
+     * Return the number of bytes of font files held in memory (mapped or copied).
+     */
+    size_t ResidentBytes();
+};
+
+#endif
@@ -0,0 +1,151 @@
+#include "FrameProfiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+static const char * const PHASE_NAMES[FRAMEPHASE_COUNT] = {"event drain","edit apply","layout","render","present"};
+
+FrameProfiler::FrameProfiler():origin(clock::now()),frames(0),tracing(false) {
+
+    std::fill(window,window + WINDOW,0.0);
+    std::fill(phaseLast,phaseLast + FRAMEPHASE_COUNT,0.0);
+    std::fill(counterLast,counterLast + FRAMECOUNTER_COUNT,0);
+    for(int i = 0;i < FRAMECOUNTER_COUNT;++i)
+        counters[i] = 0;
+}
+
+/*
+ * Write the trace file if one was asked for.
+ */
+FrameProfiler::~FrameProfiler() {
+    WriteTrace();
+}
+
+/*
+ * Map a thread to a small number for the trace.
+ */
+unsigned long FrameProfiler::ThreadIndex(std::thread::id id) {
+
+    for(size_t i = 0;i < threads.size();++i)
+        if(threads[i] == id)
+            return i + 1;
+    threads.push_back(id);
+    return threads.size();
+}
+
+/*
+ * Keep a trace event.
+ */
+void FrameProfiler::AddEvent(int phase, clock::time_point start, clock::time_point end) {
+
+    if(!tracing || events.size() >= MAX_TRACE_EVENTS)
+        return;
+
+    TraceEvent ev;
+    ev.phase = phase;
+    ev.tid = ThreadIndex(std::this_thread::get_id());
+    ev.startUs = std::chrono::duration_cast<std::chrono::microseconds>(start - origin).count();
+    ev.durUs = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    events.push_back(ev);
+}
+
+/*
+ * Record one phase.
+ */
+void FrameProfiler::AddPhase(FRAMEPHASE phase, clock::time_point start, clock::time_point end) {
+
+    std::lock_guard<std::mutex> lock(m);
+    phaseLast[static_cast<int>(phase)] = std::chrono::duration<double,std::milli>(end - start).count();
+    AddEvent(static_cast<int>(phase),start,end);
+}
+
+/*
+ * Count something that happened in the current frame.
+ */
+void FrameProfiler::Count(FRAMECOUNTER c, unsigned long n) {
+    counters[static_cast<int>(c)].fetch_add(n,std::memory_order_relaxed);
+}
+
+/*
+ * Close the current frame.
+ */
+void FrameProfiler::EndFrame(clock::time_point start) {
+
+    clock::time_point end = clock::now();
+
+    std::lock_guard<std::mutex> lock(m);
+    window[frames % WINDOW] = std::chrono::duration<double,std::milli>(end - start).count();
+    ++frames;
+    for(int i = 0;i < FRAMECOUNTER_COUNT;++i)
+        counterLast[i] = counters[i].exchange(0);
+    AddEvent(-1,start,end);
+}
+
+/*
+ * Return the figures the overlay shows.
+ */
+FrameStats FrameProfiler::GetStats() {
+
+    FrameStats s;
+    std::vector<double> v;
+
+    {
+        std::lock_guard<std::mutex> lock(m);
+        s.frames = frames;
+        std::copy(phaseLast,phaseLast + FRAMEPHASE_COUNT,s.phaseLast);
+        std::copy(counterLast,counterLast + FRAMECOUNTER_COUNT,s.counterLast);
+        v.assign(window,window + std::min<unsigned long>(frames,WINDOW));
+    }
+
+    std::sort(v.begin(),v.end());
+    s.frameP50 = v.empty() ? 0 : v[v.size() / 2];
+    s.frameP99 = v.empty() ? 0 : v[std::min(v.size() - 1,v.size() * 99 / 100)];
+    return s;
+}
+
+/*
+ * Collect trace events from now on.
+ */
+void FrameProfiler::StartTrace(const char *filename) {
+
+    std::lock_guard<std::mutex> lock(m);
+    traceFile = filename;
+    tracing = true;
+    events.reserve(1 << 16);
+}
+
+/*
+ * Write the Chrome trace-event JSON file, complete ("X") events only.
+ * Collecting stops once the file is written.
+ */
+bool FrameProfiler::WriteTrace() {
+
+    std::lock_guard<std::mutex> lock(m);
+    if(!tracing)
+        return true;
+
+    std::ofstream out(traceFile.c_str());
+    if(!out){
+        std::cout << "Can't write frame trace " << traceFile << std::endl;
+        return false;
+    }
+
+    out << "{\"traceEvents\":[\n";
+    for(size_t i = 0;i < threads.size();++i)
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i + 1
+            << ",\"args\":{\"name\":\"" << (i == 0 ? "input" : "render") << "\"}},\n";
+
+    for(size_t i = 0;i < events.size();++i){
+        const TraceEvent &ev = events[i];
+        out << "{\"name\":\"" << (ev.phase < 0 ? "frame" : PHASE_NAMES[ev.phase])
+            << "\",\"cat\":\"editor\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ev.tid
+            << ",\"ts\":" << ev.startUs << ",\"dur\":" << ev.durUs << "}"
+            << (i + 1 < events.size() ? ",\n" : "\n");
+    }
+    out << "]}\n";
+
+    tracing = false;
+    std::vector<TraceEvent>().swap(events);
+    return true;
+}
@@ -0,0 +1,136 @@
+/*
+ * Per frame timing of the editor loop.
+ *
+ * The input thread reports event draining, edit applying and layout, the
+ * render thread reports drawing and present/vsync wait and ends the frame.
+ * Frame times are kept in a rolling window for the on-screen overlay, and
+ * every phase can also be written out as a Chrome trace-event JSON file
+ * (load it in chrome://tracing or Perfetto).
+ */
+
+#ifndef FRAMEPROFILER_LIBRARY_H
+#define FRAMEPROFILER_LIBRARY_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class FRAMEPHASE{EVENTDRAIN = 0,EDITAPPLY,LAYOUT,RENDER,PRESENT};
+static const int FRAMEPHASE_COUNT = 5;
+
+enum class FRAMECOUNTER{GLYPHCACHEMISS = 0,TEXTUREUPLOAD,DRAWCALL};
+static const int FRAMECOUNTER_COUNT = 3;
+
+/*
+ * What the overlay shows, times in milliseconds.
+ */
+struct FrameStats{
+    unsigned long frames;                       //frames ended so far
+    double frameP50;                            //over the rolling window
+    double frameP99;
+    double phaseLast[FRAMEPHASE_COUNT];         //the latest time of every phase
+    unsigned long counterLast[FRAMECOUNTER_COUNT];  //counted during the latest frame
+};
+
+class FrameProfiler{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    /*
+     * Times a phase from construction to destruction.
+     */
+    class Scope{
+    private:
+        FrameProfiler &profiler;
+        FRAMEPHASE phase;
+        clock::time_point start;
+
+    public:
+        Scope(FrameProfiler &p, FRAMEPHASE ph):profiler(p),phase(ph),start(clock::now()){}
+        ~Scope(){ profiler.AddPhase(phase,start,clock::now()); }
+    };
+
+private:
+    static const unsigned WINDOW = 240;
+    /* Stop collecting trace events beyond this, about 100MB of JSON. */
+    static const size_t MAX_TRACE_EVENTS = 1000000;
+
+    struct TraceEvent{
+        int phase;              //FRAMEPHASE, or -1 for a whole frame
+        unsigned long tid;
+        long long startUs;
+        long long durUs;
+    };
+
+    clock::time_point origin;
+
+    std::mutex m;
+    double window[WINDOW];
+    unsigned long frames;
+    double phaseLast[FRAMEPHASE_COUNT];
+    unsigned long counterLast[FRAMECOUNTER_COUNT];
+    std::atomic<unsigned long> counters[FRAMECOUNTER_COUNT];
+
+    bool tracing;
+    std::string traceFile;
+    std::vector<TraceEvent> events;
+    std::vector<std::thread::id> threads;
+
+    /*
+     * Map a thread to a small number for the trace, m must be held.
+     */
+    unsigned long ThreadIndex(std::thread::id id);
+
+    /*
+     * Keep a trace event, m must be held.
+     */
+    void AddEvent(int phase, clock::time_point start, clock::time_point end);
+
+    /* There is no need for copy construction. */
+    FrameProfiler(const FrameProfiler &);
+
+public:
+    FrameProfiler();
+
+    /* Writes the trace file if one was asked for. */
+    ~FrameProfiler();
+
+    /*
+     * Record one phase.
+     */
+    void AddPhase(FRAMEPHASE phase, clock::time_point start, clock::time_point end);
+
+    /*
+     * Count something that happened in the current frame.
+     */
+    void Count(FRAMECOUNTER c, unsigned long n = 1);
+
+    /*
+     * Close the current frame, render thread only.
+     * @param start When the frame started.
+     */
+    void EndFrame(clock::time_point start);
+
+    /*
+     * Return the figures the overlay shows.
+     */
+    FrameStats GetStats();
+
+    /*
+     * Collect trace events from now on and write them when WriteTrace is
+     * called or the profiler is destroyed.
+     * @param filename The name of the JSON file.
+     */
+    void StartTrace(const char * filename);
+
+    /*
+     * Write the Chrome trace-event JSON file and stop collecting.
+     * @return false if the file can't be written.
+     */
+    bool WriteTrace();
+};
+
+#endif
@@ -1,18 +1,62 @@
 #include "GapBuffer.h"
 
+#include <algorithm>
+#include <climits>
+#include <cstring>
 #include <iostream>
 #include <fstream>
+#include <stdexcept>
 #include <string>
 
-void GapBuffer::InitBuffer(unsigned int size){
+#ifndef _WIN32
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Streams of unknown length are read in chunks of this size. */
+static const unsigned int STREAM_CHUNK_SIZE = 1 << 16;
+
+/*
+ * Copy n characters, the size of a copy is known at compile time.
+ */
+template<class CharT>
+static inline void CopyChars(CharT *to, const CharT *from, size_t n){
+    memcpy(to,from,n * sizeof(CharT));
+}
+
+template<class CharT>
+static inline void MoveChars(CharT *to, const CharT *from, size_t n){
+    memmove(to,from,n * sizeof(CharT));
+}
+
+/*
+ * Write characters for people to read: char text as it is, wider
+ * characters as ASCII or '?'.
+ */
+static void WriteChars(std::ostream &os, const char *s, size_t n){
+    os.write(s,n);
+}
+
+template<class CharT>
+static void WriteChars(std::ostream &os, const CharT *s, size_t n){
+    for(size_t i = 0;i < n;++i)
+        os.put(s[i] < 128 ? (char)s[i] : '?');
+}
+
+template<class CharT, class Growth, class Alloc>
+const int BasicGapBuffer<CharT,Growth,Alloc>::DEFAULT_GAP_BUFFER_SIZE;
+
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::InitBuffer(unsigned int size){
 
     /* we can't initialize within construction list*/
     GAP_BUFFER_SIZE = size;
 
     if(text)
-        delete[] text;
+        Free(text,textEnd - text);
 
-    text = new char[GAP_BUFFER_SIZE];
+    text = Allocate(GAP_BUFFER_SIZE);
 
     if(!text){
         throw std::runtime_error("There is no enough space.");
@@ -22,13 +66,21 @@ void GapBuffer::InitBuffer(unsigned int size){
     gapStart = text;
     gapEnd = textEnd;
     cursor = text;
+    unchangedHead = unchangedTail = 0;
+    version = 0;
+    transactionDepth = 0;
+    nextSubscriber = 0;
+
+    GB_STAT(memset(&stats,0,sizeof(stats)); stats.enabled = true);
+    GB_STAT(stats.capacity = stats.peakCapacity = GAP_BUFFER_SIZE);
 }
 
 
 /*
  * Initialization of Gap Buffer
  */
-GapBuffer::GapBuffer(int gsize):text(nullptr) {
+template<class CharT, class Growth, class Alloc>
+BasicGapBuffer<CharT,Growth,Alloc>::BasicGapBuffer(int gsize, const Alloc &a):text(nullptr),alloc(a) {
 
     InitBuffer(gsize);
 }
@@ -39,15 +91,16 @@ GapBuffer::GapBuffer(int gsize):text(nullptr) {
  * 2.Initialize the buffer
  * 3.Text-->buffer
  */
-GapBuffer::GapBuffer(const char *filename) {
+template<class CharT, class Growth, class Alloc>
+BasicGapBuffer<CharT,Growth,Alloc>::BasicGapBuffer(const char *filename, const Alloc &a):text(nullptr),alloc(a) {
 
     std::ifstream in(filename,std::ios::binary | std::ios::ate);
 
     if(!in.is_open())
         throw std::runtime_error("Can't open this text file.");
 
-    /* Set buffer size be twice size of file size. */
-    unsigned int fileSize = in.tellg(),bufferSize = fileSize * 2;
+    /* Set buffer size be twice size of file size, a last incomplete character is dropped. */
+    unsigned int fileSize = (unsigned long long)in.tellg() / sizeof(CharT),bufferSize = fileSize * 2;
 
     InitBuffer(bufferSize);
 
@@ -55,72 +108,119 @@ GapBuffer::GapBuffer(const char *filename) {
 
 
     in.seekg(0,std::ios::beg);
-    in.read(text,fileSize);
+    in.read(reinterpret_cast<char *>(text),(std::streamsize)fileSize * sizeof(CharT));
     in.close();
 
+    GB_STAT(stats.peakSize = fileSize);
+
 
 }
 
 /*
- * Expand the size of Gap Buffer by factor 2.
+ * Expand the size of Gap Buffer by the growth policy.
  */
-void GapBuffer::ExpandBuffer() {
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::ExpandBuffer() {
+    ExpandBuffer(gap_size() + 1);
+}
 
-    GAP_BUFFER_SIZE *= 2;
-    char * ntext = new char[GAP_BUFFER_SIZE];
+/*
+ * Expand the size of Gap Buffer by the growth policy until the gap holds
+ * minGap characters, the text is copied only once.
+ */
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::ExpandBuffer(unsigned int minGap) {
+
+    unsigned long long need = (unsigned long long)size() + minGap;
+    unsigned long long newSize = GAP_BUFFER_SIZE;
 
-    /* Copy the left part of the text */
-    memcpy(ntext,text,gapStart-text);
-    /* Copy the right part of the text */
-    memcpy(ntext+(gapStart-text),gapEnd,textEnd-gapEnd);
+    /* A buffer loaded from an empty file has no space at all. */
+    if(newSize == 0)
+        newSize = DEFAULT_GAP_BUFFER_SIZE;
+    newSize = Growth::Grow(newSize,need);
+
+    if(newSize > UINT_MAX){
+        if(need > UINT_MAX)
+            throw std::runtime_error("There is no enough space.");
+        newSize = UINT_MAX;
+    }
 
     /* Remember the old place of cursor. */
     unsigned cursorOffset = CursorOffset();
     /* Remember the text size */
     unsigned textSize = size();
 
-    delete [] text;
+    CharT * ntext = Allocate(newSize);
+
+    GB_STAT(++stats.expands; stats.bytesCopied += textSize * sizeof(CharT));
+    GB_STAT(stats.capacity = newSize);
+    GB_STAT(if(newSize > stats.peakCapacity) stats.peakCapacity = newSize);
+    /*
+     * The new gap is opened right at the cursor, so the insert that made us
+     * grow doesn't have to move the text a second time.
+     */
+    GetString(0,cursorOffset,ntext);
+    GetString(cursorOffset,textSize - cursorOffset,ntext + newSize - (textSize - cursorOffset));
+
+    Free(text,textEnd - text);
+    GAP_BUFFER_SIZE = newSize;
     text = ntext;
     textEnd = text + GAP_BUFFER_SIZE;
 
-    gapStart = text + textSize;
-    gapEnd = textEnd;
-
-    SetCursor(cursorOffset);
+    gapStart = cursor = text + cursorOffset;
+    gapEnd = textEnd - (textSize - cursorOffset);
 }
 
 
 /*
- * Deconstruction function of GapBuffer.
+ * Reallocate to the text plus a small gap at the cursor, one copy.
  */
-GapBuffer::~GapBuffer() {
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::ShrinkToFit(unsigned int gap) {
 
-    if (text)
-        delete [] text;
-}
+    if(gap_size() <= gap)
+        return;
 
+    unsigned cursorOffset = CursorOffset();
+    unsigned textSize = size();
+    unsigned long long newSize = (unsigned long long)textSize + gap;
+    if(newSize > UINT_MAX)
+        newSize = UINT_MAX;
 
-/*
- * Return size of text of GapBuffer.
- */
-unsigned int GapBuffer::size() {
+    CharT * ntext = Allocate(newSize);
+    GetString(0,cursorOffset,ntext);
+    GetString(cursorOffset,textSize - cursorOffset,ntext + newSize - (textSize - cursorOffset));
 
-    return (textEnd - text) - (gapEnd - gapStart);
+    GB_STAT(stats.bytesCopied += textSize * sizeof(CharT));
+    GB_STAT(stats.capacity = newSize);
+
+    Free(text,textEnd - text);
+    GAP_BUFFER_SIZE = newSize;
+    text = ntext;
+    textEnd = text + GAP_BUFFER_SIZE;
+
+    gapStart = cursor = text + cursorOffset;
+    gapEnd = textEnd - (textSize - cursorOffset);
 }
 
 /*
-* Return the size of gap.
+ * Deconstruction function of GapBuffer.
  */
-unsigned int GapBuffer::gap_size() {
-    return gapEnd-gapStart;
+template<class CharT, class Growth, class Alloc>
+BasicGapBuffer<CharT,Growth,Alloc>::~BasicGapBuffer() {
+
+    if (text)
+        Free(text,textEnd - text);
 }
 
+
 /*
 * Move the gap to the current position of the cursor.
 * Because when we press left key or right key, the cursor would go but the gap would't.
 * The effect of this function is to keep insertion of left part easy.
 */
-void GapBuffer::GapUpdate() {
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::GapUpdate() {
 
     /* Cursor is the begin of gap. */
     if(cursor == gapStart)
@@ -131,12 +231,16 @@ void GapBuffer::GapUpdate() {
         return;
     }
 
+    GB_STAT(++stats.gapUpdates);
+    GB_STAT(stats.bytesMoved += (cursor < gapStart ? gapStart - cursor : cursor - gapEnd) * sizeof(CharT));
+
+    /* The source and destination may overlap when the gap is small. */
     if(cursor < gapStart){
-        memcpy(gapEnd-(gapStart-cursor),cursor,gapStart-cursor);
+        MoveChars(gapEnd-(gapStart-cursor),cursor,gapStart-cursor);
         gapEnd -= gapStart - cursor;
         gapStart = cursor;
     }else{
-        memcpy(gapStart,gapEnd,cursor-gapEnd);
+        MoveChars(gapStart,gapEnd,cursor-gapEnd);
         gapStart += cursor - gapEnd;
         gapEnd = cursor;
         cursor = gapStart;
@@ -147,7 +251,8 @@ void GapBuffer::GapUpdate() {
  * Set cursor at offset position.
  * We need to put gap into our consideration.
  */
-void GapBuffer::SetCursor(unsigned int offset) {
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::SetCursor(unsigned int offset) {
 
     cursor = text + offset;
 
@@ -164,7 +269,8 @@ void GapBuffer::SetCursor(unsigned int offset) {
  * If point is inside the gap, the return the
  * first character outside the gap.
  */
-char GapBuffer::GetChar() {
+template<class CharT, class Growth, class Alloc>
+CharT BasicGapBuffer<CharT,Growth,Alloc>::GetChar() {
 
     if(cursor == gapStart)
         cursor = gapEnd;
@@ -176,7 +282,8 @@ char GapBuffer::GetChar() {
 * Replace the character before cursor.
 * Does not move the gap.
 */
-void GapBuffer::ReplaceChar(const char ch) {
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::ReplaceChar(const CharT ch) {
 
     if(cursor == text)
         return;
@@ -185,38 +292,54 @@ void GapBuffer::ReplaceChar(const char ch) {
         cursor = gapStart;
 
     *(cursor-1) = ch;
+
+    unsigned int offset = CursorOffset() - 1;
+    Touch(offset,size() - offset - 1);
+    Record(offset,1,1);
 }
 
 /*
 * Insert a character at cursor position.
 */
-void GapBuffer::InsertChar(const char ch) {
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::InsertChar(const CharT ch) {
 
     if(gap_size() < 1)
         ExpandBuffer();
 
     GapUpdate();
+    GB_STAT(CountEdit());
+    TouchGap();
     *(cursor++) = ch;
     ++gapStart;
+    Record(gapStart - text - 1,0,1);
 }
 
 /*
 * Delete a character at cursor position.
 */
-void GapBuffer::DeleteChar() {
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::DeleteChar() {
 
     //Set cursor at GapStart
-    if(cursor < gapStart || cursor == gapEnd)
+    if(cursor != gapStart)
         GapUpdate();
 
+    if(cursor == text)
+        return;
+
+    GB_STAT(CountEdit());
     --cursor;
     --gapStart;
+    TouchGap();
+    Record(gapStart - text,1,0);
 }
 
 /*
  * Return offset of cursor.
  */
-unsigned int GapBuffer::CursorOffset() {
+template<class CharT, class Growth, class Alloc>
+unsigned int BasicGapBuffer<CharT,Growth,Alloc>::CursorOffset() {
 
     if(cursor > gapStart)
         return cursor - (gapEnd - gapStart) - text;
@@ -227,42 +350,172 @@ unsigned int GapBuffer::CursorOffset() {
 /*
  * Delete a string(length = dsize) from cursor.
  */
-void GapBuffer::DeleteString(unsigned int dsize) {
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::DeleteString(unsigned int dsize) {
 
     if(cursor != gapStart)
         GapUpdate();
 
     if(dsize > (cursor - text))
-        throw std::runtime_error::runtime_error("There is no enough long string to delete");
+        throw std::runtime_error("There is no enough long string to delete");
 
+    GB_STAT(CountEdit());
     gapStart -= dsize;
     cursor -= dsize;
+    TouchGap();
+    Record(gapStart - text,dsize,0);
 }
 
 
 /*
  * Insert a string( s ) from cursor.
  */
-void GapBuffer::InsertString(std::string s) {
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::InsertString(const string_type &s) {
+    InsertString(s.data(),s.size());
+}
+
+/*
+ * Insert len characters from cursor, each character is copied once.
+ */
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::InsertString(const CharT *s, unsigned int len) {
+
+    ReserveGap(len);
+
+    GB_STAT(CountEdit());
+    TouchGap();
+    CopyChars(cursor,s,len);
+
+    cursor += len;
+    gapStart += len;
+    Record(gapStart - text - len,0,len);
+}
+
+/*
+ * Grow the gap once to hold n characters and put it at the cursor.
+ */
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::ReserveGap(unsigned int n) {
+
+    if(gap_size() < n)
+        ExpandBuffer(n);
 
     if(cursor != gapStart)
         GapUpdate();
+}
 
-    while(gap_size() < s.size()){
-        ExpandBuffer();
+/*
+ * Read a stream chunk by chunk straight into the gap. Bytes of a
+ * character which isn't complete yet wait at the start of the gap, so
+ * the gap is never empty while there are any.
+ */
+template<class CharT, class Growth, class Alloc>
+unsigned int BasicGapBuffer<CharT,Growth,Alloc>::InsertFromStream(std::istream &in, unsigned int sizeHint) {
+
+    unsigned int inserted = 0, pending = 0;
+
+    ReserveGap(sizeHint ? sizeHint : STREAM_CHUNK_SIZE);
+    GB_STAT(CountEdit());
+    TouchGap();
+    unsigned int offset = gapStart - text;
+
+    while(in){
+        /* Don't grow the buffer just to find the end of the stream. */
+        if(gap_size() == 0){
+            if(in.peek() == std::char_traits<char>::eof())
+                break;
+            ReserveGap(STREAM_CHUNK_SIZE);
+        }
+
+        in.read(reinterpret_cast<char *>(gapStart) + pending,(std::streamsize)gap_size() * sizeof(CharT) - pending);
+        unsigned long long bytes = pending + in.gcount();
+        unsigned int n = bytes / sizeof(CharT);
+        pending = bytes % sizeof(CharT);
+
+        cursor += n;
+        gapStart += n;
+        inserted += n;
     }
+    Record(offset,0,inserted);
+    return inserted;
+}
+
+/*
+ * Size the gap from the file size and read the file straight into it.
+ */
+template<class CharT, class Growth, class Alloc>
+unsigned int BasicGapBuffer<CharT,Growth,Alloc>::InsertFromFile(const char *filename) {
 
-    /* We can not use memcpy here. */
-    s.copy(cursor,s.size());
+    std::ifstream in(filename,std::ios::binary | std::ios::ate);
+
+    if(!in.is_open())
+        throw std::runtime_error("Can't open this text file.");
 
-    cursor += s.size();
-    gapStart += s.size();
+    unsigned long long fileSize = (unsigned long long)in.tellg() / sizeof(CharT);
+    if(fileSize > UINT_MAX)
+        throw std::runtime_error("There is no enough space.");
+
+    in.seekg(0,std::ios::beg);
+    return InsertFromStream(in,fileSize);
+}
+
+#ifndef _WIN32
+/*
+ * Read a file descriptor chunk by chunk straight into the gap.
+ * Regular files tell us their size, so the gap is sized once. Bytes of
+ * an incomplete character wait at the start of the gap as in InsertFromStream().
+ */
+template<class CharT, class Growth, class Alloc>
+unsigned int BasicGapBuffer<CharT,Growth,Alloc>::InsertFromFd(int fd) {
+
+    unsigned int inserted = 0, pending = 0;
+    unsigned long long expected = 0;
+    struct stat st;
+
+    if(fstat(fd,&st) == 0 && S_ISREG(st.st_mode)){
+        off_t left = (st.st_size - lseek(fd,0,SEEK_CUR)) / (off_t)sizeof(CharT);
+        if(left > 0 && (unsigned long long)left <= UINT_MAX){
+            expected = left;
+            ReserveGap(left);
+        }
+    }
+    GB_STAT(CountEdit());
+    unsigned int offset = CursorOffset();
+
+    while(!expected || inserted < expected){
+        if(gap_size() == 0)
+            ReserveGap(STREAM_CHUNK_SIZE);
+        else if(cursor != gapStart)
+            GapUpdate();
+        TouchGap();
+
+        ssize_t got = read(fd,reinterpret_cast<char *>(gapStart) + pending,(size_t)gap_size() * sizeof(CharT) - pending);
+        if(got < 0 && errno == EINTR)
+            continue;
+        if(got < 0)
+            throw std::runtime_error("Can't read from this file descriptor.");
+        if(got == 0)
+            break;
+
+        unsigned long long bytes = pending + got;
+        unsigned int n = bytes / sizeof(CharT);
+        pending = bytes % sizeof(CharT);
+
+        cursor += n;
+        gapStart += n;
+        inserted += n;
+    }
+    Record(offset,0,inserted);
+    return inserted;
 }
+#endif
 
 /*
  * Move Cursor forward one character.
  */
-void GapBuffer::CursorForward() {
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::CursorForward() {
 
     /* If cursor is the tail of buffer */
     if(cursor == textEnd)
@@ -274,9 +527,9 @@ void GapBuffer::CursorForward() {
         return;
 
     /* If cursor at the end of left part of text,
-     * moving cursor would put it into right part.*/
+     * moving cursor would put it behind the first character of right part.*/
     if(cursor == gapStart)
-        cursor = gapEnd;
+        cursor = gapEnd + 1;
     else
         cursor += 1;
 }
@@ -285,7 +538,8 @@ void GapBuffer::CursorForward() {
 /*
  * Move Cursor backward one character.
  */
-void GapBuffer::CursorBackward() {
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::CursorBackward() {
 
     /* If cursor is at the begin of text.*/
     if(cursor == text)
@@ -303,18 +557,68 @@ void GapBuffer::CursorBackward() {
     --cursor;
 }
 
+/*
+ * Copy len characters from offset, skipping the gap.
+ */
+template<class CharT, class Growth, class Alloc>
+typename BasicGapBuffer<CharT,Growth,Alloc>::string_type BasicGapBuffer<CharT,Growth,Alloc>::GetString(unsigned int offset, unsigned int len) {
+
+    string_type s;
+    unsigned int textSize = size();
+
+    if(offset >= textSize)
+        return s;
+    if(len > textSize - offset)
+        len = textSize - offset;
+
+    s.resize(len);
+    GetString(offset,len,&s[0]);
+    return s;
+}
+
+/*
+ * Copy len characters from offset into out, skipping the gap.
+ */
+template<class CharT, class Growth, class Alloc>
+unsigned int BasicGapBuffer<CharT,Growth,Alloc>::GetString(unsigned int offset, unsigned int len, CharT *out) {
+
+    unsigned int textSize = size();
+
+    if(offset >= textSize)
+        return 0;
+    if(len > textSize - offset)
+        len = textSize - offset;
+
+    unsigned int leftSize = gapStart - text;
+    unsigned int copied = 0;
+
+    /* The part in front of the gap. */
+    if(offset < leftSize){
+        unsigned int n = len < leftSize - offset ? len : leftSize - offset;
+        CopyChars(out,text + offset,n);
+        copied = n;
+    }
+
+    /* The part behind the gap. */
+    if(copied < len)
+        CopyChars(out + copied,gapEnd + (offset + copied - leftSize),len - copied);
+
+    return len;
+}
+
 /*
  * Save text in the buffer to file.
  */
-int GapBuffer::SaveBufferToFile(const char *filename) {
+template<class CharT, class Growth, class Alloc>
+int BasicGapBuffer<CharT,Growth,Alloc>::SaveBufferToFile(const char *filename) {
 
-    std::ofstream out(filename);
+    std::ofstream out(filename,sizeof(CharT) > 1 ? std::ios::out | std::ios::binary : std::ios::out);
 
     if(!out)
         return 1;
 
-    out.write(text,gapStart-text);
-    out.write(gapEnd,textEnd-gapEnd);
+    out.write(reinterpret_cast<const char *>(text),(gapStart-text) * sizeof(CharT));
+    out.write(reinterpret_cast<const char *>(gapEnd),(textEnd-gapEnd) * sizeof(CharT));
     out.close();
     return 0;
 }
@@ -323,7 +627,8 @@ int GapBuffer::SaveBufferToFile(const char *filename) {
  * Output text in left part and right part.
  * Used for Debug
  */
-void GapBuffer::Debug() {
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::Debug() {
     static int count = 0;
     ++count;
     GapUpdate();
@@ -332,16 +637,19 @@ void GapBuffer::Debug() {
     std::cout << "gapStart = " << (gapStart - text) << std::endl;
     std::cout << "gapEnd = " << (gapEnd - text) << std::endl;
     std::cout << "The left part is: " << std::endl;
-    std::cout.write(text,cursor-text) << std::endl;
+    WriteChars(std::cout,text,cursor-text);
+    std::cout << std::endl;
     std::cout << "The right part is: " << std::endl;
-    std::cout.write(gapEnd,textEnd-gapEnd) << std::endl << std::endl;
+    WriteChars(std::cout,gapEnd,textEnd-gapEnd);
+    std::cout << std::endl << std::endl;
 }
 
 /*
  * Move cursor forward i steps
  * @param i steps number
  */
-void GapBuffer::CursorForwardByStep(unsigned i) {
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::CursorForwardByStep(unsigned i) {
     if(cursor < gapStart){
         if(cursor + i > gapStart)
             cursor += gapEnd - gapStart + i;
@@ -358,7 +666,8 @@ void GapBuffer::CursorForwardByStep(unsigned i) {
  * Move cursor backward i steps
  * @param i steps number
  */
-void GapBuffer::CursorBackwardByStep(unsigned i) {
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::CursorBackwardByStep(unsigned i) {
     if(cursor <= gapStart)
         cursor -= i;
     else if(cursor == gapEnd)
@@ -371,4 +680,155 @@ void GapBuffer::CursorBackwardByStep(unsigned i) {
     }
 }
 
+/*
+ * An edit which touches the last delta (overlaps it or is next to it,
+ * in the text the last delta left) is merged into it.
+ */
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::Record(unsigned int offset, unsigned int removed, unsigned int inserted) {
+
+    if(removed || inserted){
+        std::vector<TextDelta> &deltas = change.deltas;
+        TextDelta *last = deltas.empty() ? nullptr : &deltas.back();
+        if(last && offset <= last->offset + last->inserted && offset + removed >= last->offset){
+            unsigned int start = std::min(offset,last->offset);
+            unsigned int end = std::max(offset + removed,last->offset + last->inserted);
+            last->removed = end - start - last->inserted + last->removed;
+            last->inserted = end - start - removed + inserted;
+            last->offset = start;
+        }else{
+            TextDelta d = {offset,removed,inserted};
+            deltas.push_back(d);
+        }
+    }
+    if(!transactionDepth)
+        Notify();
+}
+
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::Notify() {
+
+    if(change.deltas.empty())
+        return;
+
+    change.version = ++version;
+    for(size_t i = 0;i < subscribers.size();++i)
+        subscribers[i].second(change);
+    change.deltas.clear();
+}
+
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::CommitTransaction() {
+
+    if(transactionDepth && --transactionDepth == 0)
+        Notify();
+}
+
+template<class CharT, class Growth, class Alloc>
+int BasicGapBuffer<CharT,Growth,Alloc>::Subscribe(const Subscriber &f) {
+
+    subscribers.push_back(std::make_pair(nextSubscriber,f));
+    return nextSubscriber++;
+}
+
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::Unsubscribe(int id) {
+
+    for(size_t i = 0;i < subscribers.size();++i){
+        if(subscribers[i].first == id){
+            subscribers.erase(subscribers.begin() + i);
+            return;
+        }
+    }
+}
+
+#if GAPBUFFER_STATS_ENABLED
+/*
+ * Count an edit, the histogram is indexed by the bit length of the gap size.
+ * Peaks are taken before the edit, GetStats() folds in the current values.
+ */
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::CountEdit() {
+
+    unsigned int g = gap_size();
+    int bucket = 0;
+    while(g){
+        ++bucket;
+        g >>= 1;
+    }
+    ++stats.gapHistogram[bucket];
+    ++stats.edits;
+
+    unsigned int textSize = size();
+    if(textSize > stats.peakSize)
+        stats.peakSize = textSize;
+}
+#endif
+
+/*
+ * Return the hot path counters.
+ */
+template<class CharT, class Growth, class Alloc>
+GapBufferStats BasicGapBuffer<CharT,Growth,Alloc>::GetStats() {
+
+#if GAPBUFFER_STATS_ENABLED
+    GapBufferStats s = stats;
+    s.size = size();
+    if(s.size > s.peakSize)
+        s.peakSize = s.size;
+    return s;
+#else
+    GapBufferStats s;
+    memset(&s,0,sizeof(s));
+    s.enabled = false;
+    s.size = size();
+    s.capacity = GAP_BUFFER_SIZE;
+    return s;
+#endif
+}
+
+/*
+ * Reset the counters, peaks restart from the current values.
+ */
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::ResetStats() {
+
+#if GAPBUFFER_STATS_ENABLED
+    memset(&stats,0,sizeof(stats));
+    stats.enabled = true;
+    stats.capacity = stats.peakCapacity = GAP_BUFFER_SIZE;
+    stats.peakSize = size();
+#endif
+}
+
+/*
+ * Print the counters in a human readable form.
+ */
+template<class CharT, class Growth, class Alloc>
+void BasicGapBuffer<CharT,Growth,Alloc>::DumpStats(std::ostream &os) {
+
+    GapBufferStats s = GetStats();
+
+    if(!s.enabled){
+        os << "GapBuffer stats are compiled out (build with -DGAPBUFFER_STATS=ON)." << std::endl;
+        return;
+    }
+
+    os << "GapBuffer stats:" << std::endl;
+    os << "  size = " << s.size << " (peak " << s.peakSize << "), capacity = " << s.capacity
+       << " (peak " << s.peakCapacity << ")" << std::endl;
+    os << "  edits = " << s.edits << std::endl;
+    os << "  gap updates = " << s.gapUpdates << ", bytes moved = " << s.bytesMoved << std::endl;
+    os << "  expands = " << s.expands << ", bytes copied = " << s.bytesCopied << std::endl;
+    os << "  gap size histogram:" << std::endl;
+    for(int i = 0;i < GAP_HISTOGRAM_BUCKETS;++i){
+        if(!s.gapHistogram[i])
+            continue;
+        unsigned long long lo = i ? 1ULL << (i - 1) : 0, hi = 1ULL << i;
+        os << "    [" << lo << ", " << hi << ") " << s.gapHistogram[i] << std::endl;
+    }
+}
 
+template class BasicGapBuffer<char>;
+template class BasicGapBuffer<char16_t>;
+template class BasicGapBuffer<char32_t>;
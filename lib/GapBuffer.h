@@ -9,26 +9,179 @@
  *  👆->text            👆->textEnd
  *  '['->gapStart
  *  ']'->gapEnd
+ *
+ *  BasicGapBuffer is a template over the character type (char, char16_t,
+ *  char32_t), the growth policy and the allocator, so that every kind of
+ *  buffer runs the same code with the character size known at compile
+ *  time and no virtual calls. Files and streams are read and written as
+ *  raw characters in the native byte order. GapBuffer is the char buffer
+ *  with the default policies. The members are defined in GapBuffer.cpp,
+ *  which instantiates the buffers in use; a buffer with other parameters
+ *  is added to the list at its end.
+ *
+ *  Every edit is reported to subscribers as a TextChange. Edits made
+ *  between BeginTransaction() and CommitTransaction() are reported once,
+ *  as one list of deltas, when the outermost transaction commits; an edit
+ *  outside a transaction is reported on its own. Deltas which touch are
+ *  merged, so typing a word is one delta.
  */
 
 
 #ifndef GAPBUFFER_LIBRARY_H
 #define GAPBUFFER_LIBRARY_H
 
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * Hot path counters, see GapBuffer::GetStats().
+ * They are kept in debug builds and compiled out of optimized (NDEBUG)
+ * builds, unless GAPBUFFER_STATS is defined (cmake -DGAPBUFFER_STATS=ON).
+ */
+#if defined(GAPBUFFER_STATS) || !defined(NDEBUG)
+#define GAPBUFFER_STATS_ENABLED 1
+#define GB_STAT(x) do{ x; }while(0)
+#else
+#define GAPBUFFER_STATS_ENABLED 0
+#define GB_STAT(x) do{}while(0)
+#endif
 
-class GapBuffer{
+/* Bucket i counts edits made while the gap held [2^(i-1), 2^i) characters. */
+static const int GAP_HISTOGRAM_BUCKETS = 33;
+
+struct GapBufferStats{
+    bool enabled;                       //false if the counters are compiled out
+    unsigned long long gapUpdates;      //GapUpdate calls which moved the gap
+    unsigned long long bytesMoved;      //bytes moved by those calls
+    unsigned long long expands;         //ExpandBuffer calls
+    unsigned long long bytesCopied;     //bytes copied by those calls
+    unsigned long long edits;           //inserts and deletes
+    unsigned int capacity;              //current size of the whole buffer
+    unsigned int peakCapacity;
+    unsigned int size;                  //current size of text
+    unsigned int peakSize;
+    unsigned long long gapHistogram[GAP_HISTOGRAM_BUCKETS];
+};
+
+/* Characters removed at offset were replaced by inserted ones. */
+struct TextDelta{
+    unsigned int offset;
+    unsigned int removed;
+    unsigned int inserted;
+};
+
+/*
+ * What one transaction did to the text. Each delta applies to the text
+ * as the ones before it left it.
+ */
+struct TextChange{
+    unsigned long version;              //of the text after the change
+    std::vector<TextDelta> deltas;
+};
+
+/*
+ * The default growth policy: the size of the buffer doubles until the
+ * text fits, so n inserts cost O(n) copies.
+ */
+struct DoublingGrowth{
+    /*
+     * Return the new size of a buffer of capacity characters which must hold need.
+     */
+    static unsigned long long Grow(unsigned long long capacity, unsigned long long need){
+        while(capacity < need)
+            capacity *= 2;
+        return capacity;
+    }
+};
+
+/*
+ * Grow by STEP characters at a time, for buffers which stay small or
+ * live in memory which doesn't like large jumps (arenas, scratch space).
+ */
+template<unsigned int STEP>
+struct StepGrowth{
+    static unsigned long long Grow(unsigned long long capacity, unsigned long long need){
+        return capacity < need ? (need + STEP - 1) / STEP * STEP : capacity;
+    }
+};
+
+template<class CharT, class Growth = DoublingGrowth, class Alloc = std::allocator<CharT> >
+class BasicGapBuffer{
 public:
+    typedef CharT char_type;
+    typedef std::basic_string<CharT> string_type;
 
 private:
-    char * cursor;
-    char * text;
-    char * textEnd;
-    char * gapStart;
-    char * gapEnd;
+#if GAPBUFFER_STATS_ENABLED
+    GapBufferStats stats;
+
+    /*
+     * Count an edit made while the gap has its current size.
+     */
+    void CountEdit();
+#endif
+
+    CharT * cursor;
+    CharT * text;
+    CharT * textEnd;
+    CharT * gapStart;
+    CharT * gapEnd;
 
     unsigned int GAP_BUFFER_SIZE;
+    Alloc alloc;
+
+    /* Characters at the start and at the end no edit touched since MarkUnchanged(). */
+    unsigned int unchangedHead;
+    unsigned int unchangedTail;
+
+    /*
+     * Note an edit: the text from offset from on may have changed, the
+     * last after characters haven't.
+     */
+    inline void Touch(unsigned int from, unsigned int after){
+        if(from < unchangedHead)
+            unchangedHead = from;
+        if(after < unchangedTail)
+            unchangedTail = after;
+    }
+
+    /*
+     * Note an edit at the gap.
+     */
+    inline void TouchGap(){
+        Touch(gapStart - text,textEnd - gapEnd);
+    }
+
+    typedef std::function<void(const TextChange &)> Subscriber;
+
+    unsigned long version;
+    unsigned int transactionDepth;
+    TextChange change;                  //deltas not reported yet
+    std::vector<std::pair<int,Subscriber> > subscribers;
+    int nextSubscriber;
+
+    /*
+     * Note an edit for the change report, it is reported right away
+     * unless a transaction is open.
+     */
+    void Record(unsigned int offset, unsigned int removed, unsigned int inserted);
+
+    /*
+     * Report the deltas noted so far to the subscribers.
+     */
+    void Notify();
+
+    CharT * Allocate(unsigned int n){
+        return std::allocator_traits<Alloc>::allocate(alloc,n);
+    }
+
+    void Free(CharT * p, unsigned int n){
+        std::allocator_traits<Alloc>::deallocate(alloc,p,n);
+    }
 
     /*
      * Initialize the gap buffer with size.
@@ -37,38 +190,58 @@ private:
     void InitBuffer(unsigned int size);
 
     /*
-     * Expand the size of buffer when the space of buffer is not enough
-     * Usually we expand the size of buffer by factor 2.
+     * Expand the size of buffer when the space of buffer is not enough,
+     * by the growth policy (factor 2 by default).
      */
     void ExpandBuffer(void);
 
+    /*
+     * Expand the buffer once so that the gap holds at least minGap characters.
+     * The size grows by the growth policy, but the text is copied only once.
+     * @param minGap The number of characters the gap must hold.
+     */
+    void ExpandBuffer(unsigned int minGap);
+
     /* There is no need for Copy construction. */
-    GapBuffer(const GapBuffer& gb);
+    BasicGapBuffer(const BasicGapBuffer& gb);
 
 public:
     static const int DEFAULT_GAP_BUFFER_SIZE = 20;
 
     /* Constructor with default gap size.
      * @param gsize The size of buffer.
+     * @param a The allocator of the buffer memory.
      */
-    GapBuffer(int gsize = DEFAULT_GAP_BUFFER_SIZE);
+    BasicGapBuffer(int gsize = DEFAULT_GAP_BUFFER_SIZE, const Alloc &a = Alloc());
 
     /* Constructor with instantiating with an existing file.
      * @param filename The name of text file.
+     * @param a The allocator of the buffer memory.
      */
-    GapBuffer(const char * filename);
+    BasicGapBuffer(const char * filename, const Alloc &a = Alloc());
 
-    ~GapBuffer();
+    ~BasicGapBuffer();
 
     /*
      * Return the size of real text(buffer size minus gap size).
      */
-    inline unsigned int size();
+    inline unsigned int size(){
+        return (textEnd - text) - (gapEnd - gapStart);
+    }
 
     /*
      * Return the size of gap.
      */
-    inline unsigned int gap_size();
+    inline unsigned int gap_size(){
+        return gapEnd - gapStart;
+    }
+
+    /*
+     * Return the size of the whole buffer, text plus gap.
+     */
+    inline unsigned int capacity(){
+        return textEnd - text;
+    }
 
     /*
      * Move the gap to the current position of the cursor.
@@ -93,31 +266,82 @@ public:
      * If point is inside the gap, then return the
      * first character outside the gap.
      */
-    char GetChar();
+    CharT GetChar();
 
     /*
      * Replace the character of cursor.
      * Does not move the gap.
      * @param ch The character you want to use to replace.
      */
-    void ReplaceChar(const char ch);
+    void ReplaceChar(const CharT ch);
 
     /*
      * Insert a character at cursor position.
      * @param ch The character you want to insert.
      */
-    void InsertChar(const char ch);
+    void InsertChar(const CharT ch);
 
     /*
      * Delete a character at cursor position.
      */
     void DeleteChar();
 
+    /*
+     * Give back the memory of a large gap: the buffer is reallocated to
+     * hold the text plus a gap of gap characters at the cursor.
+     * Does nothing if the gap is not larger than that already.
+     * @param gap The number of characters the gap keeps.
+     */
+    void ShrinkToFit(unsigned int gap = DEFAULT_GAP_BUFFER_SIZE);
+
     /*
      * Insert a string at cursor position.
      * @param s The string you want to insert.
      */
-    void InsertString(std::string s);
+    void InsertString(const string_type &s);
+
+    /*
+     * Insert len characters at cursor position, copied straight into the gap.
+     * @param s The characters you want to insert.
+     * @param len The number of characters.
+     */
+    void InsertString(const CharT * s, unsigned int len);
+
+    /*
+     * Make sure the gap holds at least n characters, so that the following
+     * inserts of up to n characters don't reallocate.
+     * Also moves the gap to the cursor.
+     * @param n The number of characters.
+     */
+    void ReserveGap(unsigned int n);
+
+    /*
+     * Insert everything left in a stream at cursor position.
+     * The data is read in chunks straight into the gap, a last incomplete
+     * character is dropped.
+     * @param in The stream to read.
+     * @param sizeHint The expected number of characters, 0 if unknown.
+     * @return The number of characters inserted.
+     */
+    unsigned int InsertFromStream(std::istream &in, unsigned int sizeHint = 0);
+
+    /*
+     * Insert the content of a file at cursor position.
+     * The gap is sized once from the file size.
+     * @param filename The name of text file.
+     * @return The number of characters inserted.
+     */
+    unsigned int InsertFromFile(const char * filename);
+
+#ifndef _WIN32
+    /*
+     * Insert everything readable from a file descriptor (pipe, socket, file)
+     * at cursor position, read in chunks straight into the gap.
+     * @param fd The file descriptor, it is not closed.
+     * @return The number of characters inserted.
+     */
+    unsigned int InsertFromFd(int fd);
+#endif
 
     /*
      * Delete the string following the cursor.
@@ -129,6 +353,24 @@ public:
      */
     void DeleteString(unsigned int dsize);
 
+    /*
+     * Copy a part of the text out of the buffer, the gap is skipped.
+     * Does not move the gap.
+     * @param offset The offset of the first character.
+     * @param len The number of characters, clipped at the end of text.
+     */
+    string_type GetString(unsigned int offset, unsigned int len);
+
+    /*
+     * Copy a part of the text into out, the gap is skipped.
+     * Does not move the gap.
+     * @param offset The offset of the first character.
+     * @param len The number of characters, clipped at the end of text.
+     * @param out Where to copy, must hold len characters.
+     * @return The number of characters copied.
+     */
+    unsigned int GetString(unsigned int offset, unsigned int len, CharT * out);
+
     /*
      * Save text content into file.
      * @param filename The name of text file.
@@ -157,13 +399,110 @@ public:
      */
     void CursorBackwardByStep(unsigned i);
 
+    /*
+     * Take the text as it is now as unchanged, e.g. after it was saved.
+     */
+    void MarkUnchanged(){
+        unchangedHead = unchangedTail = size();
+    }
+
+    /*
+     * Return the number of characters at the start of text no edit
+     * touched since MarkUnchanged(). A new buffer counts as all changed.
+     */
+    unsigned int UnchangedHead() const{ return unchangedHead; }
+
+    /*
+     * Return the number of characters at the end of text no edit touched
+     * since MarkUnchanged().
+     */
+    unsigned int UnchangedTail() const{ return unchangedTail; }
+
+    /*
+     * Start a transaction, the edits until the matching CommitTransaction()
+     * are reported as one change. Transactions nest.
+     */
+    void BeginTransaction(){
+        ++transactionDepth;
+    }
+
+    /*
+     * End a transaction, the outermost one reports what changed.
+     */
+    void CommitTransaction();
+
+    /*
+     * Return the version of the text, one more for every change reported.
+     */
+    unsigned long Version() const{ return version; }
+
+    /*
+     * Call a function with every change of the text, after it is made.
+     * It must not edit the buffer or throw.
+     * @param f The function.
+     * @return An id for Unsubscribe().
+     */
+    int Subscribe(const Subscriber &f);
+
+    /*
+     * Stop calling a function.
+     * @param id What Subscribe() returned.
+     */
+    void Unsubscribe(int id);
+
+    /*
+     * A transaction for the lifetime of a scope.
+     */
+    class Transaction{
+    private:
+        BasicGapBuffer &gb;
+
+        /* There is no need for copy construction. */
+        Transaction(const Transaction &);
+
+    public:
+        explicit Transaction(BasicGapBuffer &b):gb(b){
+            gb.BeginTransaction();
+        }
+
+        ~Transaction(){
+            gb.CommitTransaction();
+        }
+    };
+
     /*
      * Output text in left part and right part.
      */
     void Debug();
 
+    /*
+     * Return the hot path counters, all zero (and enabled == false)
+     * if they are compiled out.
+     */
+    GapBufferStats GetStats();
+
+    /*
+     * Reset the counters, peaks restart from the current values.
+     */
+    void ResetStats();
+
+    /*
+     * Print the counters in a human readable form.
+     * @param os The output stream to write to.
+     */
+    void DumpStats(std::ostream &os);
+
     void expand(){
         ExpandBuffer();
     }
 };
+
+/* The buffers GapBuffer.cpp instantiates. */
+extern template class BasicGapBuffer<char>;
+extern template class BasicGapBuffer<char16_t>;
+extern template class BasicGapBuffer<char32_t>;
+
+typedef BasicGapBuffer<char> GapBuffer;
+typedef BasicGapBuffer<char16_t> GapBuffer16;
+typedef BasicGapBuffer<char32_t> GapBuffer32;
 #endif
\ No newline at end of file
@@ -0,0 +1,231 @@
+#include "GlyphAtlas.h"
+#include "FrameProfiler.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+GlyphAtlas::GlyphAtlas(SDL_Renderer *ren, TTF_Font *f, FrameProfiler *p):renderer(ren),font(f),profiler(p),
+                                                                      shelfX(0),shelfY(0),shelfHeight(0) {
+    AddPage();
+}
+
+GlyphAtlas::~GlyphAtlas() {
+    for(size_t i = 0;i < pages.size();++i)
+        SDL_DestroyTexture(pages[i]);
+}
+
+/*
+ * Start a new page, cleared to transparent with the white block in the corner.
+ */
+void GlyphAtlas::AddPage() {
+
+    SDL_Texture *page = SDL_CreateTexture(renderer,SDL_PIXELFORMAT_ARGB8888,SDL_TEXTUREACCESS_STATIC,
+                                          PAGE_SIZE,PAGE_SIZE);
+    if(page == nullptr)
+        throw std::runtime_error(std::string("Can not create atlas page: ") + SDL_GetError());
+    SDL_SetTextureBlendMode(page,SDL_BLENDMODE_BLEND);
+
+    std::vector<Uint32> pixels(PAGE_SIZE * PAGE_SIZE,0);
+    std::fill(pixels.begin(),pixels.begin() + WHITE_SIZE,0xFFFFFFFF);
+    for(int y = 1;y < WHITE_SIZE;++y)
+        std::copy(pixels.begin(),pixels.begin() + WHITE_SIZE,pixels.begin() + y * PAGE_SIZE);
+    SDL_UpdateTexture(page,nullptr,&pixels[0],PAGE_SIZE * sizeof(Uint32));
+    if(profiler)
+        profiler->Count(FRAMECOUNTER::TEXTUREUPLOAD);
+
+    pages.push_back(page);
+    shelfX = WHITE_SIZE + 1;
+    shelfY = 0;
+    shelfHeight = WHITE_SIZE;
+}
+
+/*
+ * Render a glyph and pack it into the newest page, opening a new one when full.
+ */
+bool GlyphAtlas::Load(Uint32 ch, AtlasGlyph &g) {
+
+    SDL_Color white = { 255, 255, 255, 255 };
+    SDL_Surface *rendered = TTF_RenderGlyph_Blended(font,ch,white);
+    if(rendered == nullptr)
+        return false;
+
+    SDL_Surface *surf = rendered;
+    if(rendered->format->format != SDL_PIXELFORMAT_ARGB8888){
+        surf = SDL_ConvertSurfaceFormat(rendered,SDL_PIXELFORMAT_ARGB8888,0);
+        SDL_FreeSurface(rendered);
+        if(surf == nullptr)
+            return false;
+    }
+
+    if(surf->w > PAGE_SIZE || surf->h > PAGE_SIZE){
+        SDL_FreeSurface(surf);
+        return false;
+    }
+
+    if(shelfX + surf->w > PAGE_SIZE){
+        shelfX = 0;
+        shelfY += shelfHeight + 1;
+        shelfHeight = 0;
+    }
+    if(shelfY + surf->h > PAGE_SIZE)
+        AddPage();
+
+    g.page = pages.size() - 1;
+    g.src.x = shelfX;
+    g.src.y = shelfY;
+    g.src.w = surf->w;
+    g.src.h = surf->h;
+
+    SDL_UpdateTexture(pages.back(),&g.src,surf->pixels,surf->pitch);
+    if(profiler)
+        profiler->Count(FRAMECOUNTER::TEXTUREUPLOAD);
+
+    /* One pixel apart, so filtering never picks up a neighbour. */
+    shelfX += surf->w + 1;
+    shelfHeight = std::max(shelfHeight,surf->h);
+    SDL_FreeSurface(surf);
+    return true;
+}
+
+/*
+ * Return a glyph, rendering it on a miss.
+ * A glyph the font can't render is kept with an empty rectangle.
+ */
+const AtlasGlyph & GlyphAtlas::Get(Uint32 ch) {
+
+    std::unordered_map<Uint32,AtlasGlyph>::iterator it = glyphs.find(ch);
+    if(it != glyphs.end())
+        return it->second;
+
+    if(profiler)
+        profiler->Count(FRAMECOUNTER::GLYPHCACHEMISS);
+
+    AtlasGlyph g;
+    g.page = 0;
+    g.src.x = g.src.y = g.src.w = g.src.h = 0;
+    g.advance = 0;
+    if(!Load(ch,g))
+        g.src.w = g.src.h = 0;
+
+    int minx,maxx,miny,maxy,advance;
+    if(TTF_GlyphMetrics(font,ch,&minx,&maxx,&miny,&maxy,&advance) == 0)
+        g.advance = advance;
+    else
+        g.advance = g.src.w;
+
+    return glyphs.insert(std::make_pair(ch,g)).first->second;
+}
+
+/*
+ * Return the width of the first n characters of a row, rendering missing glyphs.
+ */
+int GlyphAtlas::Width(const std::string &text, size_t n) {
+
+    int w = 0;
+    for(size_t i = 0;i < n && i < text.size();++i)
+        w += Get((unsigned char)text[i]).advance;
+    return w;
+}
+
+/*
+ * The inner part of the white block, filtering at its edge would blend in transparency.
+ */
+SDL_Rect GlyphAtlas::White() const {
+    SDL_Rect r = { 1, 1, WHITE_SIZE - 2, WHITE_SIZE - 2 };
+    return r;
+}
+
+/*
+ * Return the height of a text row.
+ */
+int GlyphAtlas::LineHeight() const {
+    return TTF_FontHeight(font);
+}
+
+/*
+ * Add a textured quad, two triangles.
+ */
+void GlyphBatch::AddQuad(unsigned page, const SDL_Rect &src, const SDL_Rect &dst, SDL_Color color) {
+
+    if(batches.size() <= page)
+        batches.resize(page + 1);
+    PageBatch &b = batches[page];
+
+#ifdef GLYPHATLAS_GEOMETRY
+    const float w = GlyphAtlas::PAGE_SIZE, h = GlyphAtlas::PAGE_SIZE;
+
+    float u0 = src.x / w, v0 = src.y / h;
+    float u1 = (src.x + src.w) / w, v1 = (src.y + src.h) / h;
+    float x0 = dst.x, y0 = dst.y, x1 = dst.x + dst.w, y1 = dst.y + dst.h;
+
+    int first = b.vertices.size();
+    SDL_Vertex v;
+    v.color = color;
+    v.position.x = x0; v.position.y = y0; v.tex_coord.x = u0; v.tex_coord.y = v0; b.vertices.push_back(v);
+    v.position.x = x1; v.position.y = y0; v.tex_coord.x = u1; v.tex_coord.y = v0; b.vertices.push_back(v);
+    v.position.x = x1; v.position.y = y1; v.tex_coord.x = u1; v.tex_coord.y = v1; b.vertices.push_back(v);
+    v.position.x = x0; v.position.y = y1; v.tex_coord.x = u0; v.tex_coord.y = v1; b.vertices.push_back(v);
+
+    int quad[6] = { first, first + 1, first + 2, first, first + 2, first + 3 };
+    b.indices.insert(b.indices.end(),quad,quad + 6);
+#else
+    b.src.push_back(src);
+    b.dst.push_back(dst);
+    b.colors.push_back(color);
+#endif
+}
+
+/*
+ * Add a row of text, one byte per character.
+ */
+int GlyphBatch::AddText(const std::string &text, int x, int y, SDL_Color color) {
+
+    for(size_t i = 0;i < text.size();++i){
+        const AtlasGlyph &g = atlas.Get((unsigned char)text[i]);
+        if(g.src.w && g.src.h){
+            SDL_Rect dst = { x, y, g.src.w, g.src.h };
+            AddQuad(g.page,g.src,dst,color);
+        }
+        x += g.advance;
+    }
+    return x;
+}
+
+/*
+ * Add a solid rectangle, textured with the white block of page 0.
+ */
+void GlyphBatch::AddRect(const SDL_Rect &dst, SDL_Color color) {
+    AddQuad(0,atlas.White(),dst,color);
+}
+
+/*
+ * Draw every page batch and empty them.
+ */
+unsigned GlyphBatch::Flush(SDL_Renderer *renderer) {
+
+    unsigned calls = 0;
+
+    for(size_t page = 0;page < batches.size();++page){
+        PageBatch &b = batches[page];
+        SDL_Texture *tex = atlas.Page(page);
+#ifdef GLYPHATLAS_GEOMETRY
+        if(b.indices.empty())
+            continue;
+        SDL_RenderGeometry(renderer,tex,&b.vertices[0],b.vertices.size(),&b.indices[0],b.indices.size());
+        ++calls;
+        b.vertices.clear();
+        b.indices.clear();
+#else
+        for(size_t i = 0;i < b.src.size();++i){
+            SDL_SetTextureColorMod(tex,b.colors[i].r,b.colors[i].g,b.colors[i].b);
+            SDL_SetTextureAlphaMod(tex,b.colors[i].a);
+            SDL_RenderCopy(renderer,tex,&b.src[i],&b.dst[i]);
+            ++calls;
+        }
+        b.src.clear();
+        b.dst.clear();
+        b.colors.clear();
+#endif
+    }
+    return calls;
+}
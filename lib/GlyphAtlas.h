@@ -0,0 +1,163 @@
+/*
+ * Glyph atlas and batched text drawing.
+ *
+ * Glyphs are rendered once with TTF_RenderGlyph_Blended in white and packed
+ * into large atlas textures (pages). A frame is drawn by collecting one
+ * vertex/index array per page and submitting each with a single
+ * SDL_RenderGeometry call, the color comes from the vertices. Every page
+ * keeps a small white block, so solid quads (cursor, selection, search
+ * highlights) go through the same batch.
+ *
+ * SDL older than 2.0.18 has no SDL_RenderGeometry, then every quad falls
+ * back to its own color-modulated SDL_RenderCopy.
+ */
+
+#ifndef GLYPHATLAS_LIBRARY_H
+#define GLYPHATLAS_LIBRARY_H
+
+#include "SDL2/SDL.h"
+#include "SDL2/SDL_ttf.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if SDL_VERSION_ATLEAST(2,0,18)
+#define GLYPHATLAS_GEOMETRY 1
+#endif
+
+class FrameProfiler;
+
+/*
+ * Where a glyph lives in the atlas.
+ */
+struct AtlasGlyph{
+    unsigned page;
+    SDL_Rect src;       //in the page texture
+    int advance;        //pen movement after the glyph
+};
+
+class GlyphAtlas{
+public:
+    static const int PAGE_SIZE = 1024;
+
+private:
+    static const int WHITE_SIZE = 4;        //white block in the top left corner of every page
+
+    SDL_Renderer *renderer;
+    TTF_Font *font;
+    FrameProfiler *profiler;
+
+    std::vector<SDL_Texture *> pages;
+    std::unordered_map<Uint32,AtlasGlyph> glyphs;
+
+    /* Shelf packing in the newest page. */
+    int shelfX;
+    int shelfY;
+    int shelfHeight;
+
+    /*
+     * Start a new, transparent page.
+     */
+    void AddPage();
+
+    /*
+     * Render a glyph and pack it, return false if it has no pixels.
+     */
+    bool Load(Uint32 ch, AtlasGlyph &g);
+
+    /* There is no need for copy construction. */
+    GlyphAtlas(const GlyphAtlas &);
+
+public:
+    /*
+     * @param ren The renderer owning the page textures.
+     * @param f The font, owned by the caller and kept open while the atlas lives.
+     * @param p Counts glyph cache misses and texture uploads, may be null.
+     */
+    GlyphAtlas(SDL_Renderer *ren, TTF_Font *f, FrameProfiler *p = nullptr);
+    ~GlyphAtlas();
+
+    /*
+     * Return a glyph, rendering it on a miss.
+     * @param ch The character, Latin-1 like TTF_RenderText.
+     */
+    const AtlasGlyph & Get(Uint32 ch);
+
+    /*
+     * Return the width of the first n characters of a row.
+     */
+    int Width(const std::string &text, size_t n);
+
+    /*
+     * Return the source rectangle of the white block.
+     */
+    SDL_Rect White() const;
+
+    /*
+     * Return the texture of a page.
+     */
+    SDL_Texture * Page(unsigned i) const{ return pages[i]; }
+
+    /*
+     * Return the number of pages.
+     */
+    unsigned PageCount() const{ return pages.size(); }
+
+    /*
+     * Return the height of a text row.
+     */
+    int LineHeight() const;
+};
+
+/*
+ * The quads of one frame, grouped by atlas page.
+ */
+class GlyphBatch{
+private:
+    struct PageBatch{
+#ifdef GLYPHATLAS_GEOMETRY
+        std::vector<SDL_Vertex> vertices;
+        std::vector<int> indices;
+#else
+        std::vector<SDL_Rect> src;
+        std::vector<SDL_Rect> dst;
+        std::vector<SDL_Color> colors;
+#endif
+    };
+
+    GlyphAtlas &atlas;
+    std::vector<PageBatch> batches;
+
+    /*
+     * Add a textured quad.
+     */
+    void AddQuad(unsigned page, const SDL_Rect &src, const SDL_Rect &dst, SDL_Color color);
+
+    /* There is no need for copy construction. */
+    GlyphBatch(const GlyphBatch &);
+
+public:
+    explicit GlyphBatch(GlyphAtlas &a):atlas(a){}
+
+    /*
+     * Add a row of text, return the x coordinate after it.
+     * @param text The row, one byte per character.
+     * @param x The pen position.
+     * @param y The top of the row.
+     */
+    int AddText(const std::string &text, int x, int y, SDL_Color color);
+
+    /*
+     * Add a solid rectangle. Solid quads go to page 0 and are drawn in the
+     * order they were added, before the glyphs of later pages.
+     */
+    void AddRect(const SDL_Rect &dst, SDL_Color color);
+
+    /*
+     * Draw everything, one geometry call per page, and empty the batch.
+     * @return The number of draw calls made.
+     */
+    unsigned Flush(SDL_Renderer *renderer);
+};
+
+#endif
@@ -0,0 +1,83 @@
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <string>
+
+LatencyHistogram::LatencyHistogram():count(0),sum(0),max(0) {
+    std::fill(buckets,buckets + MAX_MS + 1,0);
+}
+
+/*
+ * Count one latency.
+ */
+void LatencyHistogram::Add(unsigned ms) {
+
+    ++buckets[ms < MAX_MS ? ms : MAX_MS];
+    ++count;
+    sum += ms;
+    max = std::max(max,ms);
+}
+
+/*
+ * Return the latency p percent of the samples are at or below.
+ * The overflow bucket answers with the real maximum.
+ */
+unsigned LatencyHistogram::Percentile(double p) const {
+
+    if(count == 0)
+        return 0;
+
+    unsigned long rank = (unsigned long)(p / 100.0 * count + 0.5);
+    rank = std::max(1UL,std::min(rank,count));
+
+    unsigned long seen = 0;
+    for(unsigned i = 0;i <= MAX_MS;++i){
+        seen += buckets[i];
+        if(seen >= rank)
+            return i == MAX_MS ? max : i;
+    }
+    return max;
+}
+
+/*
+ * Return the mean latency in milliseconds.
+ */
+double LatencyHistogram::Mean() const {
+    return count ? (double)sum / count : 0;
+}
+
+/*
+ * Print a summary line and the non-empty buckets, one bar per bucket.
+ */
+void LatencyHistogram::Print(std::ostream &os) const {
+
+    os << "keystroke latency: " << count << " samples, mean " << Mean() << "ms, p50 " << Percentile(50)
+       << "ms, p99 " << Percentile(99) << "ms, max " << max << "ms" << std::endl;
+
+    unsigned long top = *std::max_element(buckets,buckets + MAX_MS + 1);
+    for(unsigned i = 0;i <= MAX_MS && top;++i){
+        if(!buckets[i])
+            continue;
+        os << (i == MAX_MS ? ">=" : "  ") << i << "ms\t" << buckets[i] << "\t"
+           << std::string((buckets[i] * 40 + top - 1) / top,'#') << std::endl;
+    }
+}
+
+/*
+ * Write the summary and the non-empty buckets as JSON.
+ */
+void LatencyHistogram::WriteJson(std::ostream &os) const {
+
+    os << "{\"count\": " << count << ", \"mean_ms\": " << Mean() << ", \"p50_ms\": " << Percentile(50)
+       << ", \"p90_ms\": " << Percentile(90) << ", \"p99_ms\": " << Percentile(99) << ", \"max_ms\": " << max
+       << ", \"buckets\": {";
+
+    bool first = true;
+    for(unsigned i = 0;i <= MAX_MS;++i){
+        if(!buckets[i])
+            continue;
+        os << (first ? "" : ", ") << "\"" << i << "\": " << buckets[i];
+        first = false;
+    }
+    os << "}}" << std::endl;
+}
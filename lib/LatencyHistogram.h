@@ -0,0 +1,64 @@
+/*
+ * Histogram of keystroke-to-photon latencies.
+ *
+ * One bucket per millisecond up to MAX_MS, anything slower lands in the
+ * last bucket. SDL event timestamps are in milliseconds, so finer buckets
+ * would not mean anything.
+ */
+
+#ifndef LATENCYHISTOGRAM_LIBRARY_H
+#define LATENCYHISTOGRAM_LIBRARY_H
+
+#include <ostream>
+
+class LatencyHistogram{
+private:
+    static const unsigned MAX_MS = 250;
+
+    unsigned long buckets[MAX_MS + 1];
+    unsigned long count;
+    unsigned long long sum;
+    unsigned max;
+
+public:
+    LatencyHistogram();
+
+    /*
+     * Count one latency.
+     * @param ms Milliseconds from the input event to the present of its frame.
+     */
+    void Add(unsigned ms);
+
+    /*
+     * Return the number of latencies counted.
+     */
+    unsigned long Count() const{ return count; }
+
+    /*
+     * Return the latency p percent of the samples are at or below, 0 without samples.
+     * @param p Between 0 and 100.
+     */
+    unsigned Percentile(double p) const;
+
+    /*
+     * Return the mean latency in milliseconds.
+     */
+    double Mean() const;
+
+    /*
+     * Return the slowest latency in milliseconds.
+     */
+    unsigned Max() const{ return max; }
+
+    /*
+     * Print a summary line and the non-empty buckets.
+     */
+    void Print(std::ostream &os) const;
+
+    /*
+     * Write count, mean, p50, p90, p99, max and the buckets as one JSON object.
+     */
+    void WriteJson(std::ostream &os) const;
+};
+
+#endif
@@ -0,0 +1,192 @@
+#include "LineDiff.h"
+#include "TextHash.h"
+
+#include <algorithm>
+#include <cstring>
+
+/*
+ * Return the offset of the first '\n' at or after i, len if there is none.
+ * Eight characters are tested at once: a byte of w ^ "\n\n\n\n\n\n\n\n" is
+ * zero where w has a '\n', and the lowest zero byte is found exactly.
+ */
+static unsigned FindNewline(const char *s, unsigned i, unsigned len){
+
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    const unsigned long long ONES = 0x0101010101010101ULL, HIGHS = 0x8080808080808080ULL;
+    const unsigned long long NEWLINES = ONES * '\n';
+    for(;i + 8 <= len;i += 8){
+        unsigned long long w;
+        memcpy(&w,s + i,8);
+        w ^= NEWLINES;
+        unsigned long long zero = (w - ONES) & ~w & HIGHS;
+        if(zero)
+            return i + __builtin_ctzll(zero) / 8;
+    }
+#endif
+    for(;i < len;++i)
+        if(s[i] == '\n')
+            return i;
+    return len;
+}
+
+void IndexLines(const char *s, unsigned len, LineIndex &out) {
+
+    out.hashes.clear();
+    out.starts.clear();
+
+    unsigned start = 0;
+    for(;;){
+        unsigned nl = FindNewline(s,start,len);
+        unsigned end = nl < len ? nl + 1 : len;
+        out.starts.push_back(start);
+        out.hashes.push_back(HashText(s + start,end - start));
+        if(nl == len)
+            break;
+        start = end;
+    }
+    out.starts.push_back(len);
+}
+
+/*
+ * Myers' greedy algorithm over a[0, n) and b[0, m), the common start and
+ * end are cut off already. v[k] is the furthest x reached on diagonal
+ * k = x - y, a copy of v is kept for every d to walk the path back.
+ * @param ops Filled with the edit script backwards: '=', '-' (a only), '+' (b only).
+ * @return false if it takes more than MAX_EDITS edits.
+ */
+static bool Myers(const unsigned long long *a, int n, const unsigned long long *b, int m, std::vector<char> &ops){
+
+    const int maxD = std::min(n + m,(int)MAX_EDITS);
+    const int offset = maxD + 1;
+    std::vector<int> v(2 * maxD + 3,0);
+    std::vector<std::vector<int> > trace;
+
+    int found = -1;
+    for(int d = 0;d <= maxD && found < 0;++d){
+        /* Only diagonals [-d - 1, d + 1] are looked at while walking back from step d. */
+        trace.push_back(std::vector<int>(v.begin() + offset - d - 1,v.begin() + offset + d + 2));
+
+        for(int k = -d;k <= d;k += 2){
+            int x;
+            if(k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1]))
+                x = v[offset + k + 1];
+            else
+                x = v[offset + k - 1] + 1;
+            int y = x - k;
+            while(x < n && y < m && a[x] == b[y]){
+                ++x;
+                ++y;
+            }
+            v[offset + k] = x;
+            if(x >= n && y >= m){
+                found = d;
+                break;
+            }
+        }
+    }
+    if(found < 0)
+        return false;
+
+    int x = n, y = m;
+    for(int d = found;d >= 0;--d){
+        const std::vector<int> &t = trace[d];
+        /* t[0] is diagonal -d - 1. */
+        int k = x - y;
+        int prevK;
+        if(k == -d || (k != d && t[k - 1 + d + 1] < t[k + 1 + d + 1]))
+            prevK = k + 1;
+        else
+            prevK = k - 1;
+        int prevX = t[prevK + d + 1];
+        int prevY = prevX - prevK;
+
+        while(x > prevX && y > prevY){
+            ops.push_back('=');
+            --x;
+            --y;
+        }
+        if(d > 0)
+            ops.push_back(x == prevX ? '+' : '-');
+        x = prevX;
+        y = prevY;
+    }
+    return true;
+}
+
+/*
+ * Trim what both share at the start and at the end, diff the rest.
+ */
+std::vector<DiffHunk> DiffLines(const LineIndex &a, const LineIndex &b) {
+
+    const std::vector<unsigned long long> &x = a.hashes, &y = b.hashes;
+    unsigned n = x.size(), m = y.size();
+
+    unsigned head = 0;
+    while(head < n && head < m && x[head] == y[head])
+        ++head;
+    unsigned tail = 0;
+    while(tail < n - head && tail < m - head && x[n - 1 - tail] == y[m - 1 - tail])
+        ++tail;
+
+    std::vector<DiffHunk> hunks;
+    unsigned oldCount = n - head - tail, newCount = m - head - tail;
+    if(oldCount == 0 && newCount == 0)
+        return hunks;
+
+    std::vector<char> ops;
+    if(oldCount == 0 || newCount == 0
+       || !Myers(&x[head],oldCount,&y[head],newCount,ops)){
+        DiffHunk h = {head,oldCount,head,newCount};
+        hunks.push_back(h);
+        return hunks;
+    }
+
+    /* ops is backwards, a hunk is a run of edits without '=' in between. */
+    unsigned oldLine = head, newLine = head;
+    bool open = false;
+    for(std::vector<char>::reverse_iterator op = ops.rbegin();op != ops.rend();++op){
+        if(*op == '='){
+            open = false;
+            ++oldLine;
+            ++newLine;
+            continue;
+        }
+        if(!open){
+            DiffHunk h = {oldLine,0,newLine,0};
+            hunks.push_back(h);
+            open = true;
+        }
+        if(*op == '-'){
+            ++hunks.back().oldCount;
+            ++oldLine;
+        }else{
+            ++hunks.back().newCount;
+            ++newLine;
+        }
+    }
+    return hunks;
+}
+
+LINECHANGE LineChange(const std::vector<DiffHunk> &hunks, unsigned line, unsigned lines) {
+
+    if(hunks.empty())
+        return LINECHANGE::NONE;
+
+    /* Lines removed at the very end mark the last line. */
+    const DiffHunk &last = hunks.back();
+    if(last.newCount == 0 && last.newLine >= lines && line + 1 == lines)
+        return LINECHANGE::REMOVED;
+
+    /* The last hunk starting at or before the line. */
+    std::vector<DiffHunk>::const_iterator it = std::upper_bound(hunks.begin(),hunks.end(),line,
+        [](unsigned l, const DiffHunk &h){ return l < h.newLine; });
+    if(it == hunks.begin())
+        return LINECHANGE::NONE;
+    --it;
+
+    if(it->newCount == 0)
+        return it->newLine == line ? LINECHANGE::REMOVED : LINECHANGE::NONE;
+    if(line < it->newLine + it->newCount)
+        return it->oldCount ? LINECHANGE::CHANGED : LINECHANGE::ADDED;
+    return LINECHANGE::NONE;
+}
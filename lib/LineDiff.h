@@ -0,0 +1,70 @@
+/*
+ * Line diff between two versions of a text.
+ *
+ * Both texts are cut into lines and every line is hashed, eight characters
+ * at a time; the newline search works on eight characters at a time as
+ * well. The diff then only compares hashes: lines both versions share at
+ * the start and at the end are skipped, the rest goes through Myers'
+ * O(ND) algorithm. Small edits to a huge file cost one hashing pass and
+ * little else. A diff with more than MAX_EDITS edits is not worked out
+ * line by line, the region between the shared start and end is reported
+ * as one changed hunk.
+ */
+
+#ifndef LINEDIFF_LIBRARY_H
+#define LINEDIFF_LIBRARY_H
+
+#include <string>
+#include <vector>
+
+/* What happened to a line of the new text. */
+enum class LINECHANGE{NONE = 0,ADDED,CHANGED,REMOVED};
+
+/*
+ * The lines of a text. A line includes its '\n', the last line is what
+ * follows the last '\n' and may be empty.
+ */
+struct LineIndex{
+    std::vector<unsigned long long> hashes;
+    std::vector<unsigned> starts;       //offset of every line, and the length of text at the end
+};
+
+/*
+ * Old lines [oldLine, oldLine + oldCount) became new lines [newLine, newLine + newCount).
+ */
+struct DiffHunk{
+    unsigned oldLine;
+    unsigned oldCount;
+    unsigned newLine;
+    unsigned newCount;
+};
+
+static const unsigned MAX_EDITS = 2048;
+
+/*
+ * Cut a text into lines and hash them.
+ * @param s The text.
+ * @param len The number of characters.
+ * @param out The lines.
+ */
+void IndexLines(const char * s, unsigned len, LineIndex &out);
+
+/*
+ * Work out which lines changed from one text to another.
+ * @param a The lines of the old text.
+ * @param b The lines of the new text.
+ * @return The hunks, in order.
+ */
+std::vector<DiffHunk> DiffLines(const LineIndex &a, const LineIndex &b);
+
+/*
+ * Return what happened to a line of the new text, a binary search over
+ * the hunks. Lines removed without a replacement mark the line which
+ * follows them (the last line at the end of text).
+ * @param hunks The diff.
+ * @param line The line of the new text.
+ * @param lines The number of lines of the new text.
+ */
+LINECHANGE LineChange(const std::vector<DiffHunk> &hunks, unsigned line, unsigned lines);
+
+#endif
@@ -0,0 +1,389 @@
+#include "LineOps.h"
+#include "TextHash.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <vector>
+
+/* A text is cut into parts of at least MIN_PART characters, one per thread. */
+static const unsigned MIN_PART = 1 << 20;
+
+struct Line{
+    unsigned long long key;     //SORT: the first eight characters, the first one highest. UNIQUE: the hash.
+    unsigned start;
+    unsigned length;            //without the '\n'
+};
+
+/*
+ * Orders lines as memcmp does, shorter first when one starts the other.
+ * Lines with different keys differ in their first eight characters.
+ */
+struct LineLess{
+    const char *s;
+    bool operator()(const Line &a, const Line &b) const{
+        if(a.key != b.key)
+            return a.key < b.key;
+        unsigned n = std::min(a.length,b.length);
+        int c = n > 8 ? memcmp(s + a.start + 8,s + b.start + 8,n - 8) : 0;
+        return c != 0 ? c < 0 : a.length < b.length;
+    }
+};
+
+struct LineGreater{
+    LineLess less;
+    bool operator()(const Line &a, const Line &b) const{ return less(b,a); }
+};
+
+/*
+ * Call f(0) to f(n - 1) at once, f(0) on the calling thread.
+ */
+static void Parallel(unsigned n, const std::function<void(unsigned)> &f){
+
+    std::vector<std::thread> workers;
+    for(unsigned i = 1;i < n;++i)
+        workers.push_back(std::thread(f,i));
+    if(n > 0)
+        f(0);
+    for(size_t i = 0;i < workers.size();++i)
+        workers[i].join();
+}
+
+/*
+ * Whether the caller asked the operation to stop.
+ */
+static bool Stopped(const std::function<bool()> &cancelled){
+    return cancelled && cancelled();
+}
+
+/*
+ * Cut a text into parts right after line ends, part i is [bounds[i], bounds[i + 1]).
+ */
+static void Split(const char *s, unsigned len, unsigned parts, std::vector<unsigned> &bounds){
+
+    bounds.assign(1,0);
+    for(unsigned i = 1;i < parts;++i){
+        unsigned at = std::max((unsigned)((unsigned long long)len * i / parts),bounds.back());
+        const char *nl = at < len ? static_cast<const char *>(memchr(s + at,'\n',len - at)) : nullptr;
+        bounds.push_back(nl ? (unsigned)(nl - s) + 1 : len);
+    }
+    bounds.push_back(len);
+}
+
+/*
+ * Call f(start, length) for every line of [from, to), which starts a line.
+ */
+template<class F>
+static void ForEachLine(const char *s, unsigned from, unsigned to, F f){
+
+    while(from < to){
+        const char *nl = static_cast<const char *>(memchr(s + from,'\n',to - from));
+        unsigned end = nl ? (unsigned)(nl - s) : to;
+        f(from,end - from);
+        from = end + 1;
+    }
+}
+
+static unsigned long long Key(const char *s, unsigned len){
+
+    unsigned long long k = 0;
+    for(unsigned i = 0;i < 8;++i)
+        k = k << 8 | (i < len ? (unsigned char)s[i] : 0);
+    return k;
+}
+
+static bool Contains(const char *s, unsigned len, const std::string &pattern){
+
+    unsigned n = pattern.size();
+    if(n == 0)
+        return true;
+    for(unsigned i = 0;i + n <= len;++i){
+        const char *c = static_cast<const char *>(memchr(s + i,pattern[0],len - n + 1 - i));
+        if(!c)
+            return false;
+        i = c - s;
+        if(memcmp(c,pattern.data(),n) == 0)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Put the parts together, each thread copying one.
+ */
+static void Join(std::vector<std::string> &parts, std::string &out){
+
+    if(parts.size() == 1){
+        out.swap(parts[0]);
+        return;
+    }
+    std::vector<size_t> at(parts.size() + 1,0);
+    for(size_t i = 0;i < parts.size();++i)
+        at[i + 1] = at[i] + parts[i].size();
+    out.resize(at.back());
+    Parallel(parts.size(),[&](unsigned i){
+        if(!parts[i].empty())
+            memcpy(&out[at[i]],parts[i].data(),parts[i].size());
+    });
+}
+
+/*
+ * Sort every part, then merge them in pairs, the pairs of a round at once.
+ * The sorted lines are written out in as many parts.
+ */
+static bool SortLines(const LineOp &op, const char *s, const std::vector<unsigned> &bounds, std::vector<std::string> &out,
+                      const std::function<bool()> &cancelled){
+
+    unsigned parts = bounds.size() - 1;
+    LineLess less = { s };
+    LineGreater greater = { less };
+
+    std::vector<std::vector<Line> > lines(parts);
+    Parallel(parts,[&](unsigned i){
+        ForEachLine(s,bounds[i],bounds[i + 1],[&](unsigned start, unsigned length){
+            Line l = { Key(s + start,length), start, length };
+            lines[i].push_back(l);
+        });
+        if(op.invert)
+            std::sort(lines[i].begin(),lines[i].end(),greater);
+        else
+            std::sort(lines[i].begin(),lines[i].end(),less);
+    });
+
+    for(unsigned width = 1;width < parts;width *= 2){
+        if(Stopped(cancelled))
+            return false;
+        Parallel((parts + 2 * width - 1) / (2 * width),[&](unsigned pair){
+            std::vector<Line> &a = lines[2 * width * pair];
+            unsigned j = 2 * width * pair + width;
+            if(j >= parts)
+                return;
+            std::vector<Line> &b = lines[j], merged(a.size() + b.size());
+            if(op.invert)
+                std::merge(a.begin(),a.end(),b.begin(),b.end(),merged.begin(),greater);
+            else
+                std::merge(a.begin(),a.end(),b.begin(),b.end(),merged.begin(),less);
+            a.swap(merged);
+            std::vector<Line>().swap(b);
+        });
+    }
+    if(Stopped(cancelled))
+        return false;
+
+    const std::vector<Line> &sorted = lines[0];
+    out.assign(parts,std::string());
+    Parallel(parts,[&](unsigned i){
+        size_t from = sorted.size() * i / parts, to = sorted.size() * (i + 1) / parts, bytes = 0;
+        for(size_t k = from;k < to;++k)
+            bytes += sorted[k].length + 1;
+        out[i].reserve(bytes);
+        for(size_t k = from;k < to;++k){
+            out[i].append(s + sorted[k].start,sorted[k].length);
+            out[i] += '\n';
+        }
+    });
+    return true;
+}
+
+/*
+ * Keep the first of equal lines. Every part hands the lines it holds to
+ * the threads by their hash, in order; a thread then looks its lines up
+ * in a hash table of its own, part after part, so it sees them in the
+ * order of the text.
+ */
+static bool UniqueLines(const char *s, const std::vector<unsigned> &bounds, std::vector<std::string> &out,
+                        const std::function<bool()> &cancelled){
+
+    unsigned parts = bounds.size() - 1;
+    std::vector<std::vector<Line> > lines(parts);
+    std::vector<std::vector<std::vector<unsigned> > > shares(parts,std::vector<std::vector<unsigned> >(parts));
+    Parallel(parts,[&](unsigned i){
+        ForEachLine(s,bounds[i],bounds[i + 1],[&](unsigned start, unsigned length){
+            Line l = { HashText(s + start,length), start, length };
+            shares[i][(l.key >> 32) % parts].push_back(lines[i].size());
+            lines[i].push_back(l);
+        });
+    });
+    if(Stopped(cancelled))
+        return false;
+
+    std::vector<std::vector<char> > keep(parts);
+    for(unsigned i = 0;i < parts;++i)
+        keep[i].assign(lines[i].size(),0);
+
+    Parallel(parts,[&](unsigned t){
+        size_t n = 0;
+        for(unsigned i = 0;i < parts;++i)
+            n += shares[i][t].size();
+        size_t size = 16;
+        while(size < 2 * n)
+            size *= 2;
+
+        /* Slots hold the part and the index of a line kept, 0 is empty. */
+        std::vector<std::pair<unsigned,unsigned> > table(size,std::make_pair(0u,0u));
+        for(unsigned i = 0;i < parts;++i){
+            for(size_t k = 0;k < shares[i][t].size();++k){
+                unsigned index = shares[i][t][k];
+                const Line &l = lines[i][index];
+                size_t slot = l.key & (size - 1);
+                bool seen = false;
+                for(;table[slot].first;slot = (slot + 1) & (size - 1)){
+                    const Line &o = lines[table[slot].first - 1][table[slot].second];
+                    if(o.key == l.key && o.length == l.length && memcmp(s + o.start,s + l.start,l.length) == 0){
+                        seen = true;
+                        break;
+                    }
+                }
+                if(!seen){
+                    table[slot] = std::make_pair(i + 1,index);
+                    keep[i][index] = 1;
+                }
+            }
+        }
+    });
+    if(Stopped(cancelled))
+        return false;
+
+    out.assign(parts,std::string());
+    Parallel(parts,[&](unsigned i){
+        for(size_t k = 0;k < lines[i].size();++k){
+            if(!keep[i][k])
+                continue;
+            out[i].append(s + lines[i][k].start,lines[i][k].length);
+            out[i] += '\n';
+        }
+    });
+    return true;
+}
+
+/*
+ * Trailing blanks go, a '\r' ending the line stays.
+ */
+static void TrimLine(const char *p, unsigned length, std::string &out){
+
+    unsigned end = length;
+    bool cr = end > 0 && p[end - 1] == '\r';
+    if(cr)
+        --end;
+    while(end > 0 && (p[end - 1] == ' ' || p[end - 1] == '\t'))
+        --end;
+    out.append(p,end);
+    if(cr)
+        out += '\r';
+    out += '\n';
+}
+
+/*
+ * The leading blanks are measured in columns and written again.
+ */
+static void ReindentLine(const LineOp &op, const char *p, unsigned length, std::string &out){
+
+    unsigned width = op.tabWidth ? op.tabWidth : 1, i = 0, column = 0;
+    for(;i < length && (p[i] == ' ' || p[i] == '\t');++i)
+        column = p[i] == '\t' ? (column / width + 1) * width : column + 1;
+    if(op.tabs){
+        out.append(column / width,'\t');
+        out.append(column % width,' ');
+    }else{
+        out.append(column,' ');
+    }
+    out.append(p + i,length - i);
+    out += '\n';
+}
+
+bool RunLineOp(const LineOp &op, const char *s, unsigned len, std::string &out, unsigned threads,
+               const std::function<bool()> &cancelled) {
+
+    if(threads == 0)
+        threads = std::max(std::thread::hardware_concurrency(),1u);
+    unsigned parts = std::min(threads,len / MIN_PART + 1);
+    std::vector<unsigned> bounds;
+    Split(s,len,parts,bounds);
+
+    std::vector<std::string> results;
+    switch(op.type){
+        case LINEOP::SORT:
+            if(!SortLines(op,s,bounds,results,cancelled))
+                return false;
+            break;
+        case LINEOP::UNIQUE:
+            if(!UniqueLines(s,bounds,results,cancelled))
+                return false;
+            break;
+        default:
+            results.assign(parts,std::string());
+            Parallel(parts,[&](unsigned i){
+                results[i].reserve(bounds[i + 1] - bounds[i]);
+                ForEachLine(s,bounds[i],bounds[i + 1],[&](unsigned start, unsigned length){
+                    if(op.type == LINEOP::TRIM)
+                        TrimLine(s + start,length,results[i]);
+                    else if(op.type == LINEOP::REINDENT)
+                        ReindentLine(op,s + start,length,results[i]);
+                    else if(Contains(s + start,length,op.pattern) != op.invert){
+                        results[i].append(s + start,length);
+                        results[i] += '\n';
+                    }
+                });
+            });
+            break;
+    }
+
+    if(Stopped(cancelled))
+        return false;
+
+    Join(results,out);
+    if(len > 0 && s[len - 1] != '\n' && !out.empty())
+        out.resize(out.size() - 1);
+    return true;
+}
+
+/*
+ * Return how many characters a and b share at their start, or at their
+ * end, of n at most. Blocks are compared with memcmp first.
+ */
+static unsigned SharedHead(const char *a, const char *b, unsigned n){
+
+    const unsigned BLOCK = 4096;
+    unsigned i = 0;
+    while(i + BLOCK <= n && memcmp(a + i,b + i,BLOCK) == 0)
+        i += BLOCK;
+    while(i < n && a[i] == b[i])
+        ++i;
+    return i;
+}
+
+static unsigned SharedTail(const char *a, const char *b, unsigned n){
+
+    const unsigned BLOCK = 4096;
+    unsigned i = 0;
+    while(i + BLOCK <= n && memcmp(a - i - BLOCK,b - i - BLOCK,BLOCK) == 0)
+        i += BLOCK;
+    while(i < n && *(a - 1 - i) == *(b - 1 - i))
+        ++i;
+    return i;
+}
+
+TextDelta ReplaceText(GapBuffer &gb, const std::string &before, const std::string &after) {
+
+    unsigned n = std::min(before.size(),after.size());
+    unsigned head = SharedHead(before.data(),after.data(),n);
+    unsigned tail = SharedTail(before.data() + before.size(),after.data() + after.size(),n - head);
+
+    TextDelta d;
+    d.offset = head;
+    d.removed = before.size() - head - tail;
+    d.inserted = after.size() - head - tail;
+    if(d.removed == 0 && d.inserted == 0)
+        return d;
+
+    unsigned cursor = gb.CursorOffset();
+    GapBuffer::Transaction t(gb);
+    gb.SetCursor(head + d.removed);
+    if(d.removed)
+        gb.DeleteString(d.removed);
+    if(d.inserted)
+        gb.InsertString(after.data() + head,d.inserted);
+    gb.SetCursor(cursor < head ? cursor : cursor >= head + d.removed ? cursor - d.removed + d.inserted : head);
+    return d;
+}
@@ -0,0 +1,68 @@
+/*
+ * Bulk line operations over a whole text: sort, drop duplicate lines,
+ * trim trailing whitespace, reindent, keep the lines matching a pattern.
+ *
+ * An operation works on a copy of the text and builds the new text, which
+ * ReplaceText() writes back as one change of the buffer. The text is cut
+ * into parts at line ends and the parts go to threads of their own:
+ * - lines are found with memchr, which tests many characters at once;
+ * - a sort sorts every part and merges them in pairs, lines are compared
+ *   by their first eight characters before their text is read;
+ * - duplicates are found by hashing every line, each thread keeps the
+ *   lines of a share of the hashes, in the order of the text;
+ * - the new text is put together by copying every part into place.
+ *
+ * A line is what comes before a '\n'. Every line of the result ends with
+ * '\n', except the last one if the text didn't end with '\n'.
+ */
+
+#ifndef LINEOPS_LIBRARY_H
+#define LINEOPS_LIBRARY_H
+
+#include "GapBuffer.h"
+#include <functional>
+#include <string>
+
+/* What a bulk line operation does. */
+enum class LINEOP{SORT,UNIQUE,TRIM,REINDENT,FILTER};
+
+/*
+ * One bulk line operation.
+ */
+struct LineOp{
+    LINEOP type;
+    bool invert;            //SORT: descending, FILTER: drop the lines which match
+    std::string pattern;    //FILTER: the text a line must contain
+    bool tabs;              //REINDENT: indent with tabs rather than spaces
+    unsigned tabWidth;      //REINDENT: columns from one tab stop to the next
+
+    LineOp(LINEOP t = LINEOP::SORT):type(t),invert(false),tabs(false),tabWidth(4){}
+};
+
+/*
+ * Run an operation over a text.
+ * @param op The operation.
+ * @param s The text.
+ * @param len The number of characters.
+ * @param out The new text.
+ * @param threads The threads to use at most, 0 for the hardware threads.
+ * Texts of less than a part each get fewer.
+ * @param cancelled Asked between the steps of the operation, it stops when
+ * this returns true. May be empty.
+ * @return False if it was cancelled, out is left unfinished then.
+ */
+bool RunLineOp(const LineOp &op, const char * s, unsigned len, std::string &out, unsigned threads = 0,
+               const std::function<bool()> &cancelled = std::function<bool()>());
+
+/*
+ * Write a new text into a buffer as one change. Only the part between the
+ * start and the end both texts share is replaced, the cursor keeps its
+ * place outside of it.
+ * @param gb The buffer, holding before.
+ * @param before The text of the buffer.
+ * @param after The new text.
+ * @return What was replaced, nothing removed nor inserted if the texts are equal.
+ */
+TextDelta ReplaceText(GapBuffer &gb, const std::string &before, const std::string &after);
+
+#endif
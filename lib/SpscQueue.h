@@ -0,0 +1,94 @@
+/*
+ * A bounded lock-free single-producer/single-consumer queue.
+ *
+ * Exactly one thread may call TryPush and exactly one (other) thread may call
+ * TryPop. Capacity is rounded up to a power of two, one slot is kept empty to
+ * tell a full queue from an empty one.
+ */
+
+#ifndef SPSCQUEUE_LIBRARY_H
+#define SPSCQUEUE_LIBRARY_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+template<typename T>
+class SpscQueue{
+private:
+    std::vector<T> slots;
+    size_t mask;
+
+    /*
+     * Keep the indices on separate cache lines so the two threads don't fight.
+     * Padding instead of alignas, C++11 operator new ignores extended alignment.
+     */
+    std::atomic<size_t> head;   //next slot to pop, owned by the consumer
+    char pad[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail;   //next slot to push, owned by the producer
+
+    /* There is no need for copy construction. */
+    SpscQueue(const SpscQueue &);
+
+public:
+    /*
+     * @param capacity The number of elements the queue can hold.
+     */
+    explicit SpscQueue(size_t capacity = 1024):head(0),tail(0){
+        size_t n = 2;
+        while(n < capacity + 1)
+            n <<= 1;
+        slots.resize(n);
+        mask = n - 1;
+    }
+
+    /*
+     * Producer side.
+     * @return false if the queue is full, v is left untouched then.
+     */
+    bool TryPush(T &&v){
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t next = (t + 1) & mask;
+        if(next == head.load(std::memory_order_acquire))
+            return false;
+        slots[t] = std::move(v);
+        tail.store(next,std::memory_order_release);
+        return true;
+    }
+
+    bool TryPush(const T &v){
+        T copy(v);
+        return TryPush(std::move(copy));
+    }
+
+    /*
+     * Consumer side.
+     * @return false if the queue is empty.
+     */
+    bool TryPop(T &v){
+        size_t h = head.load(std::memory_order_relaxed);
+        if(h == tail.load(std::memory_order_acquire))
+            return false;
+        v = std::move(slots[h]);
+        slots[h] = T();
+        head.store((h + 1) & mask,std::memory_order_release);
+        return true;
+    }
+
+    /*
+     * Return whether the queue is empty, exact only on the consumer side.
+     */
+    bool Empty() const{
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    /*
+     * Return the number of elements the queue can hold.
+     */
+    size_t Capacity() const{
+        return mask;
+    }
+};
+
+#endif
@@ -0,0 +1,725 @@
+#include "StructureIndex.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <new>
+
+/* The indentation of a chunk without lines that aren't blank. */
+static const int NO_INDENT = INT_MAX;
+
+struct StructureNode{
+    StructureNode * left;
+    StructureNode * right;
+    unsigned int priority;
+
+    /* The chunk. */
+    unsigned int bytes;
+    unsigned int ends;                  //line ends
+    int net;                            //depth after it less depth before it
+    int low;                            //lowest depth after one of its characters, relative to its start
+    int indent;                         //lowest indentation of the lines starting in it
+    bool lineStart;                     //whether a line starts where it does
+
+    /* The subtree, the same added up. */
+    unsigned int totalBytes;
+    unsigned int totalEnds;
+    int totalNet;
+    int totalLow;
+    int totalIndent;
+    unsigned int count;                 //chunks
+};
+
+static int Bracket(char c){
+
+    switch(c){
+        case '(': case '[': case '{':
+            return 1;
+        case ')': case ']': case '}':
+            return -1;
+    }
+    return 0;
+}
+
+static bool Pair(char open, char close){
+    return (open == '(' && close == ')') || (open == '[' && close == ']') || (open == '{' && close == '}');
+}
+
+/*
+ * Measure the indentation of the line starting at s[i] and move i past
+ * its end, or to n if it doesn't end in the chunk.
+ * Return -1 if it is blank as far as the chunk goes.
+ */
+static int LineIndent(const char *s, unsigned int n, unsigned int &i){
+
+    unsigned int col = 0;
+    for(;i < n;++i){
+        if(s[i] == ' ' || s[i] == '\r')
+            ++col;
+        else if(s[i] == '\t')
+            col = (col / StructureIndex::TAB_WIDTH + 1) * StructureIndex::TAB_WIDTH;
+        else
+            break;
+    }
+    int indent = i < n && s[i] != '\n' ? (int)col : -1;
+
+    const void *end = i < n ? memchr(s + i,'\n',n - i) : nullptr;
+    i = end ? static_cast<const char *>(end) - s + 1 : n;
+    return indent;
+}
+
+/*
+ * Return where the first line starting in a chunk starts, n if none does.
+ */
+static unsigned int FirstLine(const char *s, unsigned int n, bool lineStart){
+
+    if(lineStart)
+        return 0;
+    const void *end = memchr(s,'\n',n);
+    return end ? static_cast<const char *>(end) - s + 1 : n;
+}
+
+static unsigned int Bytes(const StructureNode *t){ return t ? t->totalBytes : 0; }
+static unsigned int Ends(const StructureNode *t){ return t ? t->totalEnds : 0; }
+static int Net(const StructureNode *t){ return t ? t->totalNet : 0; }
+
+static void Update(StructureNode *t){
+
+    const StructureNode *l = t->left, *r = t->right;
+
+    t->totalLow = l ? std::min(l->totalLow,l->totalNet + t->low) : t->low;
+    t->totalNet = Net(l) + t->net;
+    if(r)
+        t->totalLow = std::min(t->totalLow,t->totalNet + r->totalLow);
+    t->totalNet += Net(r);
+
+    t->totalBytes = Bytes(l) + t->bytes + Bytes(r);
+    t->totalEnds = Ends(l) + t->ends + Ends(r);
+    t->totalIndent = std::min(t->indent,std::min(l ? l->totalIndent : NO_INDENT,r ? r->totalIndent : NO_INDENT));
+    t->count = (l ? l->count : 0) + 1 + (r ? r->count : 0);
+}
+
+/*
+ * Cut a treap into the chunks whose start (or end) is before key and the rest.
+ * @param base The offset of the first chunk of t.
+ */
+static void Split(StructureNode *t, unsigned long long key, bool byEnd, unsigned long long base,
+                  StructureNode *&l, StructureNode *&r){
+
+    if(!t){
+        l = r = nullptr;
+        return;
+    }
+    unsigned long long start = base + Bytes(t->left);
+    if((byEnd ? start + t->bytes : start) < key){
+        Split(t->right,key,byEnd,start + t->bytes,t->right,r);
+        l = t;
+    }else{
+        Split(t->left,key,byEnd,base,l,t->left);
+        r = t;
+    }
+    Update(t);
+}
+
+static StructureNode * Merge(StructureNode *a, StructureNode *b){
+
+    if(!a)
+        return b;
+    if(!b)
+        return a;
+    if(a->priority > b->priority){
+        a->right = Merge(a->right,b);
+        Update(a);
+        return a;
+    }
+    b->left = Merge(a,b->left);
+    Update(b);
+    return b;
+}
+
+/*
+ * Where a chunk is found: its offset, the depth and the line ends before it.
+ */
+struct ChunkPos{
+    unsigned int start;
+    int depth;
+    unsigned int ends;
+};
+
+/*
+ * Find the chunk holding an offset, the last one for the end of the text.
+ */
+static const StructureNode * Locate(const StructureNode *t, unsigned int offset, ChunkPos &p){
+
+    p.start = 0;
+    p.depth = 0;
+    p.ends = 0;
+    while(t){
+        if(offset < p.start + Bytes(t->left)){
+            t = t->left;
+            continue;
+        }
+        p.start += Bytes(t->left);
+        p.depth += Net(t->left);
+        p.ends += Ends(t->left);
+        if(offset < p.start + t->bytes || !t->right)
+            return t;
+        p.start += t->bytes;
+        p.depth += t->net;
+        p.ends += t->ends;
+        t = t->right;
+    }
+    return nullptr;
+}
+
+/*
+ * Find the first chunk starting at from or later in which the depth gets
+ * down to target.
+ * @param p Where t starts, set to where the chunk starts.
+ */
+static const StructureNode * FindFirstLow(const StructureNode *t, unsigned int from, int target, ChunkPos &p){
+
+    if(!t || p.start + t->totalBytes <= from || p.depth + t->totalLow > target)
+        return nullptr;
+
+    ChunkPos left = p;
+    const StructureNode *found = FindFirstLow(t->left,from,target,left);
+    if(found){
+        p = left;
+        return found;
+    }
+
+    ChunkPos here = {p.start + Bytes(t->left),p.depth + Net(t->left),p.ends + Ends(t->left)};
+    if(here.start >= from && here.depth + t->low <= target){
+        p = here;
+        return t;
+    }
+    p.start = here.start + t->bytes;
+    p.depth = here.depth + t->net;
+    p.ends = here.ends + t->ends;
+    return FindFirstLow(t->right,from,target,p);
+}
+
+/*
+ * Find the last chunk ending at to or earlier in which the depth gets
+ * down to target.
+ */
+static const StructureNode * FindLastLow(const StructureNode *t, unsigned int to, int target, ChunkPos &p){
+
+    if(!t || p.start >= to || p.depth + t->totalLow > target)
+        return nullptr;
+
+    ChunkPos here = {p.start + Bytes(t->left),p.depth + Net(t->left),p.ends + Ends(t->left)};
+    ChunkPos right = {here.start + t->bytes,here.depth + t->net,here.ends + t->ends};
+    const StructureNode *found = FindLastLow(t->right,to,target,right);
+    if(found){
+        p = right;
+        return found;
+    }
+    if(here.start + t->bytes <= to && here.depth + t->low <= target){
+        p = here;
+        return t;
+    }
+    return FindLastLow(t->left,to,target,p);
+}
+
+/*
+ * The same for indentation.
+ */
+static const StructureNode * FindFirstIndent(const StructureNode *t, unsigned int from, int indent, ChunkPos &p){
+
+    if(!t || p.start + t->totalBytes <= from || t->totalIndent > indent)
+        return nullptr;
+
+    ChunkPos left = p;
+    const StructureNode *found = FindFirstIndent(t->left,from,indent,left);
+    if(found){
+        p = left;
+        return found;
+    }
+
+    ChunkPos here = {p.start + Bytes(t->left),p.depth + Net(t->left),p.ends + Ends(t->left)};
+    if(here.start >= from && t->indent <= indent){
+        p = here;
+        return t;
+    }
+    p.start = here.start + t->bytes;
+    p.depth = here.depth + t->net;
+    p.ends = here.ends + t->ends;
+    return FindFirstIndent(t->right,from,indent,p);
+}
+
+static const StructureNode * FindLastIndent(const StructureNode *t, unsigned int to, int indent, ChunkPos &p){
+
+    if(!t || p.start >= to || t->totalIndent > indent)
+        return nullptr;
+
+    ChunkPos here = {p.start + Bytes(t->left),p.depth + Net(t->left),p.ends + Ends(t->left)};
+    ChunkPos right = {here.start + t->bytes,here.depth + t->net,here.ends + t->ends};
+    const StructureNode *found = FindLastIndent(t->right,to,indent,right);
+    if(found){
+        p = right;
+        return found;
+    }
+    if(here.start + t->bytes <= to && t->indent <= indent){
+        p = here;
+        return t;
+    }
+    return FindLastIndent(t->left,to,indent,p);
+}
+
+StructureIndex::StructureIndex(GapBuffer &buffer, Arena &a):gb(buffer),arena(a),root(nullptr),seed(2463534242u),
+                                                            scratch(MAX_CHUNK) {
+
+    root = Scan(0,gb.size());
+}
+
+StructureIndex::~StructureIndex() {
+
+    FreeTree(root);
+}
+
+void StructureIndex::FreeTree(StructureNode *t) {
+
+    if(!t)
+        return;
+    FreeTree(t->left);
+    FreeTree(t->right);
+    arena.Free(t,sizeof(StructureNode));
+}
+
+const char * StructureIndex::Read(unsigned int offset, unsigned int bytes) {
+
+    if(bytes > scratch.size())
+        scratch.resize(bytes);
+    gb.GetString(offset,bytes,&scratch[0]);
+    return &scratch[0];
+}
+
+/*
+ * A chunk is cut at the first line end after CHUNK bytes, at the last line
+ * end before MAX_CHUNK bytes if there is none, at MAX_CHUNK bytes if the
+ * line is longer. A small rest of the range is left in the last chunk.
+ */
+StructureNode * StructureIndex::Scan(unsigned int from, unsigned int to) {
+
+    StructureNode *t = nullptr;
+    bool lineStart = from == 0 || *Read(from - 1,1) == '\n';
+
+    for(unsigned int pos = from;pos < to;){
+        unsigned int n = to - pos < MAX_CHUNK ? to - pos : MAX_CHUNK;
+        const char *s = Read(pos,n);
+
+        unsigned int cut = n;
+        const void *end = n >= CHUNK ? memchr(s + CHUNK - 1,'\n',n - CHUNK + 1) : nullptr;
+        if(end){
+            cut = static_cast<const char *>(end) - s + 1;
+            if(pos + n == to && n - cut < CHUNK / 2)
+                cut = n;
+        }else if(pos + n < to){
+            while(cut > 0 && s[cut - 1] != '\n')
+                --cut;
+            if(!cut)
+                cut = n;
+        }
+
+        StructureNode *c = new (arena.Allocate(sizeof(StructureNode))) StructureNode;
+        c->left = c->right = nullptr;
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        c->priority = seed;
+        c->bytes = cut;
+        c->lineStart = lineStart;
+
+        int depth = 0, low = INT_MAX;
+        unsigned int ends = 0;
+        for(unsigned int i = 0;i < cut;++i){
+            depth += Bracket(s[i]);
+            low = std::min(low,depth);
+            ends += s[i] == '\n';
+        }
+        c->net = depth;
+        c->low = low;
+        c->ends = ends;
+
+        c->indent = NO_INDENT;
+        for(unsigned int i = FirstLine(s,cut,lineStart);i < cut;){
+            int indent = LineIndent(s,cut,i);
+            if(indent >= 0)
+                c->indent = std::min(c->indent,indent);
+        }
+
+        Update(c);
+        t = Merge(t,c);
+        lineStart = s[cut - 1] == '\n';
+        pos += cut;
+    }
+    return t;
+}
+
+/*
+ * Whether a chunk can stay where it is next to a rescanned range: it ends
+ * a line and isn't small, or it is a piece of a line too long for one.
+ */
+static bool Settled(const StructureNode *t, char last){
+
+    return t->bytes == StructureIndex::MAX_CHUNK || (last == '\n' && t->bytes >= StructureIndex::CHUNK / 2);
+}
+
+static const StructureNode * First(const StructureNode *t){
+
+    while(t->left)
+        t = t->left;
+    return t;
+}
+
+static const StructureNode * Last(const StructureNode *t){
+
+    while(t->right)
+        t = t->right;
+    return t;
+}
+
+/*
+ * The deltas are added up to one range of the new text outside of which
+ * nothing changed. The chunks it touches are scanned again, widened on
+ * either side by the chunks next to it until the chunks around the range
+ * are Settled(): the last line before the range, which may have been the
+ * end of the text, is scanned whole, and no small chunks are left behind.
+ */
+void StructureIndex::Apply(const TextChange &c) {
+
+    if(c.deltas.empty())
+        return;
+
+    unsigned long long lo = c.deltas[0].offset, hi = lo;
+    long long net = 0;
+    for(size_t i = 0;i < c.deltas.size();++i){
+        const TextDelta &d = c.deltas[i];
+        hi = hi >= d.offset + d.removed ? hi + d.inserted - d.removed : d.offset + d.inserted;
+        lo = std::min(lo,(unsigned long long)d.offset);
+        net += (long long)d.inserted - d.removed;
+    }
+
+    /* Chunks ending at lo or later and starting at the end of the old range or earlier. */
+    StructureNode *left, *rest, *middle, *right;
+    Split(root,lo + 1,true,0,left,rest);
+    unsigned int start = Bytes(left);
+    Split(rest,hi - net - start + 1,false,0,middle,right);
+    unsigned long long end = start + Bytes(middle) + net;
+    FreeTree(middle);
+
+    while(left && !Settled(Last(left),*Read(start - 1,1))){
+        StructureNode *last;
+        Split(left,start,true,0,left,last);
+        start -= last->bytes;
+        FreeTree(last);
+    }
+
+    StructureNode *scanned = Scan(start,end);
+    while(right){
+        bool lineStart = end == 0 || *Read(end - 1,1) == '\n';
+        if((!scanned || Settled(Last(scanned),*Read(end - 1,1))) && First(right)->lineStart == lineStart)
+            break;
+
+        /* Cut the last chunk again together with the next one. */
+        unsigned int pos = start;
+        if(scanned){
+            StructureNode *last;
+            Split(scanned,Bytes(scanned),true,0,scanned,last);
+            FreeTree(last);
+            pos += Bytes(scanned);
+        }
+        StructureNode *next;
+        Split(right,1,false,0,next,right);
+        end += next->bytes;
+        FreeTree(next);
+        scanned = Merge(scanned,Scan(pos,end));
+    }
+
+    root = Merge(Merge(left,scanned),right);
+}
+
+int StructureIndex::Depth(unsigned int offset) {
+
+    ChunkPos p;
+    const StructureNode *t = Locate(root,offset,p);
+    if(!t)
+        return 0;
+
+    unsigned int n = std::min(offset - p.start,t->bytes);
+    const char *s = Read(p.start,n);
+    int depth = p.depth;
+    for(unsigned int i = 0;i < n;++i)
+        depth += Bracket(s[i]);
+    return depth;
+}
+
+long long StructureIndex::FirstAtMost(unsigned int from, int target) {
+
+    if(from >= gb.size())
+        return -1;
+
+    ChunkPos p;
+    const StructureNode *t = Locate(root,from,p);
+    const char *s = Read(p.start,t->bytes);
+    int depth = p.depth;
+    for(unsigned int i = 0;i < t->bytes;++i){
+        depth += Bracket(s[i]);
+        if(p.start + i >= from && depth <= target)
+            return p.start + i;
+    }
+
+    unsigned int next = p.start + t->bytes;
+    p.start = p.depth = p.ends = 0;
+    t = FindFirstLow(root,next,target,p);
+    if(!t)
+        return -1;
+    s = Read(p.start,t->bytes);
+    depth = p.depth;
+    for(unsigned int i = 0;i < t->bytes;++i){
+        depth += Bracket(s[i]);
+        if(depth <= target)
+            return p.start + i;
+    }
+    return -1;
+}
+
+long long StructureIndex::LastAtMost(unsigned int limit, int target) {
+
+    long long none = target >= 0 ? -1 : -2;
+    if(limit == 0 || !root)
+        return none;
+    limit = std::min(limit,gb.size());
+
+    ChunkPos p;
+    const StructureNode *t = Locate(root,limit - 1,p);
+    const char *s = Read(p.start,limit - p.start);
+    int depth = p.depth;
+    long long last = -2;
+    for(unsigned int i = 0;i < limit - p.start;++i){
+        depth += Bracket(s[i]);
+        if(depth <= target)
+            last = p.start + i;
+    }
+    if(last >= 0)
+        return last;
+
+    unsigned int before = p.start;
+    p.start = p.depth = p.ends = 0;
+    t = FindLastLow(root,before,target,p);
+    if(!t)
+        return none;
+    s = Read(p.start,t->bytes);
+    depth = p.depth;
+    for(unsigned int i = 0;i < t->bytes;++i){
+        depth += Bracket(s[i]);
+        if(depth <= target)
+            last = p.start + i;
+    }
+    return last;
+}
+
+/*
+ * From an opening bracket at depth d the matching one is the first place
+ * after it where the depth is back to d. From a closing bracket back to d
+ * the matching one follows the last place before it at depth d.
+ */
+bool StructureIndex::Match(unsigned int offset, unsigned int &match) {
+
+    if(offset >= gb.size())
+        return false;
+
+    char c = *Read(offset,1);
+    int depth = Depth(offset);
+    long long other;
+    if(Bracket(c) > 0)
+        other = FirstAtMost(offset + 1,depth);
+    else if(Bracket(c) < 0 && offset > 0)
+        other = LastAtMost(offset - 1,depth - 1) + 1;
+    else
+        return false;
+
+    if(other < 0 || other == offset)
+        return false;
+    char o = *Read(other,1);
+    if(!(Bracket(c) > 0 ? Pair(c,o) : Pair(o,c)))
+        return false;
+    match = other;
+    return true;
+}
+
+/*
+ * The opening bracket is the one after the last place before offset at a
+ * lower depth. Depths are relative: after an unmatched closer they are
+ * negative, and blocks there are found all the same.
+ */
+bool StructureIndex::Enclosing(unsigned int offset, unsigned int &open, unsigned int &close) {
+
+    int depth = Depth(offset);
+    if(offset == 0)
+        return false;
+
+    long long o = LastAtMost(offset - 1,depth - 1) + 1;
+    if(o < 0)
+        return false;
+    long long c = FirstAtMost(o + 1,depth - 1);
+
+    open = o;
+    close = c < 0 ? gb.size() : c;
+    return true;
+}
+
+unsigned int StructureIndex::Lines() const {
+
+    return Ends(root) + 1;
+}
+
+unsigned int StructureIndex::LineOf(unsigned int offset) {
+
+    ChunkPos p;
+    const StructureNode *t = Locate(root,offset,p);
+    if(!t)
+        return 0;
+
+    unsigned int n = std::min(offset - p.start,t->bytes);
+    const char *s = Read(p.start,n);
+    return p.ends + std::count(s,s + n,'\n');
+}
+
+unsigned int StructureIndex::LineStart(unsigned int line) {
+
+    if(line == 0)
+        return 0;
+    if(line > Ends(root))
+        return gb.size();
+
+    /* The chunk with the line end in front of it. */
+    const StructureNode *t = root;
+    unsigned int start = 0, ends = 0;
+    while(t){
+        if(line <= ends + Ends(t->left)){
+            t = t->left;
+            continue;
+        }
+        start += Bytes(t->left);
+        ends += Ends(t->left);
+        if(line <= ends + t->ends)
+            break;
+        start += t->bytes;
+        ends += t->ends;
+        t = t->right;
+    }
+
+    const char *s = Read(start,t->bytes);
+    for(unsigned int i = 0;i < t->bytes;++i)
+        if(s[i] == '\n' && ++ends == line)
+            return start + i + 1;
+    return gb.size();
+}
+
+int StructureIndex::Indent(unsigned int line) {
+
+    unsigned int offset = LineStart(line);
+    if(offset >= gb.size())
+        return -1;
+
+    ChunkPos p;
+    const StructureNode *t = Locate(root,offset,p);
+    const char *s = Read(p.start,t->bytes);
+    unsigned int i = offset - p.start;
+    return LineIndent(s,t->bytes,i);
+}
+
+/*
+ * The rest of the chunk holding the line is scanned, then the first chunk
+ * after it with a line indented little enough.
+ */
+unsigned int StructureIndex::NextIndentAtMost(unsigned int from, int indent) {
+
+    unsigned int lines = Lines();
+    if(from >= lines)
+        return lines;
+    unsigned int offset = LineStart(from);
+    if(offset >= gb.size())
+        return lines;
+
+    ChunkPos p;
+    const StructureNode *t = Locate(root,offset,p);
+    const char *s = Read(p.start,t->bytes);
+    unsigned int line = from;
+    for(unsigned int i = offset - p.start;i < t->bytes;){
+        int w = LineIndent(s,t->bytes,i);
+        if(w >= 0 && w <= indent)
+            return line;
+        line += s[i - 1] == '\n';
+    }
+
+    unsigned int next = p.start + t->bytes;
+    p.start = p.depth = p.ends = 0;
+    t = FindFirstIndent(root,next,indent,p);
+    if(!t)
+        return lines;
+    s = Read(p.start,t->bytes);
+    line = p.ends + !t->lineStart;
+    for(unsigned int i = FirstLine(s,t->bytes,t->lineStart);i < t->bytes;){
+        int w = LineIndent(s,t->bytes,i);
+        if(w >= 0 && w <= indent)
+            return line;
+        line += s[i - 1] == '\n';
+    }
+    return lines;
+}
+
+int StructureIndex::PrevIndentAtMost(unsigned int to, int indent) {
+
+    if(to == 0 || !root)
+        return -1;
+    unsigned int limit = LineStart(std::min(to,Lines()));
+
+    ChunkPos p;
+    const StructureNode *t = Locate(root,limit - 1,p);
+    const char *s = Read(p.start,t->bytes);
+    int found = -1;
+    unsigned int line = p.ends + !t->lineStart;
+    for(unsigned int i = FirstLine(s,t->bytes,t->lineStart);i < limit - p.start;){
+        int w = LineIndent(s,t->bytes,i);
+        if(w >= 0 && w <= indent)
+            found = line;
+        line += s[i - 1] == '\n';
+    }
+    if(found >= 0)
+        return found;
+
+    unsigned int before = p.start;
+    p.start = p.depth = p.ends = 0;
+    t = FindLastIndent(root,before,indent,p);
+    if(!t)
+        return -1;
+    s = Read(p.start,t->bytes);
+    line = p.ends + !t->lineStart;
+    for(unsigned int i = FirstLine(s,t->bytes,t->lineStart);i < t->bytes;){
+        int w = LineIndent(s,t->bytes,i);
+        if(w >= 0 && w <= indent)
+            found = line;
+        line += s[i - 1] == '\n';
+    }
+    return found;
+}
+
+unsigned int StructureIndex::BlockEnd(unsigned int line) {
+
+    int indent = Indent(line);
+    if(indent < 0 || line + 1 >= Lines())
+        return line;
+
+    unsigned int next = NextIndentAtMost(line + 1,indent);
+    int last = PrevIndentAtMost(next,INT_MAX - 1);
+    return last > (int)line ? last : line;
+}
+
+size_t StructureIndex::Chunks() const {
+
+    return root ? root->count : 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * The structure of a text, kept up to date with its edits: lines, bracket
+ * nesting and indentation. Matching brackets, the block around a position
+ * and the lines of an indented block are found in O(log n) instead of by
+ * scanning the buffer.
+ *
+ * The text is cut into chunks of a few KB which end at a line end. Each
+ * chunk knows its bytes, its line ends, the net change of bracket depth
+ * over it, the lowest depth reached in it and the lowest indentation of
+ * the lines starting in it. The chunks are the leaves of a treap whose
+ * nodes add these up for their subtree, so a search for the first or last
+ * place reaching a depth or an indentation goes down one path and scans
+ * one chunk at the end.
+ *
+ * An edit rescans only the chunks it touched, read back from the buffer,
+ * and those next to them until the rescanned range starts and ends at a
+ * line end without leaving small chunks. The index must be given every
+ * change of the buffer (Apply) and nothing else may edit it in between.
+ *
+ * Brackets are (), [] and {}, all of them count for the same depth; those
+ * in strings and comments count too. A line's indentation is its leading
+ * spaces and tabs, a tab to the next multiple of TAB_WIDTH. Lines with
+ * nothing else are blank and have none. A line longer than MAX_CHUNK is
+ * cut, its indentation is only seen if it ends in the first chunk.
+ *
+ * Nodes are allocated from an arena (see Arena.h).
+ */
+
+#ifndef STRUCTUREINDEX_LIBRARY_H
+#define STRUCTUREINDEX_LIBRARY_H
+
+#include "Arena.h"
+#include "GapBuffer.h"
+#include <vector>
+
+struct StructureNode;
+
+class StructureIndex{
+private:
+    GapBuffer &gb;
+    Arena &arena;
+    StructureNode * root;
+    unsigned int seed;                  //for the node priorities
+    std::vector<char> scratch;          //the text of the chunk being scanned
+
+    /*
+     * Cut the text of [from, to) into chunks.
+     * @return The treap of the chunks.
+     */
+    StructureNode * Scan(unsigned int from, unsigned int to);
+
+    /*
+     * Copy the text of a chunk into scratch.
+     */
+    const char * Read(unsigned int offset, unsigned int bytes);
+
+    /*
+     * Give the nodes of a subtree back to the arena.
+     */
+    void FreeTree(StructureNode * t);
+
+    /*
+     * Return the last character before limit where the depth after it
+     * is at most target, -1 for the start of the text if its depth 0 is,
+     * -2 if there is none.
+     */
+    long long LastAtMost(unsigned int limit, int target);
+
+    /*
+     * Return the first character from from on where the depth after it
+     * is at most target, -1 if there is none.
+     */
+    long long FirstAtMost(unsigned int from, int target);
+
+    /* There is no need for copy construction. */
+    StructureIndex(const StructureIndex &);
+
+public:
+    static const unsigned int CHUNK = 4 << 10;      //chunks end at the first line end after this many bytes
+    static const unsigned int MAX_CHUNK = 16 << 10; //a chunk is cut here even without a line end
+    static const unsigned int TAB_WIDTH = 4;
+
+    /*
+     * Index the text of a buffer.
+     * @param gb The buffer, it must outlive the index.
+     * @param a The arena the nodes are allocated from, it must outlive the index.
+     */
+    StructureIndex(GapBuffer &gb, Arena &a);
+
+    ~StructureIndex();
+
+    /*
+     * Follow a change of the buffer, it holds the text after it.
+     * @param c The change.
+     */
+    void Apply(const TextChange &c);
+
+    /*
+     * Return the bracket depth at an offset, the number of brackets open
+     * before it less the number closed. Negative after unmatched closers.
+     */
+    int Depth(unsigned int offset);
+
+    /*
+     * Find the bracket matching the one at an offset.
+     * @param offset The offset of an opening or closing bracket.
+     * @param match Set to the offset of the other one.
+     * @return False if there is no bracket at offset, it isn't matched or
+     * matched by one of another kind.
+     */
+    bool Match(unsigned int offset, unsigned int &match);
+
+    /*
+     * Find the innermost brackets around an offset.
+     * @param open Set to the offset of the opening one.
+     * @param close Set to the offset of the closing one, the size of the
+     * text if the block isn't closed.
+     * @return False if the offset isn't in brackets.
+     */
+    bool Enclosing(unsigned int offset, unsigned int &open, unsigned int &close);
+
+    /*
+     * Return the number of lines, one more than the line ends.
+     */
+    unsigned int Lines() const;
+
+    /*
+     * Return the line an offset is in.
+     */
+    unsigned int LineOf(unsigned int offset);
+
+    /*
+     * Return the offset a line starts at, the size of the text for lines
+     * past the last one.
+     */
+    unsigned int LineStart(unsigned int line);
+
+    /*
+     * Return the indentation of a line, -1 if it is blank.
+     */
+    int Indent(unsigned int line);
+
+    /*
+     * Return the first line from line from on which isn't blank and is
+     * indented at most indent, Lines() if there is none.
+     */
+    unsigned int NextIndentAtMost(unsigned int from, int indent);
+
+    /*
+     * Return the last line before line to which isn't blank and is
+     * indented at most indent, -1 if there is none.
+     */
+    int PrevIndentAtMost(unsigned int to, int indent);
+
+    /*
+     * Return the last line of the block indented deeper than a line,
+     * right after it. Blank lines at its end are not part of it.
+     * @return line itself if no such block follows it.
+     */
+    unsigned int BlockEnd(unsigned int line);
+
+    /*
+     * Return the number of chunks.
+     */
+    size_t Chunks() const;
+};
+
+#endif
@@ -0,0 +1,293 @@
+#include "TaskScheduler.h"
+
+#include <iostream>
+
+/*
+ * A token which is only cancelled explicitly.
+ */
+CancelToken::CancelToken():cancelled(new std::atomic<bool>(false)),version(nullptr),expectedVersion(0) {
+}
+
+/*
+ * A token tied to a buffer version.
+ */
+CancelToken::CancelToken(const std::atomic<unsigned long> *v):cancelled(new std::atomic<bool>(false)),
+                                                              version(v),expectedVersion(v->load()) {
+}
+
+/*
+ * The work is stale if somebody cancelled it or the buffer changed.
+ */
+bool CancelToken::IsCancelled() const {
+
+    if(cancelled->load(std::memory_order_relaxed))
+        return true;
+
+    return version && version->load(std::memory_order_relaxed) != expectedVersion;
+}
+
+/*
+ * Cancel the token and every copy of it.
+ */
+void CancelToken::Cancel() {
+    cancelled->store(true);
+}
+
+/*
+ * Keep a running maximum in an atomic.
+ */
+static void AtomicMax(std::atomic<unsigned long long> &m, unsigned long long v){
+    unsigned long long cur = m.load(std::memory_order_relaxed);
+    while(v > cur && !m.compare_exchange_weak(cur,v,std::memory_order_relaxed))
+        ;
+}
+
+/*
+ * Start the workers.
+ */
+TaskScheduler::TaskScheduler(unsigned n):stop(false),nextQueue(0),submitted(0),completed(0),cancelled(0),
+                                         stolen(0),totalWaitUs(0),maxWaitUs(0),totalRunUs(0),maxRunUs(0){
+
+    pending[0] = 0;
+    pending[1] = 0;
+
+    if(n == 0){
+        n = std::thread::hardware_concurrency();
+        n = n > 1 ? n - 1 : 1;
+    }
+
+    for(unsigned i = 0;i < n;++i)
+        queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue));
+
+    for(unsigned i = 0;i < n;++i)
+        workers.push_back(std::thread(&TaskScheduler::WorkerLoop,this,i));
+}
+
+/*
+ * Stop the workers, tasks still queued are dropped.
+ */
+TaskScheduler::~TaskScheduler() {
+
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stop = true;
+    }
+    wakeUp.notify_all();
+
+    for(auto &w : workers)
+        w.join();
+}
+
+/*
+ * Queue work into the next worker queue (round robin).
+ * Workers steal from each other, so the choice only matters for locality.
+ */
+void TaskScheduler::Submit(TASKPRIORITY p, const CancelToken &token, Work w, Completion onFailure) {
+
+    unsigned lane = static_cast<unsigned>(p);
+    unsigned i = nextQueue.fetch_add(1,std::memory_order_relaxed) % queues.size();
+
+    Task t;
+    t.work = std::move(w);
+    t.failure = std::move(onFailure);
+    t.token = token;
+    t.enqueued = std::chrono::steady_clock::now();
+
+    /* Counted before a worker can pop it, or its decrement would wrap the counter. */
+    {
+        std::lock_guard<std::mutex> lock(queues[i]->m);
+        ++pending[lane];
+        queues[i]->lanes[lane].push_back(std::move(t));
+    }
+    ++submitted;
+
+    /* Take the lock so a worker can't miss the wake up between its check and its wait. */
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wakeUp.notify_one();
+}
+
+/*
+ * Take a task of lane from queue i.
+ * The owner works from the front, thieves take from the back.
+ */
+bool TaskScheduler::TryPop(unsigned i, unsigned lane, bool steal, Task &t) {
+
+    std::lock_guard<std::mutex> lock(queues[i]->m);
+    std::deque<Task> &q = queues[i]->lanes[lane];
+
+    if(q.empty())
+        return false;
+
+    if(steal){
+        t = std::move(q.back());
+        q.pop_back();
+    }else{
+        t = std::move(q.front());
+        q.pop_front();
+    }
+    --pending[lane];
+    return true;
+}
+
+/*
+ * Find the next task for worker i, viewport lane first.
+ */
+bool TaskScheduler::FindTask(unsigned i, Task &t) {
+
+    unsigned n = queues.size();
+
+    for(unsigned lane = 0;lane < 2;++lane){
+        if(pending[lane].load() == 0)
+            continue;
+
+        if(TryPop(i,lane,false,t))
+            return true;
+
+        for(unsigned k = 1;k < n;++k){
+            if(TryPop((i + k) % n,lane,true,t)){
+                ++stolen;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/*
+ * Execute t and post its completion to the SDL thread.
+ */
+void TaskScheduler::Run(Task &t) {
+
+    typedef std::chrono::microseconds us;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    unsigned long long wait = std::chrono::duration_cast<us>(start - t.enqueued).count();
+    totalWaitUs += wait;
+    AtomicMax(maxWaitUs,wait);
+
+    Completion c;
+    if(t.token.IsCancelled()){
+        ++cancelled;
+        c = t.failure;
+    }else{
+        try{
+            c = t.work(t.token);
+        }catch(const std::exception &ex){
+            std::cout << "Task failed: " << ex.what() << std::endl;
+            c = t.failure;
+        }catch(...){
+            std::cout << "Task failed." << std::endl;
+            c = t.failure;
+        }
+
+        unsigned long long run = std::chrono::duration_cast<us>(std::chrono::steady_clock::now() - start).count();
+        totalRunUs += run;
+        AtomicMax(maxRunUs,run);
+        ++completed;
+
+        if(t.token.IsCancelled())
+            c = t.failure;
+    }
+
+    if(!c)
+        return;
+
+    PendingCompletion *pc = new PendingCompletion;
+    pc->completion = std::move(c);
+    pc->failure = t.failure;
+    pc->token = t.token;
+
+    SDL_Event event;
+    SDL_UserEvent userevent;
+
+    userevent.type = SDL_USEREVENT;
+    userevent.code = TASK_COMPLETE;
+    userevent.data1 = pc;
+    userevent.data2 = NULL;
+
+    event.type = SDL_USEREVENT;
+    event.user = userevent;
+
+    /*
+     * Callers count on the completion to clear their state, so a full
+     * event queue is waited out. Only stopping the workers drops it.
+     */
+    int pushed;
+    while((pushed = SDL_PushEvent(&event)) < 0 && !stop)
+        SDL_Delay(1);
+    if(pushed <= 0)
+        delete pc;
+}
+
+/*
+ * Main loop of worker i.
+ */
+void TaskScheduler::WorkerLoop(unsigned i) {
+
+    Task t;
+    while(true){
+        if(FindTask(i,t)){
+            Run(t);
+            t = Task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeUp.wait(lock,[this]{ return stop || pending[0] > 0 || pending[1] > 0; });
+        if(stop)
+            return;
+    }
+}
+
+/*
+ * Run a completion on the SDL thread. A stale one is dropped and its
+ * failure completion runs instead, the caller still gets to clean up.
+ */
+void TaskScheduler::RunCompletion(const SDL_Event &e) {
+
+    PendingCompletion *pc = static_cast<PendingCompletion *>(e.user.data1);
+    if(!pc)
+        return;
+
+    if(!pc->token.IsCancelled())
+        pc->completion();
+    else if(pc->failure)
+        pc->failure();
+
+    delete pc;
+}
+
+/*
+ * Return the number of tasks waiting in all lanes.
+ */
+unsigned long TaskScheduler::QueueDepth() const {
+    return pending[0].load() + pending[1].load();
+}
+
+/*
+ * Return a snapshot of the metrics.
+ */
+TaskMetrics TaskScheduler::GetMetrics() const {
+
+    TaskMetrics m;
+    m.queued[0] = pending[0].load();
+    m.queued[1] = pending[1].load();
+    m.submitted = submitted.load();
+    m.completed = completed.load();
+    m.cancelled = cancelled.load();
+    m.stolen = stolen.load();
+    m.totalWaitUs = totalWaitUs.load();
+    m.maxWaitUs = maxWaitUs.load();
+    m.totalRunUs = totalRunUs.load();
+    m.maxRunUs = maxRunUs.load();
+    return m;
+}
+
+/*
+ * Return the number of worker threads.
+ */
+unsigned TaskScheduler::WorkerCount() const {
+    return workers.size();
+}
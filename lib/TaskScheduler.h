@@ -0,0 +1,198 @@
+/*
+ * A small work-stealing thread pool used to run editor work
+ * (save, search, highlighting, indexing, file loading) off the SDL thread.
+ *
+ * Every worker owns a queue with two priority lanes. A worker always looks
+ * for viewport work (in its own queue first, then by stealing from the others)
+ * before it touches whole-file work.
+ *
+ * A task may return a completion which is marshalled back to the SDL thread
+ * through an SDL_USEREVENT(code = TASK_COMPLETE), the same way my_callbackfunc
+ * pushes the cursor flash event. The SDL thread hands that event to
+ * TaskScheduler::RunCompletion.
+ */
+
+#ifndef TASKSCHEDULER_LIBRARY_H
+#define TASKSCHEDULER_LIBRARY_H
+
+#include "SDL2/SDL.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Codes carried in SDL_UserEvent::code. */
+enum USEREVENTCODE{CURSOR_FLASH = 0,TASK_COMPLETE = 1};
+
+/* Priority lanes, the visible viewport always goes first. */
+enum class TASKPRIORITY{VIEWPORT = 0,BACKGROUND = 1};
+
+/*
+ * Cooperative cancellation.
+ * A token is cancelled either explicitly or when the buffer version it was
+ * created against has moved on, so stale work is dropped.
+ */
+class CancelToken{
+private:
+    std::shared_ptr<std::atomic<bool> > cancelled;
+    const std::atomic<unsigned long> * version;
+    unsigned long expectedVersion;
+
+public:
+    /* A token which is only cancelled explicitly. */
+    CancelToken();
+
+    /*
+     * A token tied to a buffer version.
+     * @param v The version counter of the buffer, it must outlive the token.
+     */
+    explicit CancelToken(const std::atomic<unsigned long> * v);
+
+    /*
+     * Return whether the work should be dropped.
+     */
+    bool IsCancelled() const;
+
+    /*
+     * Cancel the token and every copy of it.
+     */
+    void Cancel();
+};
+
+/*
+ * Queue depth and latency figures, all times in microseconds.
+ */
+struct TaskMetrics{
+    unsigned long queued[2];        //pending tasks per lane
+    unsigned long submitted;
+    unsigned long completed;
+    unsigned long cancelled;
+    unsigned long stolen;
+    unsigned long long totalWaitUs; //time between Submit and start
+    unsigned long long maxWaitUs;
+    unsigned long long totalRunUs;
+    unsigned long long maxRunUs;
+};
+
+class TaskScheduler{
+public:
+    /* Run on the SDL thread after the task finished, may be empty. */
+    typedef std::function<void()> Completion;
+    /* Run on a worker thread. */
+    typedef std::function<Completion(const CancelToken &)> Work;
+
+private:
+    struct Task{
+        Work work;
+        Completion failure;             //run instead of the completion if the work throws or is cancelled
+        CancelToken token;
+        std::chrono::steady_clock::time_point enqueued;
+    };
+
+    struct WorkerQueue{
+        std::mutex m;
+        std::deque<Task> lanes[2];
+    };
+
+    /* Used to carry a completion through SDL_UserEvent::data1. */
+    struct PendingCompletion{
+        Completion completion;
+        Completion failure;
+        CancelToken token;
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue> > queues;
+    std::vector<std::thread> workers;
+
+    /* Sleeping workers wait here until something is submitted. */
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    std::atomic<bool> stop;
+    std::atomic<unsigned long> pending[2];
+    std::atomic<unsigned> nextQueue;
+
+    /* Metrics */
+    std::atomic<unsigned long> submitted;
+    std::atomic<unsigned long> completed;
+    std::atomic<unsigned long> cancelled;
+    std::atomic<unsigned long> stolen;
+    std::atomic<unsigned long long> totalWaitUs;
+    std::atomic<unsigned long long> maxWaitUs;
+    std::atomic<unsigned long long> totalRunUs;
+    std::atomic<unsigned long long> maxRunUs;
+
+    /*
+     * Main loop of worker i.
+     */
+    void WorkerLoop(unsigned i);
+
+    /*
+     * Take a task of lane from queue i, from the front of our own queue
+     * or from the back of somebody else's.
+     * @return true if t is filled.
+     */
+    bool TryPop(unsigned i, unsigned lane, bool steal, Task &t);
+
+    /*
+     * Find the next task for worker i, viewport lane first.
+     */
+    bool FindTask(unsigned i, Task &t);
+
+    /*
+     * Execute t on the current worker and post its completion.
+     */
+    void Run(Task &t);
+
+    /* There is no need for copy construction. */
+    TaskScheduler(const TaskScheduler &);
+
+public:
+    /*
+     * Start the workers.
+     * @param n The number of workers, 0 means one less than the hardware threads.
+     */
+    explicit TaskScheduler(unsigned n = 0);
+
+    /* Stop the workers, tasks still queued are dropped. */
+    ~TaskScheduler();
+
+    /*
+     * Queue work.
+     * @param p The lane of the task.
+     * @param token The token checked before the task starts and before its completion runs.
+     * @param w The work itself. It should poll token.IsCancelled() when it runs long.
+     * @param onFailure Run on the SDL thread instead of the completion if the work
+     * throws or the token is cancelled, so that the caller can clear what it keeps
+     * for the task. May be empty.
+     */
+    void Submit(TASKPRIORITY p, const CancelToken &token, Work w, Completion onFailure = Completion());
+
+    /*
+     * Run a completion carried by an SDL_USEREVENT(code = TASK_COMPLETE).
+     * Must be called on the SDL thread. Stale completions are dropped, their
+     * failure completion runs instead.
+     */
+    static void RunCompletion(const SDL_Event &e);
+
+    /*
+     * Return the number of tasks waiting in all lanes.
+     */
+    unsigned long QueueDepth() const;
+
+    /*
+     * Return a snapshot of the metrics.
+     */
+    TaskMetrics GetMetrics() const;
+
+    /*
+     * Return the number of worker threads.
+     */
+    unsigned WorkerCount() const;
+};
+
+#endif
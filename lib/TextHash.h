@@ -0,0 +1,26 @@
+/*
+ * A fast hash of a piece of text, eight characters at a time.
+ * Not meant to resist attacks, only to tell texts apart.
+ */
+
+#ifndef TEXTHASH_LIBRARY_H
+#define TEXTHASH_LIBRARY_H
+
+#include <cstring>
+
+inline unsigned long long HashText(const char *s, unsigned len){
+
+    unsigned long long h = 0xCBF29CE484222325ULL ^ len;
+    unsigned i = 0;
+    for(;i + 8 <= len;i += 8){
+        unsigned long long w;
+        memcpy(&w,s + i,8);
+        h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+    for(;i < len;++i)
+        h = (h ^ (unsigned char)s[i]) * 0x100000001B3ULL;
+    return h ^ (h >> 32);
+}
+
+#endif
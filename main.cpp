@@ -6,8 +6,126 @@
 /* 这里SDL2库的导入存在问题，所以暂时先用include导入。。。。 */
 #include "EditorWindow.cpp"
 
-int main(){
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+/*
+ * Usage: SDL_first [file...] [--record trace_file] [--profile frame_trace.json]
+ *                  [--latency latency.json] [--inject-keys n] [--headless]
+ *                  [--memory-budget MB]
+ * Every file is opened as a document, Ctrl+Tab switches between them.
+ * Setting OOPEDITOR_RECORD=trace_file does the same as --record,
+ * OOPEDITOR_PROFILE=frame_trace.json the same as --profile,
+ * OOPEDITOR_LATENCY=latency.json the same as --latency and
+ * OOPEDITOR_MEMORY_BUDGET=MB the same as --memory-budget.
+ *
+ * --inject-keys types n synthetic keystrokes and quits, --headless runs on
+ * SDL's dummy video driver, together they give a scripted latency run.
+ *
+ * Offscreen, no display or GPU needed:
+ * SDL_first [file] [--save-frame out.bmp] [--golden ref.bmp] [--render-bench n]
+ * --golden exits with 3 if any pixel differs from the reference frame.
+ */
+
+/*
+ * Draw the loaded file offscreen as the flags ask, return the exit code.
+ */
+static int runOffscreen(const char *loadFile, const char *frameFile, const char *goldenFile, unsigned benchFrames){
+
+    try{
+        EditorWindow editor(true);
+        if(loadFile)
+            editor.openFile(loadFile);
+
+        if(frameFile && !editor.saveFrame(frameFile))
+            return 1;
+        if(benchFrames)
+            editor.benchRender(benchFrames,std::cout);
+        if(goldenFile){
+            unsigned long diff = editor.compareFrame(goldenFile);
+            std::cout << goldenFile << ": " << diff << " pixels differ" << std::endl;
+            if(diff)
+                return 3;
+        }
+    }catch(const std::exception &ex){
+        std::cout << ex.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]){
+
+    const char *traceFile = getenv("OOPEDITOR_RECORD");
+    const char *profileFile = getenv("OOPEDITOR_PROFILE");
+    const char *latencyFile = getenv("OOPEDITOR_LATENCY");
+    const char *budgetEnv = getenv("OOPEDITOR_MEMORY_BUDGET");
+    unsigned long budgetMB = budgetEnv ? strtoul(budgetEnv,nullptr,10) : 0;
+    unsigned injectCount = 0;
+    const char *frameFile = nullptr, *goldenFile = nullptr;
+    unsigned benchFrames = 0;
+    std::vector<const char *> files;
+
+    for(int i = 1;i < argc;++i){
+        if(strcmp(argv[i],"--headless") == 0){
+            SDL_setenv("SDL_VIDEODRIVER","dummy",1);
+            continue;
+        }
+        if(strncmp(argv[i],"--",2) != 0){
+            files.push_back(argv[i]);
+            continue;
+        }
+        if(i + 1 == argc)
+            break;
+        const char *value = argv[++i];
+        if(strcmp(argv[i - 1],"--record") == 0)
+            traceFile = value;
+        else if(strcmp(argv[i - 1],"--profile") == 0)
+            profileFile = value;
+        else if(strcmp(argv[i - 1],"--latency") == 0)
+            latencyFile = value;
+        else if(strcmp(argv[i - 1],"--inject-keys") == 0)
+            injectCount = atoi(value);
+        else if(strcmp(argv[i - 1],"--memory-budget") == 0)
+            budgetMB = strtoul(value,nullptr,10);
+        else if(strcmp(argv[i - 1],"--load") == 0)
+            files.push_back(value);
+        else if(strcmp(argv[i - 1],"--save-frame") == 0)
+            frameFile = value;
+        else if(strcmp(argv[i - 1],"--golden") == 0)
+            goldenFile = value;
+        else if(strcmp(argv[i - 1],"--render-bench") == 0)
+            benchFrames = atoi(value);
+    }
+
+    if(frameFile || goldenFile || benchFrames)
+        return runOffscreen(files.empty() ? nullptr : files[0],frameFile,goldenFile,benchFrames);
+
     EditorWindow editor;
+    if(budgetMB)
+        editor.setMemoryBudget(budgetMB << 20);
+    for(size_t i = 0;i < files.size();++i){
+        try{
+            editor.openFile(files[i]);
+        }catch(const std::exception &ex){
+            std::cout << ex.what() << std::endl;
+        }
+    }
+    if(traceFile && *traceFile){
+        try{
+            editor.startRecording(traceFile);
+        }catch(const std::exception &ex){
+            std::cout << ex.what() << " Recording is off." << std::endl;
+        }
+    }
+
+    if(profileFile && *profileFile)
+        editor.startProfiling(profileFile);
+    if(latencyFile && *latencyFile)
+        editor.reportLatency(latencyFile);
+    editor.injectKeys(injectCount);
+
     editor.show();
     std::cout << std::endl;
     return 0;
@@ -0,0 +1,157 @@
+/*
+ * Checks of FoldSet against random edits, headless.
+ * Exits with 1 and names the failed checks if any fails.
+ */
+
+#include "GapBuffer.h"
+#include "Arena.h"
+#include "StructureIndex.h"
+#include "FoldSet.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void Check(bool ok, const char *what){
+
+    if(!ok){
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+/*
+ * Walk the folds with Next() and check them against the text: each starts
+ * at a line start after a header line, they don't touch, and the rows of
+ * the lines agree with the hidden ones.
+ */
+static bool Consistent(GapBuffer &gb, StructureIndex &s, FoldSet &f){
+
+    unsigned int lines = s.Lines(), offset = 0, from, to, n, hidden = 0;
+    std::vector<bool> folded(lines,false);
+    long long previous = -2;
+    size_t count = 0;
+    while(f.Next(s,offset,from,to,n)){
+        unsigned int first = s.LineOf(from), last = first + n - 1;
+        if(n == 0 || first == 0 || last >= lines || s.LineStart(first) != from
+           || s.LineStart(last + 1) != to || (long long)first <= previous + 1)
+            return false;
+        for(unsigned int line = first;line <= last;++line)
+            folded[line] = true;
+        hidden += n;
+        previous = last;
+        ++count;
+        offset = to > from ? to : from + 1;
+        if(offset > gb.size())
+            break;
+    }
+    if(count != f.Count() || hidden != f.Hidden())
+        return false;
+
+    unsigned int row = 0;
+    for(unsigned int line = 0;line < lines;++line){
+        if(folded[line]){
+            if(f.VisualLine(line) != row - 1)
+                return false;
+            continue;
+        }
+        if(f.VisualLine(line) != row || f.BufferLine(s,row) != line)
+            return false;
+        ++row;
+    }
+    return row == f.VisualLines(s);
+}
+
+/*
+ * Folding, unfolding and edits of up to three deltas in one change, in
+ * and around the folds.
+ */
+static void TestRandomEdits(){
+
+    static const char alphabet[] = "ab  \n\n{}x";
+    Arena arena;
+    srand(5);
+    for(int round = 0;round < 40;++round){
+        GapBuffer gb;
+        std::string text;
+        for(int i = 0;i < 2000;++i)
+            text += alphabet[rand() % 9];
+        gb.InsertString(text);
+
+        StructureIndex s(gb,arena);
+        FoldSet f(arena);
+        gb.Subscribe([&](const TextChange &c){
+            s.Apply(c);
+            if(f.Count())
+                f.Apply(s,c);
+        });
+
+        bool ok = true;
+        for(int step = 0;ok && step < 100;++step){
+            int op = rand() % 4;
+            unsigned int lines = s.Lines();
+            if(op == 0){
+                unsigned int first = rand() % lines;
+                f.Fold(s,first,first + rand() % 20);
+            }else if(op == 1){
+                f.Unfold(rand() % lines);
+            }else{
+                GapBuffer::Transaction t(gb);
+                for(int j = rand() % 3;j >= 0;--j){
+                    unsigned int offset = rand() % (gb.size() + 1);
+                    gb.SetCursor(offset);
+                    if(rand() % 2){
+                        std::string inserted;
+                        for(int k = rand() % 30;k > 0;--k)
+                            inserted += alphabet[rand() % 9];
+                        gb.InsertString(inserted);
+                    }else{
+                        gb.DeleteString(std::min<unsigned int>(offset,rand() % 60));
+                    }
+                }
+            }
+            ok = Consistent(gb,s,f);
+        }
+        Check(ok,"Folds after random edits");
+    }
+}
+
+/*
+ * An indented block typed at the end of the text is folded whole.
+ */
+static void TestFoldTypedBlock(){
+
+    GapBuffer gb;
+    gb.InsertString(std::string("def f():\n"));
+    Arena arena;
+    StructureIndex s(gb,arena);
+    FoldSet f(arena);
+    gb.Subscribe([&](const TextChange &c){
+        s.Apply(c);
+        if(f.Count())
+            f.Apply(s,c);
+    });
+
+    std::string typed = "    x = 1\n    y = 2\nprint(2)";
+    for(size_t i = 0;i < typed.size();++i)
+        gb.InsertString(typed.substr(i,1));
+
+    Check(f.Fold(s,1,s.BlockEnd(0)) && f.Hidden() == 2,"Fold of a block typed at the end");
+    Check(f.BufferLine(s,1) == 3,"Line shown after the fold");
+    gb.InsertString(std::string("\n"));
+    Check(f.Hidden() == 2 && f.VisualLines(s) == 3,"Fold after typing below it");
+}
+
+int main(){
+
+    TestRandomEdits();
+    TestFoldTypedBlock();
+    if(failures)
+        return 1;
+    std::cout << "FoldSet checks passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * Checks of StructureIndex on small texts, headless.
+ * Exits with 1 and names the failed checks if any fails.
+ */
+
+#include "GapBuffer.h"
+#include "Arena.h"
+#include "StructureIndex.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+static int failures = 0;
+
+static void Check(bool ok, const char *what){
+
+    if(!ok){
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+/*
+ * A stray closer leaves the depth negative for the rest of the text, the
+ * blocks after it are still found.
+ */
+static void TestEnclosingAfterUnmatchedCloser(){
+
+    std::string text = "a ( b ) ) { c }";
+    GapBuffer gb;
+    gb.InsertString(text);
+    Arena arena;
+    StructureIndex index(gb,arena);
+
+    unsigned int brace = text.find('{'), closing = text.find('}'), open, close;
+    for(unsigned int offset = brace + 1;offset <= closing;++offset){
+        bool found = index.Enclosing(offset,open,close);
+        Check(found && open == brace && close == closing,"Enclosing inside { c } after a stray )");
+    }
+    Check(index.Enclosing(4,open,close) && open == 2 && close == 6,"Enclosing inside ( b )");
+    Check(!index.Enclosing(9,open,close),"Enclosing between the blocks");
+    Check(index.Match(brace,close) && close == closing,"Match of { after a stray )");
+}
+
+static void TestEnclosingUnclosed(){
+
+    std::string text = "x\n{\n  (y\n";
+    GapBuffer gb;
+    gb.InsertString(text);
+    Arena arena;
+    StructureIndex index(gb,arena);
+
+    unsigned int open, close;
+    Check(index.Enclosing(text.size(),open,close) && open == text.find('(') && close == text.size(),
+          "Enclosing of an unclosed block");
+    Check(!index.Enclosing(1,open,close),"Enclosing outside any block");
+}
+
+/*
+ * Compare an index kept up to date through edits with one built afresh
+ * on the same text.
+ */
+static void Compare(GapBuffer &gb, StructureIndex &index, const char *what){
+
+    Arena arena;
+    StructureIndex fresh(gb,arena);
+
+    /* Chunks may be cut elsewhere, but not into many small ones. */
+    bool ok = index.Chunks() <= 2 * fresh.Chunks() + 1 && index.Lines() == fresh.Lines();
+    for(unsigned int line = 0;ok && line < fresh.Lines();++line)
+        ok = index.Indent(line) == fresh.Indent(line) && index.LineStart(line) == fresh.LineStart(line)
+             && index.BlockEnd(line) == fresh.BlockEnd(line)
+             && index.NextIndentAtMost(line,4) == fresh.NextIndentAtMost(line,4);
+    for(unsigned int offset = 0;ok && offset <= gb.size();++offset){
+        unsigned int a = 0, b = 0;
+        ok = index.LineOf(offset) == fresh.LineOf(offset) && index.Depth(offset) == fresh.Depth(offset)
+             && index.Match(offset,a) == fresh.Match(offset,b) && a == b;
+    }
+    Check(ok,what);
+}
+
+/*
+ * The last chunk of a text usually doesn't end in a line end, typing at
+ * the end of the text must extend it rather than add chunks.
+ */
+static void TestTypingAtTheEnd(){
+
+    GapBuffer gb;
+    gb.InsertString(std::string("def f():\n"));
+    Arena arena;
+    StructureIndex index(gb,arena);
+    gb.Subscribe([&index](const TextChange &c){ index.Apply(c); });
+
+    std::string typed = "    x = 1\nprint(2)";
+    for(size_t i = 0;i < typed.size();++i)
+        gb.InsertString(typed.substr(i,1));
+
+    Check(index.Chunks() == 1,"Chunks after typing at the end");
+    Check(index.Indent(1) == 4,"Indent of a line typed at the end");
+    Check(index.BlockEnd(0) == 1,"BlockEnd of a block typed at the end");
+    Check(index.NextIndentAtMost(1,4) == 1,"NextIndentAtMost of a line typed at the end");
+    Compare(gb,index,"Index after typing at the end");
+}
+
+/*
+ * Random inserts and deletes, small and large, the index following them
+ * through Subscribe must always equal a fresh one.
+ */
+static void TestRandomEdits(){
+
+    static const char pieces[][16] = {"a","\n","    ","\t","(",")","{\n","}\n","[x]","  y = 1\n","\n\n"};
+    GapBuffer gb;
+    Arena arena;
+    StructureIndex index(gb,arena);
+    gb.Subscribe([&index](const TextChange &c){ index.Apply(c); });
+
+    srand(1);
+    for(int round = 0;round < 300;++round){
+        if(gb.size() > 0 && rand() % 3 == 0){
+            unsigned int to = rand() % gb.size() + 1;
+            unsigned int n = std::min<unsigned int>(to,rand() % 4 == 0 ? rand() % 6000 + 1 : rand() % 8 + 1);
+            gb.SetCursor(to);
+            gb.DeleteString(n);
+        }else{
+            std::string s;
+            unsigned int n = rand() % 8 == 0 ? 600 : rand() % 4 + 1;
+            for(unsigned int i = 0;i < n;++i)
+                s += pieces[rand() % (sizeof(pieces) / sizeof(pieces[0]))];
+            gb.SetCursor(rand() % 4 == 0 ? gb.size() : rand() % (gb.size() + 1));
+            gb.InsertString(s);
+        }
+        if(round % 30 == 29)
+            Compare(gb,index,"Index after random edits");
+    }
+    Compare(gb,index,"Index after random edits");
+}
+
+int main(){
+
+    TestEnclosingAfterUnmatchedCloser();
+    TestEnclosingUnclosed();
+    TestTypingAtTheEnd();
+    TestRandomEdits();
+    if(failures)
+        return 1;
+    std::cout << "StructureIndex checks passed" << std::endl;
+    return 0;
+}
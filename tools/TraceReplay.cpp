@@ -0,0 +1,286 @@
+/*
+ * Replay a recorded edit trace against a storage backend, headless.
+ *
+ * Reports ops/sec, p50/p99 latency per operation, bytes moved by gap
+ * relocation and peak RSS, so storage engines and growth policies can be
+ * compared on realistic workloads. A summary goes to stderr, JSON to stdout.
+ *
+ * Usage: trace_replay <trace> [--backend gapbuffer|string|all] [--repeat n]
+ */
+
+#include "EditTrace.h"
+#include "GapBuffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+/*
+ * A text storage the trace is replayed against.
+ * The trace positions are checked against size() before every operation.
+ */
+class ReplayBackend{
+public:
+    virtual ~ReplayBackend(){}
+    virtual const char * Name() const = 0;
+    virtual void Insert(unsigned int position, const char * s, unsigned int len) = 0;
+    virtual void Delete(unsigned int position, unsigned int len) = 0;
+    virtual void Cursor(unsigned int position) = 0;
+    virtual unsigned int Size() = 0;
+    /* Bytes moved to make room or close holes, 0 if the backend doesn't know. */
+    virtual unsigned long long BytesMoved() = 0;
+    /* Bytes copied when the storage grew, 0 if the backend doesn't know. */
+    virtual unsigned long long BytesCopied() = 0;
+    virtual std::string Text() = 0;
+};
+
+/*
+ * GapBuffer. Its own counters are used when they are compiled in,
+ * otherwise the bytes moved are worked out from where the gap must be:
+ * it sits where the last edit ended, so moving it to the next edit moves
+ * every byte in between.
+ */
+class GapBufferBackend : public ReplayBackend{
+private:
+    GapBuffer gb;
+    unsigned int gapOffset;
+    unsigned long long moved;
+
+    void MoveGap(unsigned int to){
+        moved += to > gapOffset ? to - gapOffset : gapOffset - to;
+    }
+
+public:
+    GapBufferBackend(const std::string &start):gapOffset(0),moved(0){
+        gb.InsertString(start);
+        gapOffset = start.size();
+    }
+
+    const char * Name() const{ return "gapbuffer"; }
+
+    void Insert(unsigned int position, const char *s, unsigned int len){
+        MoveGap(position);
+        gb.SetCursor(position);
+        gb.InsertString(s,len);
+        gapOffset = position + len;
+    }
+
+    void Delete(unsigned int position, unsigned int len){
+        MoveGap(position + len);
+        gb.SetCursor(position + len);
+        gb.DeleteString(len);
+        gapOffset = position;
+    }
+
+    void Cursor(unsigned int position){
+        gb.SetCursor(position);
+    }
+
+    unsigned int Size(){ return gb.size(); }
+
+    unsigned long long BytesMoved(){
+        GapBufferStats s = gb.GetStats();
+        return s.enabled ? s.bytesMoved : moved;
+    }
+
+    unsigned long long BytesCopied(){ return gb.GetStats().bytesCopied; }
+
+    std::string Text(){ return gb.GetString(0,gb.size()); }
+};
+
+/*
+ * A plain std::string, every edit moves the whole tail.
+ */
+class StringBackend : public ReplayBackend{
+private:
+    std::string text;
+    unsigned long long moved;
+
+public:
+    StringBackend(const std::string &start):text(start),moved(0){}
+
+    const char * Name() const{ return "string"; }
+
+    void Insert(unsigned int position, const char *s, unsigned int len){
+        moved += text.size() - position;
+        text.insert(position,s,len);
+    }
+
+    void Delete(unsigned int position, unsigned int len){
+        moved += text.size() - position - len;
+        text.erase(position,len);
+    }
+
+    void Cursor(unsigned int){}
+
+    unsigned int Size(){ return text.size(); }
+
+    unsigned long long BytesMoved(){ return moved; }
+
+    unsigned long long BytesCopied(){ return 0; }
+
+    std::string Text(){ return text; }
+};
+
+static ReplayBackend * MakeBackend(const std::string &name, const std::string &start){
+
+    if(name == "gapbuffer")
+        return new GapBufferBackend(start);
+    if(name == "string")
+        return new StringBackend(start);
+    throw std::runtime_error("Unknown backend " + name + ".");
+}
+
+/*
+ * Peak resident set size of this process in KB, 0 if unknown.
+ */
+static long PeakRssKb(){
+#ifndef _WIN32
+    struct rusage ru;
+    if(getrusage(RUSAGE_SELF,&ru) == 0)
+        return ru.ru_maxrss;
+#endif
+    return 0;
+}
+
+struct ReplayResult{
+    std::string backend;
+    unsigned long long ops;
+    double totalNs;
+    double p50Ns;
+    double p99Ns;
+    double maxNs;
+    unsigned long long bytesMoved;
+    unsigned long long bytesCopied;
+    long peakRssKb;
+    bool contentOk;
+};
+
+/*
+ * Replay the whole trace once.
+ */
+static ReplayResult Replay(const EditTrace &trace, const std::string &backendName){
+
+    std::unique_ptr<ReplayBackend> b(MakeBackend(backendName,trace.startContent));
+    std::vector<double> latency;
+    latency.reserve(trace.records.size());
+
+    typedef std::chrono::steady_clock clock;
+    clock::time_point begin = clock::now();
+
+    for(size_t i = 0;i < trace.records.size();++i){
+        const TraceRecord &r = trace.records[i];
+        unsigned int size = b->Size();
+
+        if(r.position > size || (r.op == TRACEOP::DELETE && r.length > size - r.position)){
+            std::cerr << "record " << i << " is out of range (position " << r.position
+                      << ", length " << r.length << ", text size " << size << ")" << std::endl;
+            throw std::runtime_error("The trace doesn't match the text.");
+        }
+
+        clock::time_point start = clock::now();
+        switch(r.op){
+            case TRACEOP::INSERT:
+                b->Insert(r.position,r.text.data(),r.text.size());
+                break;
+            case TRACEOP::DELETE:
+                b->Delete(r.position,r.length);
+                break;
+            case TRACEOP::CURSOR:
+                b->Cursor(r.position);
+                break;
+        }
+        latency.push_back(std::chrono::duration<double,std::nano>(clock::now() - start).count());
+    }
+
+    ReplayResult res;
+    res.backend = b->Name();
+    res.ops = trace.records.size();
+    res.totalNs = std::chrono::duration<double,std::nano>(clock::now() - begin).count();
+    res.bytesMoved = b->BytesMoved();
+    res.bytesCopied = b->BytesCopied();
+    res.peakRssKb = PeakRssKb();
+    res.contentOk = !trace.hasEndContent || b->Text() == trace.endContent;
+
+    std::sort(latency.begin(),latency.end());
+    res.p50Ns = latency.empty() ? 0 : latency[latency.size() / 2];
+    res.p99Ns = latency.empty() ? 0 : latency[std::min(latency.size() - 1,latency.size() * 99 / 100)];
+    res.maxNs = latency.empty() ? 0 : latency.back();
+    return res;
+}
+
+int main(int argc, char *argv[]){
+
+    std::string traceFile, backend = "all";
+    unsigned repeat = 1;
+
+    for(int i = 1;i < argc;++i){
+        std::string arg = argv[i];
+        if(arg == "--backend" && i + 1 < argc)
+            backend = argv[++i];
+        else if(arg == "--repeat" && i + 1 < argc)
+            repeat = atoi(argv[++i]);
+        else if(traceFile.empty() && arg[0] != '-')
+            traceFile = arg;
+        else
+            traceFile.clear(), i = argc;
+    }
+
+    if(traceFile.empty()){
+        std::cerr << "Usage: " << argv[0] << " <trace> [--backend gapbuffer|string|all] [--repeat n]" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> backends;
+    if(backend == "all"){
+        backends.push_back("gapbuffer");
+        backends.push_back("string");
+    }else{
+        backends.push_back(backend);
+    }
+
+    std::vector<ReplayResult> results;
+    try{
+        EditTrace trace = LoadEditTrace(traceFile.c_str());
+        std::cerr << traceFile << ": " << trace.records.size() << " operations" << std::endl;
+
+        for(const std::string &name : backends){
+            for(unsigned k = 0;k < (repeat ? repeat : 1);++k){
+                ReplayResult r = Replay(trace,name);
+                std::cerr << r.backend << ": " << r.ops / (r.totalNs / 1e9) << " ops/s, p50 " << r.p50Ns
+                          << "ns, p99 " << r.p99Ns << "ns, moved " << r.bytesMoved << " bytes, peak RSS "
+                          << r.peakRssKb << "KB" << (r.contentOk ? "" : ", END CONTENT MISMATCH") << std::endl;
+                results.push_back(r);
+            }
+        }
+    }catch(const std::exception &ex){
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+
+    /* Peak RSS is per process, run one backend per process to compare memory. */
+    std::cout << "{\n  \"results\": [";
+    bool ok = true;
+    for(size_t i = 0;i < results.size();++i){
+        const ReplayResult &r = results[i];
+        std::cout << (i ? ",\n" : "\n") << "    {\"backend\": \"" << r.backend << "\", \"ops\": " << r.ops
+                  << ", \"total_ns\": " << (unsigned long long)r.totalNs
+                  << ", \"ops_per_s\": " << (r.totalNs > 0 ? r.ops / (r.totalNs / 1e9) : 0)
+                  << ", \"p50_ns\": " << r.p50Ns << ", \"p99_ns\": " << r.p99Ns << ", \"max_ns\": " << r.maxNs
+                  << ", \"bytes_moved\": " << r.bytesMoved << ", \"bytes_copied\": " << r.bytesCopied
+                  << ", \"peak_rss_kb\": " << r.peakRssKb
+                  << ", \"content_ok\": " << (r.contentOk ? "true" : "false") << "}";
+        ok = ok && r.contentOk;
+    }
+    std::cout << "\n  ]\n}\n";
+    return ok ? 0 : 2;
+}